@@ -0,0 +1,206 @@
+// Generated workloads for esmat benchmark, which measures the per-message cost of the parts of the handler.
+//
+// The messages are built in memory from paths like those of a Mac, or from a file with one path per line,
+// e.g. the output of `find /Applications /usr /System/Library -perm +111 -type f`. Every measurement runs
+// over the whole workload repeatedly for at least a fifth of a second and reports the time per item.
+
+#pragma once
+
+#include "EndpointSecurity/EndpointSecurity.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Benchmark
+{
+   /// Executable paths in the layout of a Mac: system tools, frameworks, XPC services, apps and Homebrew.
+   inline std::vector<std::string> generatePaths(size_t count, uint32_t seed = 1)
+   {
+      static constexpr std::string_view tools[] {"zsh", "git", "clang", "ld", "python3", "node", "swift-frontend", "xcodebuild",
+                                                 "mdworker_shared", "xpcproxy", "cfprefsd", "trustd", "ls", "make", "ruby", "ssh"};
+      std::mt19937 random {seed};
+      auto pick = [&random](size_t n) { return static_cast<size_t>(random() % n); };
+      std::vector<std::string> paths {};
+      paths.reserve(count);
+      for (size_t i = 0; i < count; ++i)
+      {
+         const std::string tool {tools[pick(std::size(tools))]};
+         const std::string n = std::to_string(pick(400));
+         switch (pick(6))
+         {
+            case 0: paths.push_back("/usr/bin/" + tool); break;
+            case 1: paths.push_back("/usr/libexec/" + tool + n); break;
+            case 2: paths.push_back("/System/Library/PrivateFrameworks/Framework" + n + ".framework/Versions/A/XPCServices/com.apple.Service" + n
+                                    + ".xpc/Contents/MacOS/com.apple.Service" + n); break;
+            case 3: paths.push_back("/Applications/App" + n + ".app/Contents/MacOS/App" + n); break;
+            case 4: paths.push_back("/Applications/Xcode.app/Contents/Developer/Toolchains/XcodeDefault.xctoolchain/usr/bin/" + tool); break;
+            default: paths.push_back("/opt/homebrew/Cellar/" + tool + "/" + n + ".0/bin/" + tool); break;
+         }
+      }
+      return paths;
+   }
+
+   /// one path per line, empty lines are skipped
+   inline std::vector<std::string> readPaths(const std::string& file)
+   {
+      std::vector<std::string> paths {};
+      std::ifstream input {file};
+      for (std::string line; std::getline(input, line);)
+      {
+         if (!line.empty())
+            paths.push_back(std::move(line));
+      }
+      return paths;
+   }
+
+   /// NOTIFY_EXEC, FORK, EXIT and OPEN messages of processes running the given executables
+   class Messages
+   {
+   public:
+      explicit Messages(const std::vector<std::string>& paths, uint32_t seed = 1)
+      {
+         std::mt19937 random {seed};
+         this->paths = {paths.begin(), paths.end()};
+         for (size_t i = 0; i < this->paths.size(); ++i)
+         {
+            es_process_t& process = processes.emplace_back(processOf(this->paths[i], random));
+            es_message_t message {};
+            message.version = 4;
+            message.process = &process;
+            message.seq_num = i;
+            switch (i % 4)
+            {
+               case 0:
+               {
+                  message.event_type = ES_EVENT_TYPE_NOTIFY_EXEC;
+                  message.event.exec.target = &processes.emplace_back(processOf(this->paths[random() % this->paths.size()], random));
+                  break;
+               }
+               case 1: message.event_type = ES_EVENT_TYPE_NOTIFY_FORK; message.event.fork.child = &process; break;
+               case 2: message.event_type = ES_EVENT_TYPE_NOTIFY_EXIT; break;
+               default: message.event_type = ES_EVENT_TYPE_NOTIFY_OPEN; message.event.open.file = process.executable; break;
+            }
+            messages.push_back(message);
+         }
+      }
+
+      const std::vector<es_message_t>& all() const
+      {
+         return messages;
+      }
+
+   private:
+      es_process_t processOf(const std::string& path, std::mt19937& random)
+      {
+         es_file_t& file = files.emplace_back();
+         file.path = {path.size(), path.c_str()};
+         const std::string& signingId = strings.emplace_back("com.vendor" + std::to_string(random() % 50) + "." + path.substr(path.rfind('/') + 1));
+         es_process_t process {};
+         process.executable = &file;
+         process.signing_id = {signingId.size(), signingId.c_str()};
+         process.ppid = static_cast<pid_t>(1 + random() % 1000);
+         process.is_platform_binary = path.starts_with("/usr/") || path.starts_with("/System/");
+         // the fields read by audit_token_to_pid and audit_token_to_euid
+         process.audit_token.val[5] = 1000 + random() % 60000;
+         process.audit_token.val[1] = random() % 4 == 0 ? 0 : 501;
+         return process;
+      }
+
+      std::deque<std::string> paths {};
+      std::deque<std::string> strings {};
+      std::deque<es_file_t> files {};
+      std::deque<es_process_t> processes {};
+      std::vector<es_message_t> messages {};
+   };
+
+   /// Calls f, which handles numItems items, until at least 200 ms have passed, returns the nanoseconds per item.
+   template<typename F>
+   double nanosecondsPer(size_t numItems, F&& f)
+   {
+      using Clock = std::chrono::steady_clock;
+      const auto start = Clock::now();
+      size_t numRuns {0};
+      do
+      {
+         f();
+         numRuns++;
+      } while (Clock::now() - start < std::chrono::milliseconds {200});
+      const double nanoseconds = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+      return nanoseconds / static_cast<double>(numRuns * std::max<size_t>(1, numItems));
+   }
+
+   /// -a path patterns in the styles used for families of binaries: app bundles, tool names anywhere and frameworks.
+   /// About a quarter of them match generated paths.
+   inline std::vector<std::string> generatePatterns(size_t count)
+   {
+      std::vector<std::string> patterns {};
+      patterns.reserve(count);
+      for (size_t i = 0; i < count; ++i)
+      {
+         const std::string n = std::to_string(i);
+         switch (i % 4)
+         {
+            case 0: patterns.push_back("/Applications/App" + n + ".app/**"); break;
+            case 1: patterns.push_back("**/tool" + n + "*"); break;
+            case 2: patterns.push_back("/System/Library/PrivateFrameworks/Framework" + n + ".framework/**"); break;
+            default: patterns.push_back("/opt/homebrew/Cellar/*/" + n + ".?/bin/*"); break;
+         }
+      }
+      return patterns;
+   }
+
+   /// A filter of numClauses comparisons joined with ||, none of which matches the generated messages,
+   /// so every clause is evaluated: globs on paths and signing ids, names and numbers in turn.
+   inline std::string filterWithClauses(size_t numClauses)
+   {
+      std::string filter {};
+      for (size_t i = 0; i < numClauses; ++i)
+      {
+         const std::string n = std::to_string(i);
+         if (i > 0)
+            filter += " || ";
+         switch (i % 4)
+         {
+            case 0: filter += "process.path =~ \"/Applications/Missing" + n + ".app/**\""; break;
+            case 1: filter += "signing_id =~ \"org.missing" + n + ".*\""; break;
+            case 2: filter += "exec.target.name == \"missing" + n + "\""; break;
+            default: filter += "process.uid == " + std::to_string(1000 + i); break;
+         }
+      }
+      return filter;
+   }
+
+   /// A filter of numClauses comparisons in groups of four joined with &&, the groups joined with ||, which can't be
+   /// turned into set lookups: ranges, negations and globs mixed like in hand-written filters. The first three
+   /// comparisons of a group hold for the generated messages and the last one doesn't, so every clause is evaluated.
+   inline std::string filterWithMixedClauses(size_t numClauses)
+   {
+      std::string filter {};
+      for (size_t i = 0; i < numClauses; ++i)
+      {
+         const std::string n = std::to_string(i / 4);
+         if (i > 0)
+            filter += i % 4 == 0 ? " || " : " && ";
+         switch (i % 4)
+         {
+            case 0: filter += "(process.ppid > 0"; break;
+            case 1: filter += "process.uid != " + std::to_string(100 + i / 4); break;
+            case 2: filter += "!(process.path =~ \"/Applications/Missing" + n + ".app/**\")"; break;
+            default: filter += "process.pid < " + n + ")"; break;
+         }
+      }
+      // a last group cut short still needs its parenthesis
+      if (numClauses % 4 != 0)
+         filter += ")";
+      return filter;
+   }
+}
@@ -0,0 +1,216 @@
+// Counts per name, or per any other key, for at most a fixed number of keys.
+//
+// Once the capacity is reached a new name replaces the name with the smallest count, whose count since
+// it was taken in moves into a shared "other" bucket, so the total stays exact while memory stays flat no
+// matter how many distinct names appear. As in Space-Saving, the new name inherits the count it replaces
+// for ranking: otherwise the next new name would replace it right away and the frequent names of a long
+// tail would never be kept. The counts shown are those since a name was taken in, without the inherited
+// part. Names are found through a FlatHashMap of views into the names, which is rebuilt when the entries
+// move, other keys through a FlatHashMap of copies. The smallest count is found through
+// a lazy min-heap: counting a name leaves the heap alone, its entry in the heap keeps the count it had when
+// it was pushed, which is at most its current count. Only on replacing a name, heap entries whose count is
+// outdated are updated and sifted down until the top is current and hence the smallest. The storage grows
+// with the number of names up to the capacity.
+
+#pragma once
+
+#include "FlatHashMap.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+template<typename Key>
+class BoundedCounts
+{
+public:
+   explicit BoundedCounts(size_t capacity)
+      : capacity {std::max<size_t>(1, capacity)}
+   {
+   }
+
+   BoundedCounts(const BoundedCounts& other)
+      : capacity {other.capacity}, entries {other.entries}, heap {other.heap}, otherCount {other.otherCount}, evictions {other.evictions}
+   {
+      rebuildIndex();
+   }
+
+   /// moving a vector keeps its elements in place, so the views stay valid
+   BoundedCounts(BoundedCounts&&) noexcept = default;
+
+   BoundedCounts& operator=(BoundedCounts other) noexcept
+   {
+      std::swap(capacity, other.capacity);
+      entries.swap(other.entries);
+      index.swap(other.index);
+      heap.swap(other.heap);
+      std::swap(otherCount, other.otherCount);
+      std::swap(evictions, other.evictions);
+      return *this;
+   }
+
+   using KeyView = std::conditional_t<std::is_same_v<Key, std::string>, std::string_view, Key>;
+
+   void add(KeyView key, uint64_t count)
+   {
+      if (auto it = index.find(key); it != index.end())
+      {
+         Entry& entry = entries[it->second];
+         entry.rank += count;
+         entry.count += count;
+         return;
+      }
+
+      if (entries.size() < capacity)
+      {
+         const auto slot = static_cast<uint32_t>(entries.size());
+         const bool moves = entries.size() == entries.capacity();
+         entries.push_back({Key {key}, count, count});
+         if (moves)
+            rebuildIndex();
+         else
+            index.emplace(KeyView {entries.back().key}, slot);
+         heap.push_back({count, slot});
+         siftUp(heap.size() - 1);
+         return;
+      }
+
+      while (heap.front().rank != entries[heap.front().slot].rank)
+      {
+         heap.front().rank = entries[heap.front().slot].rank;
+         siftDown(0);
+      }
+      const uint32_t slot = heap.front().slot;
+      Entry& victim = entries[slot];
+      otherCount += victim.count;
+      evictions++;
+      index.erase(KeyView {victim.key});
+      victim.key = key;
+      victim.rank += count;
+      victim.count = count;
+      index.emplace(KeyView {victim.key}, slot);
+      heap.front().rank = victim.rank;
+      siftDown(0);
+   }
+
+   /// adds all counts of other, including its other bucket
+   void merge(const BoundedCounts& other)
+   {
+      for (const auto& entry : other.entries)
+         add(entry.key, entry.count);
+      otherCount += other.otherCount;
+   }
+
+   template<typename F>
+   void forEach(F&& f) const
+   {
+      for (const auto& entry : entries)
+         f(entry.key, entry.count);
+   }
+
+   /// sum of the counts of all names which were replaced
+   uint64_t other() const
+   {
+      return otherCount;
+   }
+
+   /// number of names replaced since the last call of resetEvictions
+   uint64_t numEvictions() const
+   {
+      return evictions;
+   }
+
+   void resetEvictions()
+   {
+      evictions = 0;
+   }
+
+   bool empty() const
+   {
+      return entries.empty() && otherCount == 0;
+   }
+
+   size_t longestName() const requires std::is_same_v<Key, std::string>
+   {
+      size_t longest {0};
+      for (const auto& entry : entries)
+         longest = std::max(longest, entry.key.length());
+      return longest;
+   }
+
+   void clear()
+   {
+      index.clear();
+      entries.clear();
+      heap.clear();
+      otherCount = 0;
+   }
+
+private:
+   struct Entry
+   {
+      Key key {};
+      /// count including the counts of the names it replaced, orders the heap
+      uint64_t rank {0};
+      /// count since the name was taken in
+      uint64_t count {0};
+   };
+
+   /// an entry of the heap with the rank of its entry when it was last sifted
+   struct HeapEntry
+   {
+      uint64_t rank;
+      uint32_t slot;
+   };
+
+   void rebuildIndex()
+   {
+      index.clear();
+      index.reserve(entries.size());
+      for (uint32_t slot = 0; slot < entries.size(); ++slot)
+         index.emplace(KeyView {entries[slot].key}, slot);
+   }
+
+   void siftUp(size_t position)
+   {
+      while (position > 0)
+      {
+         const size_t parent = (position - 1) / 2;
+         if (heap[parent].rank <= heap[position].rank)
+            return;
+         std::swap(heap[parent], heap[position]);
+         position = parent;
+      }
+   }
+
+   /// ranks only grow, so an entry only moves towards the leaves
+   void siftDown(size_t position)
+   {
+      const size_t size = heap.size();
+      while (true)
+      {
+         size_t smallest = position;
+         const size_t left = 2 * position + 1;
+         const size_t right = left + 1;
+         if (left < size && heap[left].rank < heap[smallest].rank)
+            smallest = left;
+         if (right < size && heap[right].rank < heap[smallest].rank)
+            smallest = right;
+         if (smallest == position)
+            return;
+         std::swap(heap[position], heap[smallest]);
+         position = smallest;
+      }
+   }
+
+   size_t capacity;
+   std::vector<Entry> entries {};
+   FlatHashMap<KeyView, uint32_t> index {};
+   /// min-heap of the slots in entries by their rank when they were last sifted
+   std::vector<HeapEntry> heap {};
+   uint64_t otherCount {0};
+   uint64_t evictions {0};
+};
@@ -0,0 +1,117 @@
+// Finds message bursts with millisecond resolution.
+//
+// Messages are counted in 1 ms or 10 ms buckets of a ring holding the last 128 buckets. Like RateRing
+// the ring is advanced by the counting thread when a message falls into a new bucket; completing a
+// bucket updates the sums of the sliding 10 ms and 100 ms windows ending with it, their maxima and the
+// profile of the aligned 10 ms windows. Long pauses complete at most one ring of empty buckets, the
+// rest of the pause only adds to the number of empty windows.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+
+class BurstRing
+{
+public:
+   /// windows of the profile by number of messages: 0, 1, 2-3, 4-7, ... , >= 2^15
+   static constexpr size_t numProfileBins = 17;
+
+   explicit BurstRing(uint64_t resolutionMs)
+      : resolutionMs {resolutionMs}, ticksPer10Ms {10 / resolutionMs}, ticksPer100Ms {100 / resolutionMs}
+   {
+   }
+
+   void add(uint64_t timeMs)
+   {
+      const uint64_t tick = timeMs / resolutionMs;
+      if (tick != currentTick)
+      {
+         if (currentTick == 0)
+            currentTick = tick;
+         else if (tick > currentTick)
+            advance(tick);
+      }
+      // late messages are counted in the current bucket
+      auto& bucket = buckets[currentTick % numBuckets];
+      if (bucket < UINT16_MAX)
+         bucket++;
+   }
+
+   /// most messages in any 10 ms window since the last reset
+   uint64_t max10Ms() const
+   {
+      return max10;
+   }
+
+   /// most messages in any 100 ms window since the last reset
+   uint64_t max100Ms() const
+   {
+      return max100;
+   }
+
+   /// number of aligned 10 ms windows since the last reset per profile bin
+   const std::array<uint64_t, numProfileBins>& profile() const
+   {
+      return windows;
+   }
+
+   static const char* profileBinLabel(size_t bin)
+   {
+      static constexpr std::array<const char*, numProfileBins> labels {
+         "0", "1", "2-3", "4-7", "8-15", "16-31", "32-63", "64-127", "128-255", "256-511", "512-1k",
+         "1k-2k", "2k-4k", "4k-8k", "8k-16k", "16k-32k", ">=32k"
+      };
+      return labels[bin];
+   }
+
+   void reset()
+   {
+      max10 = 0;
+      max100 = 0;
+      windows.fill(0);
+   }
+
+private:
+   static constexpr uint64_t numBuckets = 128;
+
+   void advance(uint64_t tick)
+   {
+      for (uint64_t step = 0; step < numBuckets && currentTick < tick; ++step)
+         completeTick();
+      if (currentTick < tick)
+      {
+         // the whole ring is empty by now, so all windows until tick are empty
+         windows[0] += tick / ticksPer10Ms - currentTick / ticksPer10Ms;
+         currentTick = tick;
+      }
+   }
+
+   void completeTick()
+   {
+      const uint64_t count = buckets[currentTick % numBuckets];
+      // the buckets leaving the windows are still in the ring because it is longer than 100 ms
+      sum10 += count - buckets[(currentTick + numBuckets - ticksPer10Ms) % numBuckets];
+      sum100 += count - buckets[(currentTick + numBuckets - ticksPer100Ms) % numBuckets];
+      max10 = std::max(max10, sum10);
+      max100 = std::max(max100, sum100);
+      if ((currentTick + 1) % ticksPer10Ms == 0)
+         windows[std::min<size_t>(std::bit_width(sum10), numProfileBins - 1)]++;
+
+      currentTick++;
+      buckets[currentTick % numBuckets] = 0;
+   }
+
+   uint64_t resolutionMs;
+   uint64_t ticksPer10Ms;
+   uint64_t ticksPer100Ms;
+   std::array<uint16_t, numBuckets> buckets {};
+   uint64_t currentTick {0};
+   uint64_t sum10 {0};
+   uint64_t sum100 {0};
+   uint64_t max10 {0};
+   uint64_t max100 {0};
+   std::array<uint64_t, numProfileBins> windows {};
+};
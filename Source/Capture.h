@@ -0,0 +1,182 @@
+// Format of the capture files written by the flight recorder.
+//
+// A capture starts with a FileHeader, followed by blocks of records and an index of the blocks. The
+// records of a block are in the order the messages were handled, a record is a RecordHeader followed
+// by the executable path of the process and the path of the file the event acts on (the target
+// executable for NOTIFY_EXEC), padded to a multiple of 8 bytes so headers can be read in place from a
+// mapped file. Records never span blocks. A block holds at most blockSize bytes of records, it is
+// stored either as is or packed by CaptureCodec, optionally compressed on top.
+//
+// The index at the end of the file holds a BlockInfo per block with its time range, the event types
+// and the pid range of its records, followed by a Footer which locates the index. Readers use it to
+// skip all blocks outside of the requested time range or without the requested event types.
+// Captures of several recordings can be merged into one, see CaptureMerger.h, its records tell which
+// recording they come from.
+// Integers are stored in the byte order of the machine which wrote the capture, which is little
+// endian on all Macs.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+namespace Capture
+{
+
+constexpr std::array<char, 8> magic {'E', 'S', 'M', 'A', 'T', 'C', 'A', 'P'};
+constexpr std::array<char, 8> footerMagic {'E', 'S', 'M', 'A', 'T', 'I', 'D', 'X'};
+constexpr uint32_t version = 3;
+constexpr size_t alignment = 8;
+/// longer paths are truncated
+constexpr size_t maxPathLength = 4096;
+constexpr uint32_t defaultBlockSize = 64 * 1024;
+/// larger blocks are taken for damage, decoding never allocates more than this
+constexpr uint32_t maxBlockSize = 16 * 1024 * 1024;
+/// the first block starts at a page boundary
+constexpr uint64_t dataOffset = 16 * 1024;
+/// event types are numbered below this, one bit each in BlockInfo::eventTypes
+constexpr size_t maxEventTypes = 256;
+
+/// BlockInfo::encoding: the low byte tells how records are stored, the next one the compressor applied on top
+constexpr uint32_t encodingRaw = 0;
+/// paths interned per block, integers as varints, times and seq_nums as deltas
+constexpr uint32_t encodingPacked = 1;
+enum class Compressor : uint32_t
+{
+   none = 0,
+   lz4 = 1,
+   lzfse = 2,
+   zlib = 3,
+};
+
+inline uint32_t encoding(uint32_t layout, Compressor compressor)
+{
+   return layout | static_cast<uint32_t>(compressor) << 8;
+}
+
+inline uint32_t layoutOf(uint32_t encoding)
+{
+   return encoding & 0xff;
+}
+
+inline Compressor compressorOf(uint32_t encoding)
+{
+   return static_cast<Compressor>(encoding >> 8 & 0xff);
+}
+
+/// FileHeader::flags: only messages selected with --record-apps or --record-path were recorded, so gaps between seq_nums
+/// are not necessarily missing messages. --record-events alone does not set it, seq_nums count per event type.
+constexpr uint32_t selectedRecords = 1;
+
+/// RecordHeader::flags: the low byte holds flags, the high byte the source of the record in a merged capture
+constexpr uint16_t matchedFilter = 1;
+constexpr unsigned sourceShift = 8;
+/// sources a merged capture can have
+constexpr uint32_t maxSources = 256;
+/// RecordHeader::eventType of the filler at the end of the flight recorder ring, never written to a capture
+constexpr uint16_t wrapMarker = UINT16_MAX;
+
+struct FileHeader
+{
+   std::array<char, 8> magic {Capture::magic};
+   uint32_t version {Capture::version};
+   uint32_t headerSize {sizeof(FileHeader)};
+   /// when the recording was frozen, nanoseconds since the epoch
+   uint64_t frozenAt {0};
+   uint64_t numRecords {0};
+   /// records which were overwritten in the ring before it was frozen
+   uint64_t numOverwritten {0};
+   /// bytes of a block, the first one starts at dataOffset
+   uint32_t blockSize {defaultBlockSize};
+   /// recordings merged into the capture, seq_nums and pids are only comparable between records of the same source
+   uint32_t numSources {1};
+   /// what caused the dump, zero terminated
+   std::array<char, 64> reason {};
+   /// FileHeader flags
+   uint32_t flags {0};
+   uint32_t reserved {0};
+};
+
+struct RecordHeader
+{
+   /// bytes of the record including header, paths and padding
+   uint32_t size {0};
+   uint16_t eventType {0};
+   uint16_t flags {0};
+   /// message time, nanoseconds since the epoch
+   uint64_t time {0};
+   uint64_t seqNum {0};
+   int32_t pid {0};
+   int32_t pidVersion {0};
+   int32_t ppid {0};
+   uint32_t uid {0};
+   /// the child of NOTIFY_FORK or the new image of NOTIFY_EXEC, 0 otherwise
+   int32_t relatedPid {0};
+   int32_t relatedPidVersion {0};
+   /// exit status of NOTIFY_EXIT
+   int32_t status {0};
+   uint16_t executableLength {0};
+   uint16_t fileLength {0};
+};
+static_assert(sizeof(RecordHeader) == 56 && sizeof(RecordHeader) % alignment == 0);
+
+struct BlockInfo
+{
+   /// position in the file and bytes used by the records once decoded
+   uint64_t offset {0};
+   uint32_t size {0};
+   uint32_t numRecords {0};
+   /// bytes in the file
+   uint32_t storedSize {0};
+   uint32_t encoding {encodingRaw};
+   /// smallest and largest message time of the records
+   uint64_t firstTime {UINT64_MAX};
+   uint64_t lastTime {0};
+   int32_t minPid {INT32_MAX};
+   int32_t maxPid {INT32_MIN};
+   /// bit n is set if a record has event type n
+   std::array<uint64_t, maxEventTypes / 64> eventTypes {};
+
+   void add(const RecordHeader& record)
+   {
+      numRecords++;
+      firstTime = record.time < firstTime ? record.time : firstTime;
+      lastTime = record.time > lastTime ? record.time : lastTime;
+      minPid = record.pid < minPid ? record.pid : minPid;
+      maxPid = record.pid > maxPid ? record.pid : maxPid;
+      if (record.eventType < maxEventTypes)
+         eventTypes[record.eventType / 64] |= uint64_t {1} << (record.eventType % 64);
+   }
+};
+static_assert(sizeof(BlockInfo) == 80);
+
+struct Footer
+{
+   uint64_t indexOffset {0};
+   uint64_t numBlocks {0};
+   std::array<char, 8> magic {footerMagic};
+};
+
+inline uint8_t sourceOf(const RecordHeader& record)
+{
+   return static_cast<uint8_t>(record.flags >> sourceShift);
+}
+
+inline uint32_t recordSize(size_t executableLength, size_t fileLength)
+{
+   return static_cast<uint32_t>((sizeof(RecordHeader) + executableLength + fileLength + alignment - 1) & ~(alignment - 1));
+}
+
+/// the paths following a record header
+inline std::string_view executablePath(const RecordHeader& header)
+{
+   return {reinterpret_cast<const char*>(&header + 1), header.executableLength};
+}
+
+inline std::string_view filePath(const RecordHeader& header)
+{
+   return {reinterpret_cast<const char*>(&header + 1) + header.executableLength, header.fileLength};
+}
+
+}
@@ -0,0 +1,306 @@
+// Packs and unpacks blocks of capture records, see Capture.h.
+//
+// Raw records are large because the same few executable and file paths repeat over and over and
+// because times and sequence numbers take 8 bytes although they grow in small steps. A packed block
+// starts with a dictionary holding every distinct path of the block once, records refer to paths by
+// their index in it. All integers are LEB128 varints: times are stored as difference to the previous
+// record, sequence numbers as difference to the previous record of the same event type and pids as
+// difference to the previous record's pid, zigzag encoded so small negative steps stay small.
+//
+// Packed blocks can be compressed on top with the Compression framework, blocks which would not get
+// smaller are stored as they are.
+
+#pragma once
+
+#include "Capture.h"
+
+#if __has_include(<compression.h>)
+#include <compression.h>
+#define ESMAT_HAS_COMPRESSION 1
+#endif
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace CaptureCodec
+{
+
+inline void putVarint(std::vector<std::byte>& out, uint64_t value)
+{
+   while (value >= 0x80)
+   {
+      out.push_back(static_cast<std::byte>(value | 0x80));
+      value >>= 7;
+   }
+   out.push_back(static_cast<std::byte>(value));
+}
+
+inline uint64_t zigzag(int64_t value)
+{
+   return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value)
+{
+   return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+/// reads varints from a buffer, ok turns false once it is read past its end
+struct Reader
+{
+   const std::byte* position;
+   const std::byte* end;
+   bool ok {true};
+
+   uint64_t varint()
+   {
+      uint64_t value {0};
+      for (unsigned shift = 0; shift < 64; shift += 7)
+      {
+         if (position == end)
+            break;
+         const auto byte = static_cast<uint8_t>(*position++);
+         value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+         if (byte < 0x80)
+            return value;
+      }
+      ok = false;
+      return 0;
+   }
+
+   size_t remaining() const
+   {
+      return static_cast<size_t>(end - position);
+   }
+
+   std::string_view bytes(size_t length)
+   {
+      if (static_cast<size_t>(end - position) < length)
+      {
+         ok = false;
+         return {};
+      }
+      const std::string_view result {reinterpret_cast<const char*>(position), length};
+      position += length;
+      return result;
+   }
+};
+
+/// the deltas of a record are relative to this state, which is the same for packing and unpacking
+struct DeltaState
+{
+   uint64_t time {0};
+   int64_t pid {0};
+   std::array<uint64_t, Capture::maxEventTypes> seqNums {};
+
+   uint64_t& seqNum(uint16_t eventType)
+   {
+      return seqNums[eventType % Capture::maxEventTypes];
+   }
+};
+
+inline void pack(std::span<const std::byte> raw, std::vector<std::byte>& out)
+{
+   std::vector<const Capture::RecordHeader*> records {};
+   std::unordered_map<std::string_view, uint32_t> dictionary {};
+   std::vector<std::string_view> paths {};
+   auto intern = [&](std::string_view path) {
+      auto [entry, inserted] = dictionary.try_emplace(path, static_cast<uint32_t>(paths.size()));
+      if (inserted)
+         paths.push_back(path);
+   };
+   for (size_t offset = 0; offset + sizeof(Capture::RecordHeader) <= raw.size();)
+   {
+      const auto& record = *reinterpret_cast<const Capture::RecordHeader*>(raw.data() + offset);
+      records.push_back(&record);
+      intern(Capture::executablePath(record));
+      intern(Capture::filePath(record));
+      offset += record.size;
+   }
+
+   out.clear();
+   putVarint(out, paths.size());
+   for (const auto path : paths)
+   {
+      putVarint(out, path.size());
+      const auto* bytes = reinterpret_cast<const std::byte*>(path.data());
+      out.insert(out.end(), bytes, bytes + path.size());
+   }
+   putVarint(out, records.size());
+   DeltaState previous {};
+   for (const auto* record : records)
+   {
+      putVarint(out, record->eventType);
+      putVarint(out, record->flags);
+      putVarint(out, zigzag(static_cast<int64_t>(record->time - previous.time)));
+      auto& seqNum = previous.seqNum(record->eventType);
+      putVarint(out, zigzag(static_cast<int64_t>(record->seqNum - seqNum)));
+      putVarint(out, zigzag(record->pid - previous.pid));
+      putVarint(out, zigzag(record->pidVersion));
+      putVarint(out, zigzag(record->ppid));
+      putVarint(out, record->uid);
+      putVarint(out, zigzag(record->relatedPid));
+      putVarint(out, zigzag(record->relatedPidVersion));
+      putVarint(out, zigzag(record->status));
+      putVarint(out, dictionary.at(Capture::executablePath(*record)));
+      putVarint(out, dictionary.at(Capture::filePath(*record)));
+      previous.time = record->time;
+      previous.pid = record->pid;
+      seqNum = record->seqNum;
+   }
+}
+
+/// the fields of a packed record, each one takes at least one byte
+constexpr size_t minPackedRecordSize = 13;
+
+/// rebuilds the raw records of a packed block, returns false if the block is damaged
+inline bool unpack(std::span<const std::byte> packed, size_t rawSize, std::vector<std::byte>& raw)
+{
+   if (rawSize > Capture::maxBlockSize)
+      return false;
+   Reader in {packed.data(), packed.data() + packed.size()};
+   // counts are checked against the bytes left before anything is allocated for them, every path
+   // takes at least the byte of its length and every record at least one byte per field
+   const uint64_t numPaths = in.varint();
+   if (!in.ok || numPaths > in.remaining())
+      return false;
+   std::vector<std::string_view> paths(numPaths);
+   for (auto& path : paths)
+      path = in.bytes(in.varint());
+
+   // only the padding of the records needs to be zeroed, buffers are reused for block after block
+   raw.resize(rawSize);
+   size_t offset {0};
+   const uint64_t numRecords = in.varint();
+   if (!in.ok || numRecords > in.remaining() / minPackedRecordSize)
+      return false;
+   DeltaState previous {};
+   for (uint64_t i = 0; i < numRecords && in.ok; ++i)
+   {
+      Capture::RecordHeader record {};
+      record.eventType = static_cast<uint16_t>(in.varint());
+      record.flags = static_cast<uint16_t>(in.varint());
+      record.time = previous.time + static_cast<uint64_t>(unzigzag(in.varint()));
+      auto& seqNum = previous.seqNum(record.eventType);
+      record.seqNum = seqNum + static_cast<uint64_t>(unzigzag(in.varint()));
+      record.pid = static_cast<int32_t>(previous.pid + unzigzag(in.varint()));
+      record.pidVersion = static_cast<int32_t>(unzigzag(in.varint()));
+      record.ppid = static_cast<int32_t>(unzigzag(in.varint()));
+      record.uid = static_cast<uint32_t>(in.varint());
+      record.relatedPid = static_cast<int32_t>(unzigzag(in.varint()));
+      record.relatedPidVersion = static_cast<int32_t>(unzigzag(in.varint()));
+      record.status = static_cast<int32_t>(unzigzag(in.varint()));
+      const uint64_t executable = in.varint();
+      const uint64_t file = in.varint();
+      if (!in.ok || executable >= paths.size() || file >= paths.size())
+         return false;
+      record.executableLength = static_cast<uint16_t>(paths[executable].size());
+      record.fileLength = static_cast<uint16_t>(paths[file].size());
+      record.size = Capture::recordSize(record.executableLength, record.fileLength);
+      if (offset + record.size > rawSize)
+         return false;
+
+      std::memcpy(raw.data() + offset, &record, sizeof(record));
+      std::memcpy(raw.data() + offset + sizeof(record), paths[executable].data(), record.executableLength);
+      std::memcpy(raw.data() + offset + sizeof(record) + record.executableLength, paths[file].data(), record.fileLength);
+      const size_t used = sizeof(record) + record.executableLength + record.fileLength;
+      std::memset(raw.data() + offset + used, 0, record.size - used);
+      offset += record.size;
+      previous.time = record.time;
+      previous.pid = record.pid;
+      seqNum = record.seqNum;
+   }
+   return in.ok && offset == rawSize;
+}
+
+inline bool available(Capture::Compressor compressor)
+{
+#ifdef ESMAT_HAS_COMPRESSION
+   return compressor <= Capture::Compressor::zlib;
+#else
+   return compressor == Capture::Compressor::none;
+#endif
+}
+
+#ifdef ESMAT_HAS_COMPRESSION
+inline compression_algorithm algorithmOf(Capture::Compressor compressor)
+{
+   switch (compressor)
+   {
+      case Capture::Compressor::lz4: return COMPRESSION_LZ4;
+      case Capture::Compressor::lzfse: return COMPRESSION_LZFSE;
+      default: return COMPRESSION_ZLIB;
+   }
+}
+#endif
+
+/// Encodes a raw block into out and returns the encoding used, which lacks the compressor if compressing did not pay off.
+inline uint32_t encode(std::span<const std::byte> raw, Capture::Compressor compressor, std::vector<std::byte>& scratch, std::vector<std::byte>& out)
+{
+   if (compressor == Capture::Compressor::none || !available(compressor))
+   {
+      pack(raw, out);
+      return Capture::encodingPacked;
+   }
+
+   pack(raw, scratch);
+#ifdef ESMAT_HAS_COMPRESSION
+   // the compressed block starts with the size of the packed one
+   const auto packedSize = static_cast<uint32_t>(scratch.size());
+   out.resize(sizeof(packedSize) + scratch.size());
+   std::memcpy(out.data(), &packedSize, sizeof(packedSize));
+   const size_t compressedSize = compression_encode_buffer(reinterpret_cast<uint8_t*>(out.data() + sizeof(packedSize)), scratch.size(),
+                                                           reinterpret_cast<const uint8_t*>(scratch.data()), scratch.size(), nullptr,
+                                                           algorithmOf(compressor));
+   if (compressedSize > 0 && compressedSize < scratch.size())
+   {
+      out.resize(sizeof(packedSize) + compressedSize);
+      return Capture::encoding(Capture::encodingPacked, compressor);
+   }
+#endif
+   out.swap(scratch);
+   return Capture::encodingPacked;
+}
+
+/// Decodes a stored block into its raw records, returns false if the block is damaged or its compressor is not available.
+inline bool decode(std::span<const std::byte> stored, const Capture::BlockInfo& info, [[maybe_unused]] std::vector<std::byte>& scratch,
+                   std::vector<std::byte>& raw)
+{
+   switch (Capture::layoutOf(info.encoding))
+   {
+      case Capture::encodingRaw:
+         raw.assign(stored.begin(), stored.end());
+         return true;
+      case Capture::encodingPacked:
+         break;
+      default:
+         return false;
+   }
+
+   const auto compressor = Capture::compressorOf(info.encoding);
+   if (compressor == Capture::Compressor::none)
+      return unpack(stored, info.size, raw);
+   if (!available(compressor) || stored.size() < sizeof(uint32_t))
+      return false;
+#ifdef ESMAT_HAS_COMPRESSION
+   uint32_t packedSize {0};
+   std::memcpy(&packedSize, stored.data(), sizeof(packedSize));
+   if (packedSize > Capture::maxBlockSize || info.size > Capture::maxBlockSize)
+      return false;
+   scratch.resize(packedSize);
+   const size_t decodedSize = compression_decode_buffer(reinterpret_cast<uint8_t*>(scratch.data()), packedSize,
+                                                        reinterpret_cast<const uint8_t*>(stored.data() + sizeof(packedSize)),
+                                                        stored.size() - sizeof(packedSize), nullptr, algorithmOf(compressor));
+   return decodedSize == packedSize && unpack(scratch, info.size, raw);
+#else
+   return false;
+#endif
+}
+
+}
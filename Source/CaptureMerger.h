@@ -0,0 +1,209 @@
+// Merges capture files, e.g. of several clients or Macs, into one timeline ordered by message time.
+//
+// Every input is read through a cursor which holds one decoded block, so memory stays bounded by
+// the number of inputs no matter how large they are. The cursors are kept in a heap by the time of
+// their current record and the record of the earliest one is taken until all of them ran out. The
+// records of a capture are in the order they were handled, which can differ slightly from their
+// time order, so the records of each block are sorted by time when the block is loaded.
+//
+// Paths need no remapping on their own: the dictionary of a packed block only lives as long as the
+// block, records are decoded to their paths and interned again into the blocks of the output.
+// Sources are remapped instead, the records of the n-th input get the sources after those of the
+// inputs before it, so seq_nums and pids of different recordings are never compared.
+
+#pragma once
+
+#include "Capture.h"
+#include "CaptureReader.h"
+#include "CaptureWriter.h"
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+class CaptureMerger
+{
+public:
+   struct Statistics
+   {
+      uint64_t numRecords {0};
+      /// blocks which could not be decoded and were skipped
+      uint64_t numDamagedBlocks {0};
+      CaptureWriter::Statistics written {};
+   };
+
+   /// Adds an input, returns false if it can't be read, see error.
+   bool add(const std::string& path)
+   {
+      auto reader = std::make_unique<CaptureReader>(path);
+      if (!reader->valid())
+      {
+         errorMessage = path + ": " + reader->error();
+         return false;
+      }
+      const uint32_t numSources = std::max<uint32_t>(1, reader->header().numSources);
+      if (numSources + nextSource > Capture::maxSources)
+      {
+         errorMessage = path + ": more than " + std::to_string(Capture::maxSources) + " recordings can't be merged";
+         return false;
+      }
+      cursors.push_back(std::make_unique<Cursor>(std::move(reader), static_cast<uint8_t>(nextSource)));
+      nextSource += numSources;
+      return true;
+   }
+
+   const std::string& error() const
+   {
+      return errorMessage;
+   }
+
+   /// header of the merged capture
+   Capture::FileHeader header() const
+   {
+      Capture::FileHeader header {};
+      header.numSources = std::max<uint32_t>(1, nextSource);
+      for (const auto& cursor : cursors)
+      {
+         header.frozenAt = std::max(header.frozenAt, cursor->reader->header().frozenAt);
+         header.numOverwritten += cursor->reader->header().numOverwritten;
+         header.flags |= cursor->reader->header().flags;
+      }
+      const std::string reason = "merge of " + std::to_string(cursors.size()) + " captures";
+      reason.copy(header.reason.data(), header.reason.size() - 1);
+      return header;
+   }
+
+   /// Calls f for the records of all inputs selected by the filter in the order of their time, records
+   /// with the same time in the order of the inputs. Can only be called once.
+   template<typename F>
+   void forEachRecord(const CaptureFilter& filter, F&& f)
+   {
+      auto later = [this](size_t a, size_t b) {
+         const uint64_t timeA = cursors[a]->current().time;
+         const uint64_t timeB = cursors[b]->current().time;
+         return timeA > timeB || (timeA == timeB && a > b);
+      };
+      std::vector<size_t> heap {};
+      for (size_t i = 0; i < cursors.size(); ++i)
+      {
+         if (cursors[i]->start(filter))
+            heap.push_back(i);
+      }
+      std::ranges::make_heap(heap, later);
+
+      std::vector<std::byte> record {};
+      while (!heap.empty())
+      {
+         std::ranges::pop_heap(heap, later);
+         Cursor& cursor = *cursors[heap.back()];
+         // the record is copied, raw blocks are mapped read-only
+         const auto& current = cursor.current();
+         record.assign(reinterpret_cast<const std::byte*>(&current), reinterpret_cast<const std::byte*>(&current) + current.size);
+         auto& header = *reinterpret_cast<Capture::RecordHeader*>(record.data());
+         header.flags = static_cast<uint16_t>((header.flags & 0xff) | (cursor.firstSource + Capture::sourceOf(current)) << Capture::sourceShift);
+         f(header);
+         stats.numRecords++;
+
+         if (cursor.advance(filter))
+            std::ranges::push_heap(heap, later);
+         else
+            heap.pop_back();
+      }
+      for (const auto& cursor : cursors)
+         stats.numDamagedBlocks += cursor->numDamagedBlocks;
+   }
+
+   /// Writes the records selected by the filter to a new capture, returns nothing if it could not be written.
+   std::optional<Statistics> merge(const std::string& path, const CaptureFilter& filter, Capture::Compressor compressor, WorkStealingPool* pool)
+   {
+      CaptureWriter writer {path, header(), compressor, pool};
+      if (!writer.valid())
+         return std::nullopt;
+      forEachRecord(filter, [&writer](const Capture::RecordHeader& record) {
+         writer.add(record);
+      });
+      if (!writer.finish())
+         return std::nullopt;
+      stats.written = writer.statistics();
+      return stats;
+   }
+
+private:
+   /// the selected records of one input, one block at a time
+   struct Cursor
+   {
+      Cursor(std::unique_ptr<CaptureReader> reader, uint8_t firstSource) : reader {std::move(reader)}, firstSource {firstSource}
+      {
+      }
+
+      /// moves to the first selected record, returns false if there is none
+      bool start(const CaptureFilter& filter)
+      {
+         for (size_t i = 0; i < reader->blocks().size(); ++i)
+         {
+            if (filter.overlaps(reader->blocks()[i]))
+               blocks.push_back(i);
+         }
+         return advance(filter);
+      }
+
+      /// moves to the next selected record, returns false at the end of the input
+      bool advance(const CaptureFilter& filter)
+      {
+         if (++nextRecord < records.size())
+            return true;
+         while (nextBlock < blocks.size())
+         {
+            if (nextBlock > 0)
+               reader->release(blocks[nextBlock - 1]);
+            // the next block is read ahead while this one is merged
+            if (nextBlock + 1 < blocks.size())
+               reader->prefetch(blocks[nextBlock + 1]);
+            load(blocks[nextBlock++], filter);
+            if (!records.empty())
+               return true;
+         }
+         return false;
+      }
+
+      const Capture::RecordHeader& current() const
+      {
+         return *records[nextRecord];
+      }
+
+      void load(size_t block, const CaptureFilter& filter)
+      {
+         records.clear();
+         nextRecord = 0;
+         const auto recordsOfBlock = reader->recordsOf(block, scratch, buffer);
+         if (!recordsOfBlock || !CaptureReader::forEachRecord(*recordsOfBlock, filter, [this](const Capture::RecordHeader& record) {
+                records.push_back(&record);
+             }))
+            numDamagedBlocks++;
+         if (!std::ranges::is_sorted(records, {}, &Capture::RecordHeader::time))
+            std::ranges::stable_sort(records, {}, &Capture::RecordHeader::time);
+      }
+
+      std::unique_ptr<CaptureReader> reader;
+      uint8_t firstSource;
+      std::vector<size_t> blocks {};
+      size_t nextBlock {0};
+      std::vector<std::byte> scratch {};
+      std::vector<std::byte> buffer {};
+      std::vector<const Capture::RecordHeader*> records {};
+      size_t nextRecord {0};
+      uint64_t numDamagedBlocks {0};
+   };
+
+   std::vector<std::unique_ptr<Cursor>> cursors {};
+   uint32_t nextSource {0};
+   std::string errorMessage {};
+   Statistics stats {};
+};
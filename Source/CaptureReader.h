@@ -0,0 +1,254 @@
+// Reads capture files through a read-only mapping of the whole file.
+//
+// Only the header, the index and the footer are read when a capture is opened. The mapping is advised
+// for random access, so the kernel does not read ahead into blocks which are skipped, and the blocks
+// selected by a filter are advised as needed, so they are read ahead while earlier ones are decoded.
+// Packed blocks are decoded into a buffer of the calling thread, raw ones are read in place.
+
+#pragma once
+
+#include "Capture.h"
+#include "CaptureCodec.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+/// selects records by their message time and event type
+struct CaptureFilter
+{
+   /// nanoseconds since the epoch, from is inclusive, to exclusive
+   uint64_t from {0};
+   uint64_t to {UINT64_MAX};
+   /// selected event types, all if none were added
+   std::array<uint64_t, Capture::maxEventTypes / 64> eventTypes {};
+   bool allEventTypes {true};
+
+   void addEventType(uint16_t eventType)
+   {
+      if (eventType < Capture::maxEventTypes)
+         eventTypes[eventType / 64] |= uint64_t {1} << (eventType % 64);
+      allEventTypes = false;
+   }
+
+   /// false if the block certainly holds no selected records
+   bool overlaps(const Capture::BlockInfo& block) const
+   {
+      if (block.numRecords == 0 || block.lastTime < from || block.firstTime >= to)
+         return false;
+      if (allEventTypes)
+         return true;
+      for (size_t i = 0; i < eventTypes.size(); ++i)
+      {
+         if (eventTypes[i] & block.eventTypes[i])
+            return true;
+      }
+      return false;
+   }
+
+   bool matches(const Capture::RecordHeader& record) const
+   {
+      if (record.time < from || record.time >= to)
+         return false;
+      return allEventTypes || (record.eventType < Capture::maxEventTypes && (eventTypes[record.eventType / 64] >> (record.eventType % 64)) & 1);
+   }
+};
+
+class CaptureReader
+{
+public:
+   explicit CaptureReader(const std::string& path)
+   {
+      const int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0)
+      {
+         errorMessage = strerror(errno);
+         return;
+      }
+      struct stat status {};
+      if (fstat(fd, &status) == 0 && status.st_size > 0)
+      {
+         size = static_cast<size_t>(status.st_size);
+         void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+         data = mapping != MAP_FAILED ? static_cast<const std::byte*>(mapping) : nullptr;
+      }
+      if (!data)
+         errorMessage = size > 0 ? strerror(errno) : "empty file";
+      close(fd);
+      if (data)
+      {
+         madvise(const_cast<std::byte*>(data), size, MADV_RANDOM);
+         readIndex();
+      }
+   }
+
+   CaptureReader(const CaptureReader&) = delete;
+   CaptureReader& operator=(const CaptureReader&) = delete;
+
+   ~CaptureReader()
+   {
+      if (data)
+         munmap(const_cast<std::byte*>(data), size);
+   }
+
+   bool valid() const
+   {
+      return errorMessage.empty();
+   }
+
+   const std::string& error() const
+   {
+      return errorMessage;
+   }
+
+   const Capture::FileHeader& header() const
+   {
+      return *reinterpret_cast<const Capture::FileHeader*>(data);
+   }
+
+   std::span<const Capture::BlockInfo> blocks() const
+   {
+      return index;
+   }
+
+   /// Returns the indices of the blocks which may hold records selected by the filter and asks the
+   /// kernel to read them ahead.
+   std::vector<size_t> select(const CaptureFilter& filter) const
+   {
+      std::vector<size_t> selected {};
+      for (size_t i = 0; i < index.size(); ++i)
+      {
+         if (filter.overlaps(index[i]))
+         {
+            selected.push_back(i);
+            prefetch(i);
+         }
+      }
+      return selected;
+   }
+
+   /// Returns the records of the block, which are decoded into buffer unless they are stored raw.
+   /// Returns nothing if the block could not be decoded.
+   std::optional<std::span<const std::byte>> recordsOf(size_t block, std::vector<std::byte>& scratch, std::vector<std::byte>& buffer) const
+   {
+      const auto& info = index[block];
+      const std::byte* stored = data + info.offset;
+      if (info.encoding == Capture::encodingRaw)
+         return std::span {stored, info.size};
+      if (!CaptureCodec::decode({stored, info.storedSize}, info, scratch, buffer))
+         return std::nullopt;
+      return buffer;
+   }
+
+   /// Calls f for every record of the block which is selected by the filter.
+   /// Returns false if the block could not be decoded.
+   template<typename F>
+   bool forEachRecord(size_t block, const CaptureFilter& filter, F&& f) const
+   {
+      thread_local std::vector<std::byte> scratch {};
+      thread_local std::vector<std::byte> decoded {};
+      const auto records = recordsOf(block, scratch, decoded);
+      return records && forEachRecord(*records, filter, f);
+   }
+
+   /// calls f for every record selected by the filter of the records returned by recordsOf, returns false if they are damaged
+   template<typename F>
+   static bool forEachRecord(std::span<const std::byte> records, const CaptureFilter& filter, F&& f)
+   {
+      const std::byte* position = records.data();
+      const std::byte* end = position + records.size();
+      while (position + sizeof(Capture::RecordHeader) <= end)
+      {
+         const auto& record = *reinterpret_cast<const Capture::RecordHeader*>(position);
+         // a truncated or damaged block ends at the first implausible record
+         if (record.size < Capture::recordSize(record.executableLength, record.fileLength) || position + record.size > end)
+            return false;
+         if (filter.matches(record))
+            f(record);
+         position += record.size;
+      }
+      return true;
+   }
+
+   /// asks the kernel to read the block ahead
+   void prefetch(size_t block) const
+   {
+      advise(index[block], MADV_WILLNEED);
+   }
+
+   /// tells the kernel that the pages of the block are not needed anymore
+   void release(size_t block) const
+   {
+      advise(index[block], MADV_DONTNEED);
+   }
+
+private:
+   void readIndex()
+   {
+      const auto& fileHeader = header();
+      Capture::Footer footer {};
+      if (size < Capture::dataOffset + sizeof(footer) || fileHeader.magic != Capture::magic)
+      {
+         errorMessage = "not a capture file";
+         return;
+      }
+      if (fileHeader.version != Capture::version)
+      {
+         errorMessage = "unsupported capture version " + std::to_string(fileHeader.version);
+         return;
+      }
+      std::memcpy(&footer, data + size - sizeof(footer), sizeof(footer));
+      if (footer.magic != Capture::footerMagic || footer.indexOffset < Capture::dataOffset
+          || footer.numBlocks > (size - sizeof(footer) - footer.indexOffset) / sizeof(Capture::BlockInfo))
+      {
+         errorMessage = "the index is missing, the capture was not finished";
+         return;
+      }
+      const auto* blocks = reinterpret_cast<const Capture::BlockInfo*>(data + footer.indexOffset);
+      index.assign(blocks, blocks + footer.numBlocks);
+      if (fileHeader.blockSize > Capture::maxBlockSize)
+      {
+         errorMessage = "unsupported block size " + std::to_string(fileHeader.blockSize);
+         return;
+      }
+      for (const auto& block : index)
+      {
+         // the offset is checked first so that adding the stored size cannot overflow
+         if (block.offset < Capture::dataOffset || block.offset > footer.indexOffset || block.storedSize > footer.indexOffset - block.offset
+             || (block.encoding == Capture::encodingRaw && block.storedSize != block.size))
+         {
+            errorMessage = "the index refers to data outside of the capture";
+            return;
+         }
+         if (block.size > fileHeader.blockSize)
+         {
+            errorMessage = "the index holds a block larger than the block size";
+            return;
+         }
+      }
+   }
+
+   void advise(const Capture::BlockInfo& block, int advice) const
+   {
+      // madvise takes whole pages
+      const auto pageSize = static_cast<uint64_t>(getpagesize());
+      const uint64_t start = block.offset / pageSize * pageSize;
+      madvise(const_cast<std::byte*>(data + start), static_cast<size_t>(block.offset + block.storedSize - start), advice);
+   }
+
+   const std::byte* data {nullptr};
+   size_t size {0};
+   std::vector<Capture::BlockInfo> index {};
+   std::string errorMessage {};
+};
@@ -0,0 +1,156 @@
+// Writes capture files: records are collected into blocks of a fixed size, full blocks are packed by
+// CaptureCodec and written back to back and described in the index, which is appended together with
+// the footer when the capture is finished. See Capture.h for the format.
+//
+// Blocks are encoded in batches, on the threads of a pool if one is given, and written in order once
+// the whole batch is encoded.
+
+#pragma once
+
+#include "Capture.h"
+#include "CaptureCodec.h"
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <span>
+#include <string>
+#include <vector>
+
+class CaptureWriter
+{
+public:
+   struct Statistics
+   {
+      /// bytes of the records and bytes written for them
+      uint64_t rawBytes {0};
+      uint64_t storedBytes {0};
+      /// wall time spent encoding blocks
+      uint64_t encodeNanoseconds {0};
+   };
+
+   CaptureWriter(const std::string& path, const Capture::FileHeader& fileHeader, Capture::Compressor compressor = Capture::Compressor::none,
+                 WorkStealingPool* pool = nullptr)
+      : file {path, std::ios::binary | std::ios::trunc}, header {fileHeader}, compressor {compressor}, pool {pool},
+        batch(pool ? pool->size() * 2 : 1)
+   {
+      // the header is written again with the number of records by finish
+      writeHeader();
+   }
+
+   bool valid() const
+   {
+      return static_cast<bool>(file);
+   }
+
+   /// appends a record, which is followed by its paths in memory
+   void add(const Capture::RecordHeader& record)
+   {
+      Block* block = &batch[numPending];
+      if (!block->raw.empty() && block->raw.size() + record.size > header.blockSize)
+      {
+         if (++numPending == batch.size())
+            writeBatch();
+         block = &batch[numPending];
+      }
+      const auto* bytes = reinterpret_cast<const std::byte*>(&record);
+      block->raw.insert(block->raw.end(), bytes, bytes + record.size);
+      block->info.add(record);
+      header.numRecords++;
+   }
+
+   /// writes the last blocks, the index and the footer, returns false if anything could not be written
+   bool finish()
+   {
+      if (!batch[numPending].raw.empty())
+         numPending++;
+      writeBatch();
+      Capture::Footer footer {};
+      footer.indexOffset = nextOffset;
+      footer.numBlocks = index.size();
+      file.write(reinterpret_cast<const char*>(index.data()), static_cast<std::streamsize>(index.size() * sizeof(Capture::BlockInfo)));
+      file.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+      writeHeader();
+      return static_cast<bool>(file.flush());
+   }
+
+   const Statistics& statistics() const
+   {
+      return stats;
+   }
+
+private:
+   struct Block
+   {
+      std::vector<std::byte> raw {};
+      std::vector<std::byte> stored {};
+      std::vector<std::byte> scratch {};
+      Capture::BlockInfo info {};
+   };
+
+   void writeHeader()
+   {
+      file.seekp(0);
+      file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      if (nextOffset == Capture::dataOffset && index.empty())
+      {
+         const std::vector<char> padding(Capture::dataOffset - sizeof(header), 0);
+         file.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+      }
+      file.seekp(static_cast<std::streamoff>(nextOffset));
+   }
+
+   /// encodes and writes the pending blocks
+   void writeBatch()
+   {
+      if (numPending == 0)
+         return;
+
+      const auto start = std::chrono::steady_clock::now();
+      std::vector<std::function<void()>> tasks {};
+      for (size_t i = 0; i < numPending; ++i)
+      {
+         tasks.emplace_back([this, i] {
+            Block& block = batch[i];
+            block.info.encoding = CaptureCodec::encode(block.raw, compressor, block.scratch, block.stored);
+         });
+      }
+      if (pool && tasks.size() > 1)
+         pool->run(tasks);
+      else
+         std::ranges::for_each(tasks, [](const auto& task) { task(); });
+      stats.encodeNanoseconds += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+
+      for (size_t i = 0; i < numPending; ++i)
+      {
+         Block& block = batch[i];
+         file.write(reinterpret_cast<const char*>(block.stored.data()), static_cast<std::streamsize>(block.stored.size()));
+         block.info.offset = nextOffset;
+         block.info.size = static_cast<uint32_t>(block.raw.size());
+         block.info.storedSize = static_cast<uint32_t>(block.stored.size());
+         index.push_back(block.info);
+         nextOffset += block.stored.size();
+         stats.rawBytes += block.raw.size();
+         stats.storedBytes += block.stored.size();
+         block.raw.clear();
+         block.info = {};
+      }
+      numPending = 0;
+   }
+
+   std::ofstream file;
+   Capture::FileHeader header;
+   Capture::Compressor compressor;
+   WorkStealingPool* pool;
+   /// blocks waiting to be encoded, the one at numPending is being filled
+   std::vector<Block> batch;
+   size_t numPending {0};
+   std::vector<Capture::BlockInfo> index {};
+   uint64_t nextOffset {Capture::dataOffset};
+   Statistics stats {};
+};
@@ -0,0 +1,516 @@
+// Queries which count the messages of an EventStore, optionally grouped and restricted to the top groups.
+//
+// Example:
+//    count by process.name where event == "NOTIFY_EXEC" && time >= "12:01" && time < "12:03" top 5
+//
+// A query is compiled once and can be run again and again while the store grows. It is run chunk by chunk:
+// the conditions are evaluated one after the other over whole columns into a mask with one byte per row,
+// simple loops without branches the compiler turns into vector instructions. String conditions are
+// evaluated once per dictionary entry instead of once per row, the column of ids then only looks up the
+// result. Chunks whose times can't satisfy the time conditions are skipped without looking at their rows.
+// The matching rows are counted by a key packing the values of the grouped fields.
+
+#pragma once
+
+#include "EventStore.h"
+#include "PathMatcher.h"
+#include "Types.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace EventQuery
+{
+   /// the columns of the store, by the names of the corresponding filter fields
+   enum class Field : uint8_t
+   {
+      Time,
+      Event,
+      ProcessPath,
+      ProcessName,
+      TargetPath,
+      TargetName,
+      ProcessPid,
+      ProcessPpid,
+   };
+
+   const std::unordered_map<std::string_view, Field> name2field {
+      {"time", Field::Time},
+      {"event", Field::Event},
+      {"process.path", Field::ProcessPath},
+      {"process.name", Field::ProcessName},
+      {"exec.target.path", Field::TargetPath},
+      {"exec.target.name", Field::TargetName},
+      {"process.pid", Field::ProcessPid},
+      {"process.ppid", Field::ProcessPpid},
+   };
+
+   inline std::string_view nameOf(Field field)
+   {
+      const auto entry = std::find_if(name2field.begin(), name2field.end(), [field](const auto& entry) { return entry.second == field; });
+      return entry->first;
+   }
+
+   inline bool isStringField(Field field)
+   {
+      return field >= Field::ProcessPath && field <= Field::TargetName;
+   }
+
+   enum class Op : uint8_t
+   {
+      Equal,
+      NotEqual,
+      Less,
+      LessEqual,
+      Greater,
+      GreaterEqual,
+      GlobMatch,
+      GlobNoMatch,
+   };
+
+   struct Condition
+   {
+      Field field;
+      Op op;
+      /// integer fields
+      int64_t number {0};
+      /// string fields
+      std::string literal {};
+      /// the automaton caches its transitions while matching
+      mutable std::optional<PathMatcher> glob {};
+   };
+
+   /// a group and its number of matching rows
+   struct Row
+   {
+      std::vector<std::string> values {};
+      uint64_t count {0};
+   };
+
+   struct Result
+   {
+      /// the top groups by count, a single row without values if nothing is grouped
+      std::vector<Row> rows {};
+      uint64_t numMatched {0};
+      uint64_t numGroups {0};
+      uint64_t numScanned {0};
+      size_t numChunksScanned {0};
+      size_t numChunksSkipped {0};
+   };
+
+   /// parses a time literal into nanoseconds since the epoch
+   using TimeParser = std::function<std::optional<uint64_t>(const std::string&)>;
+
+   class Query
+   {
+   public:
+      static constexpr size_t maxGroupFields = 2;
+      static constexpr size_t defaultTop = 10;
+
+      /// throws std::invalid_argument if the query is malformed
+      static Query compile(std::string_view text, const TimeParser& parseTime)
+      {
+         Query query {};
+         query.text = text;
+         Parser parser {text, query, parseTime};
+         parser.parseQuery();
+         return query;
+      }
+
+      const std::string& source() const
+      {
+         return text;
+      }
+
+      const std::vector<Field>& groupedFields() const
+      {
+         return groupFields;
+      }
+
+      /// runs the query on the rows of a snapshot of the store
+      Result run(const EventStore::Snapshot& store) const
+      {
+         Result result {};
+         // the results of the string conditions by dictionary id, the dictionary grows between runs
+         std::vector<std::vector<uint8_t>> matchesById(conditions.size());
+         for (size_t c = 0; c < conditions.size(); ++c)
+         {
+            if (isStringField(conditions[c].field))
+               matchesById[c] = evaluateDictionary(conditions[c], store);
+         }
+
+         std::unordered_map<uint64_t, uint64_t> counts {};
+         std::vector<uint8_t> mask(EventStore::chunkRows);
+         for (const auto& chunk : store.allChunks())
+         {
+            if (!mayMatch(*chunk))
+            {
+               result.numChunksSkipped++;
+               continue;
+            }
+            result.numChunksScanned++;
+            result.numScanned += chunk->size;
+            const size_t n = chunk->size;
+            std::fill_n(mask.begin(), n, 1);
+            for (size_t c = 0; c < conditions.size(); ++c)
+               filter(conditions[c], matchesById[c], *chunk, mask.data());
+
+            if (groupFields.empty())
+            {
+               uint64_t matched {0};
+               for (size_t i = 0; i < n; ++i)
+                  matched += mask[i];
+               result.numMatched += matched;
+               continue;
+            }
+            for (size_t i = 0; i < n; ++i)
+            {
+               if (!mask[i])
+                  continue;
+               uint64_t key {0};
+               for (const auto field : groupFields)
+                  key = key << 32 | valueOf(field, *chunk, i, store);
+               counts[key]++;
+               result.numMatched++;
+            }
+         }
+
+         if (groupFields.empty())
+         {
+            result.rows.push_back({{}, result.numMatched});
+            return result;
+         }
+         result.numGroups = counts.size();
+         std::vector<std::pair<uint64_t, uint64_t>> groups(counts.begin(), counts.end());
+         const size_t numRows = std::min(top, groups.size());
+         std::partial_sort(groups.begin(), groups.begin() + static_cast<std::ptrdiff_t>(numRows), groups.end(), [](const auto& a, const auto& b) {
+            return a.second > b.second || (a.second == b.second && a.first < b.first);
+         });
+         for (size_t g = 0; g < numRows; ++g)
+         {
+            Row row {};
+            row.count = groups[g].second;
+            for (size_t f = 0; f < groupFields.size(); ++f)
+            {
+               const auto value = static_cast<uint32_t>(groups[g].first >> (32 * (groupFields.size() - 1 - f)));
+               row.values.push_back(format(groupFields[f], value, store));
+            }
+            result.rows.push_back(std::move(row));
+         }
+         return result;
+      }
+
+   private:
+      class Parser
+      {
+      public:
+         Parser(std::string_view text, Query& query, const TimeParser& parseTime) : input {text}, query {query}, parseTime {parseTime} {}
+
+         /// query := 'count' ['by' field (',' field)*] ['where' condition ('&&' condition)*] ['top' integer]
+         void parseQuery()
+         {
+            if (!consumeWord("count"))
+               fail("expected 'count'");
+            if (consumeWord("by"))
+            {
+               do
+               {
+                  const Field field = parseField();
+                  if (field == Field::Time)
+                     fail("time can't be grouped by");
+                  if (query.groupFields.size() == maxGroupFields)
+                     fail("at most " + std::to_string(maxGroupFields) + " fields can be grouped by");
+                  query.groupFields.push_back(field);
+               } while (consume(","));
+            }
+            if (consumeWord("where"))
+            {
+               do
+                  parseCondition();
+               while (consume("&&"));
+            }
+            if (consumeWord("top"))
+            {
+               if (query.groupFields.empty())
+                  fail("top needs grouped fields");
+               const int64_t top = parseInteger();
+               if (top <= 0)
+                  fail("top must be positive");
+               query.top = static_cast<size_t>(top);
+            }
+            skipWhitespace();
+            if (pos != input.size())
+               fail("unexpected input");
+         }
+
+      private:
+         /// condition := field operator literal
+         void parseCondition()
+         {
+            Condition condition {parseField(), Op::Equal};
+            skipWhitespace();
+            static const std::array<std::pair<std::string_view, Op>, 8> ops {{
+               {"==", Op::Equal}, {"!=", Op::NotEqual}, {"=~", Op::GlobMatch}, {"!~", Op::GlobNoMatch},
+               {"<=", Op::LessEqual}, {">=", Op::GreaterEqual}, {"<", Op::Less}, {">", Op::Greater},
+            }};
+            const auto op = std::find_if(ops.begin(), ops.end(), [this](const auto& candidate) { return consume(candidate.first); });
+            if (op == ops.end())
+               fail("expected a comparison operator");
+            condition.op = op->second;
+
+            const bool isGlob = condition.op == Op::GlobMatch || condition.op == Op::GlobNoMatch;
+            if (isStringField(condition.field))
+            {
+               if (condition.op != Op::Equal && condition.op != Op::NotEqual && !isGlob)
+                  fail("operator " + std::string(op->first) + " is not supported for string fields");
+               condition.literal = parseString(isGlob);
+               if (isGlob)
+                  condition.glob.emplace(std::vector<std::string> {condition.literal});
+            }
+            else
+            {
+               if (isGlob)
+                  fail("operator " + std::string(op->first) + " is not supported for integer fields");
+               condition.number = parseNumber(condition.field);
+            }
+            query.conditions.push_back(std::move(condition));
+         }
+
+         int64_t parseNumber(Field field)
+         {
+            if (field == Field::Event)
+            {
+               const auto eventName = parseString(false);
+               if (!ESEventTypes::name2event.contains(eventName))
+                  fail("'" + eventName + "' is not a valid ES event type");
+               return ESEventTypes::name2event.at(eventName);
+            }
+            if (field == Field::Time)
+            {
+               const auto timeText = parseString(false);
+               const auto time = parseTime(timeText);
+               if (!time)
+                  fail("'" + timeText + "' is not a valid time");
+               return static_cast<int64_t>(*time);
+            }
+            return parseInteger();
+         }
+
+         Field parseField()
+         {
+            skipWhitespace();
+            const size_t start = pos;
+            while (pos < input.size() && (std::isalnum(static_cast<unsigned char>(input[pos])) || input[pos] == '_' || input[pos] == '.'))
+               ++pos;
+            if (start == pos)
+               fail("expected a field name");
+            const auto fieldName = input.substr(start, pos - start);
+            if (!name2field.contains(fieldName))
+               fail("unknown field '" + std::string(fieldName) + "'");
+            return name2field.at(fieldName);
+         }
+
+         /// keepGlobEscapes preserves escaped wildcards for the glob compiler
+         std::string parseString(bool keepGlobEscapes)
+         {
+            skipWhitespace();
+            if (pos == input.size() || input[pos] != '"')
+               fail("expected a string literal");
+            ++pos;
+            std::string value {};
+            while (pos < input.size() && input[pos] != '"')
+            {
+               if (input[pos] == '\\' && pos + 1 < input.size())
+               {
+                  const char escaped = input[pos + 1];
+                  if (keepGlobEscapes && (escaped == '*' || escaped == '?' || escaped == '\\'))
+                     value += '\\';
+                  ++pos;
+               }
+               value += input[pos++];
+            }
+            if (pos == input.size())
+               fail("unterminated string literal");
+            ++pos;
+            return value;
+         }
+
+         int64_t parseInteger()
+         {
+            skipWhitespace();
+            int64_t value {0};
+            const auto [end, error] = std::from_chars(input.data() + pos, input.data() + input.size(), value);
+            if (error != std::errc())
+               fail("expected an integer");
+            pos = static_cast<size_t>(end - input.data());
+            return value;
+         }
+
+         void skipWhitespace()
+         {
+            while (pos < input.size() && std::isspace(static_cast<unsigned char>(input[pos])))
+               ++pos;
+         }
+
+         bool consume(std::string_view token)
+         {
+            skipWhitespace();
+            if (!input.substr(pos).starts_with(token))
+               return false;
+            pos += token.size();
+            return true;
+         }
+
+         /// consumes a keyword which is not just the start of a longer word
+         bool consumeWord(std::string_view word)
+         {
+            skipWhitespace();
+            const size_t end = pos + word.size();
+            if (!input.substr(pos).starts_with(word) || (end < input.size() && (std::isalnum(static_cast<unsigned char>(input[end])) || input[end] == '_')))
+               return false;
+            pos = end;
+            return true;
+         }
+
+         [[noreturn]] void fail(const std::string& message) const
+         {
+            throw std::invalid_argument(message + " at position " + std::to_string(pos) + " of query");
+         }
+
+         std::string_view input;
+         size_t pos {0};
+         Query& query;
+         const TimeParser& parseTime;
+      };
+
+      static std::vector<uint8_t> evaluateDictionary(const Condition& condition, const EventStore::Snapshot& store)
+      {
+         const bool byName = condition.field == Field::ProcessName || condition.field == Field::TargetName;
+         std::vector<uint8_t> matches(store.dictionarySize());
+         for (EventStore::Id id = 0; id < matches.size(); ++id)
+         {
+            const auto value = store.path(byName ? store.name(id) : id);
+            bool match {false};
+            switch (condition.op)
+            {
+               case Op::Equal: match = value == condition.literal; break;
+               case Op::NotEqual: match = value != condition.literal; break;
+               case Op::GlobMatch: match = condition.glob->matches(value); break;
+               case Op::GlobNoMatch: match = !condition.glob->matches(value); break;
+               default: break;
+            }
+            matches[id] = match;
+         }
+         return matches;
+      }
+
+      /// whether rows of the chunk can satisfy the time conditions
+      bool mayMatch(const EventStore::Chunk& chunk) const
+      {
+         for (const auto& condition : conditions)
+         {
+            if (condition.field != Field::Time)
+               continue;
+            const auto time = static_cast<uint64_t>(condition.number);
+            switch (condition.op)
+            {
+               case Op::Equal: if (time < chunk.firstTime || time > chunk.lastTime) return false; break;
+               case Op::Less: if (chunk.firstTime >= time) return false; break;
+               case Op::LessEqual: if (chunk.firstTime > time) return false; break;
+               case Op::Greater: if (chunk.lastTime <= time) return false; break;
+               case Op::GreaterEqual: if (chunk.lastTime < time) return false; break;
+               default: break;
+            }
+         }
+         return true;
+      }
+
+      template<typename T>
+      static void compare(Op op, const T* column, int64_t value, size_t n, uint8_t* mask)
+      {
+         // values out of the range of the column compare correctly in 64 bits
+         switch (op)
+         {
+            case Op::Equal: for (size_t i = 0; i < n; ++i) mask[i] &= static_cast<int64_t>(column[i]) == value; break;
+            case Op::NotEqual: for (size_t i = 0; i < n; ++i) mask[i] &= static_cast<int64_t>(column[i]) != value; break;
+            case Op::Less: for (size_t i = 0; i < n; ++i) mask[i] &= static_cast<int64_t>(column[i]) < value; break;
+            case Op::LessEqual: for (size_t i = 0; i < n; ++i) mask[i] &= static_cast<int64_t>(column[i]) <= value; break;
+            case Op::Greater: for (size_t i = 0; i < n; ++i) mask[i] &= static_cast<int64_t>(column[i]) > value; break;
+            case Op::GreaterEqual: for (size_t i = 0; i < n; ++i) mask[i] &= static_cast<int64_t>(column[i]) >= value; break;
+            default: break;
+         }
+      }
+
+      static void lookUp(const EventStore::Id* column, const std::vector<uint8_t>& matchesById, size_t n, uint8_t* mask)
+      {
+         // the snapshot doesn't change during a run, so every id of the column has been evaluated
+         for (size_t i = 0; i < n; ++i)
+            mask[i] &= matchesById[column[i]];
+      }
+
+      static void filter(const Condition& condition, const std::vector<uint8_t>& matchesById, const EventStore::Chunk& chunk, uint8_t* mask)
+      {
+         const size_t n = chunk.size;
+         switch (condition.field)
+         {
+            // nanoseconds since the epoch fit into 63 bits until 2262
+            case Field::Time: compare(condition.op, chunk.time.data(), condition.number, n, mask); break;
+            case Field::Event: compare(condition.op, chunk.eventType.data(), condition.number, n, mask); break;
+            case Field::ProcessPid: compare(condition.op, chunk.pid.data(), condition.number, n, mask); break;
+            case Field::ProcessPpid: compare(condition.op, chunk.ppid.data(), condition.number, n, mask); break;
+            case Field::ProcessPath:
+            case Field::ProcessName: lookUp(chunk.source.data(), matchesById, n, mask); break;
+            case Field::TargetPath:
+            case Field::TargetName: lookUp(chunk.target.data(), matchesById, n, mask); break;
+         }
+      }
+
+      static uint32_t valueOf(Field field, const EventStore::Chunk& chunk, size_t i, const EventStore::Snapshot& store)
+      {
+         switch (field)
+         {
+            case Field::Event: return chunk.eventType[i];
+            case Field::ProcessPath: return chunk.source[i];
+            case Field::ProcessName: return store.name(chunk.source[i]);
+            case Field::TargetPath: return chunk.target[i];
+            case Field::TargetName: return store.name(chunk.target[i]);
+            case Field::ProcessPid: return static_cast<uint32_t>(chunk.pid[i]);
+            case Field::ProcessPpid: return static_cast<uint32_t>(chunk.ppid[i]);
+            case Field::Time: return 0;
+         }
+         return 0;
+      }
+
+      static std::string format(Field field, uint32_t value, const EventStore::Snapshot& store)
+      {
+         switch (field)
+         {
+            case Field::Event:
+            {
+               const auto name = ESEventTypes::event2name.find(static_cast<es_event_type_t>(value));
+               return name != ESEventTypes::event2name.end() ? name->second : "EVENT_" + std::to_string(value);
+            }
+            case Field::ProcessPath:
+            case Field::ProcessName:
+            case Field::TargetPath:
+            case Field::TargetName: return value == EventStore::noPath ? "-" : std::string(store.path(value));
+            default: return std::to_string(static_cast<int32_t>(value));
+         }
+      }
+
+      std::string text {};
+      std::vector<Condition> conditions {};
+      std::vector<Field> groupFields {};
+      size_t top {defaultTop};
+   };
+}
@@ -0,0 +1,203 @@
+// Keeps the messages of a session in memory, column by column, so they can be queried afterwards, see EventQuery.h.
+//
+// Rows are appended to fixed-size chunks which hold one array per column, so a query scans each
+// column it needs as one contiguous array per chunk. Executable paths are stored once in a dictionary,
+// the columns hold their ids. The memory of the store is capped: once all chunks the cap allows are in
+// use the oldest chunk is dropped, so the store always holds the most recent messages. The dictionary
+// gets a quarter of the cap, paths which do not fit anymore share the id of the path "<other>".
+//
+// Queries don't run on the store but on a snapshot of it, so messages can be appended meanwhile: full chunks
+// are shared with the snapshot and never change, only the chunk being filled is copied. A dropped chunk is
+// only reused if no snapshot reads it anymore.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class EventStore
+{
+public:
+   using Id = uint32_t;
+   /// the id of no path, e.g. the target of a message which is not an exec
+   static constexpr Id noPath = 0;
+   /// the id shared by the paths which did not fit into the dictionary
+   static constexpr Id otherPath = 1;
+   static constexpr size_t chunkRows = 16 * 1024;
+
+   struct Chunk
+   {
+      size_t size {0};
+      uint64_t firstTime {UINT64_MAX};
+      uint64_t lastTime {0};
+      /// nanoseconds since the epoch
+      std::array<uint64_t, chunkRows> time;
+      std::array<uint16_t, chunkRows> eventType;
+      /// executable of the process and, for NOTIFY_EXEC, the executable of the new image
+      std::array<Id, chunkRows> source;
+      std::array<Id, chunkRows> target;
+      std::array<int32_t, chunkRows> pid;
+      std::array<int32_t, chunkRows> ppid;
+   };
+
+   /// the rows and paths of the store when it was taken
+   class Snapshot
+   {
+   public:
+      const std::vector<std::shared_ptr<const Chunk>>& allChunks() const
+      {
+         return chunks;
+      }
+
+      std::string_view path(Id id) const
+      {
+         return paths[id];
+      }
+
+      /// the id of the file name of the path
+      Id name(Id id) const
+      {
+         return names[id];
+      }
+
+      size_t dictionarySize() const
+      {
+         return paths.size();
+      }
+
+   private:
+      friend class EventStore;
+
+      std::vector<std::shared_ptr<const Chunk>> chunks {};
+      /// views of the paths of the store, whose strings never move
+      std::vector<std::string_view> paths {};
+      std::vector<Id> names {};
+   };
+
+   explicit EventStore(size_t maxBytes)
+      : maxChunks {std::max<size_t>(2, maxBytes * 3 / 4 / sizeof(Chunk))}, maxDictionaryBytes {maxBytes / 4}
+   {
+      intern("");
+      intern("<other>");
+   }
+
+   /// returns the id of the path, adding it to the dictionary if there is room
+   Id intern(std::string_view path)
+   {
+      if (const auto it = ids.find(path); it != ids.end())
+         return it->second;
+      if (dictionaryBytes + path.size() > maxDictionaryBytes && paths.size() > otherPath)
+         return otherPath;
+      // the deque keeps the strings in place, so the keys of ids stay valid
+      const auto& stored = paths.emplace_back(path);
+      const auto id = static_cast<Id>(paths.size() - 1);
+      ids.emplace(stored, id);
+      dictionaryBytes += path.size() + sizeof(std::string) + 2 * sizeof(void*);
+      const auto slash = stored.rfind('/');
+      const std::string_view name = slash == std::string::npos ? std::string_view {stored} : std::string_view {stored}.substr(slash + 1);
+      names.push_back(id);
+      if (name.size() != stored.size())
+      {
+         // interning the name appends to names
+         const Id nameId = intern(name);
+         names[id] = nameId;
+      }
+      return id;
+   }
+
+   void append(uint64_t time, uint16_t eventType, Id source, Id target, int32_t pid, int32_t ppid)
+   {
+      if (chunks.empty() || chunks.back()->size == chunkRows)
+      {
+         if (chunks.size() == maxChunks)
+         {
+            // the oldest chunk is reused for the newest rows unless a snapshot still reads it, snapshots are only
+            // taken under the lock of the store, so a count of one can't grow meanwhile
+            numDroppedRows += chunks.front()->size;
+            auto oldest = std::move(chunks.front());
+            chunks.pop_front();
+            if (oldest.use_count() == 1)
+            {
+               // only rows below size are ever read, so the columns are left as they are
+               oldest->size = 0;
+               oldest->firstTime = UINT64_MAX;
+               oldest->lastTime = 0;
+               chunks.push_back(std::move(oldest));
+            }
+            else
+            {
+               chunks.push_back(std::make_shared<Chunk>());
+            }
+         }
+         else
+         {
+            chunks.push_back(std::make_shared<Chunk>());
+         }
+      }
+      Chunk& chunk = *chunks.back();
+      const size_t row = chunk.size++;
+      chunk.time[row] = time;
+      chunk.eventType[row] = eventType;
+      chunk.source[row] = source;
+      chunk.target[row] = target;
+      chunk.pid[row] = pid;
+      chunk.ppid[row] = ppid;
+      chunk.firstTime = std::min(chunk.firstTime, time);
+      chunk.lastTime = std::max(chunk.lastTime, time);
+   }
+
+   /// Takes a snapshot for queries, which must not run on the store while messages are appended.
+   Snapshot snapshot() const
+   {
+      Snapshot snapshot {};
+      snapshot.chunks.assign(chunks.begin(), chunks.end());
+      if (!chunks.empty() && chunks.back()->size < chunkRows)
+         snapshot.chunks.back() = std::make_shared<const Chunk>(*chunks.back());
+      snapshot.paths.assign(paths.begin(), paths.end());
+      snapshot.names = names;
+      return snapshot;
+   }
+
+   size_t dictionarySize() const
+   {
+      return paths.size();
+   }
+
+   uint64_t numRows() const
+   {
+      uint64_t rows {0};
+      for (const auto& chunk : chunks)
+         rows += chunk->size;
+      return rows;
+   }
+
+   /// rows dropped with the oldest chunks because of the memory cap
+   uint64_t numDropped() const
+   {
+      return numDroppedRows;
+   }
+
+   size_t memoryUsage() const
+   {
+      return chunks.size() * sizeof(Chunk) + dictionaryBytes;
+   }
+
+private:
+   size_t maxChunks;
+   size_t maxDictionaryBytes;
+   std::deque<std::shared_ptr<Chunk>> chunks {};
+   std::deque<std::string> paths {};
+   std::unordered_map<std::string_view, Id> ids {};
+   /// by id
+   std::vector<Id> names {};
+   size_t dictionaryBytes {0};
+   uint64_t numDroppedRows {0};
+};
@@ -0,0 +1,67 @@
+// Baseline of a rate as exponentially weighted moving average and variance.
+//
+// Every update blends the new value into mean and variance with the weight alpha, so a baseline is a
+// few numbers no matter how long it ran and old values fade out with the half-life alpha is derived
+// from. The z-score of a value is its distance to the mean in standard deviations. Rates of rare
+// events hardly vary, so the deviation is never taken smaller than the one of a Poisson process with
+// the same mean and at least 1, otherwise the first message after a quiet phase would be an anomaly.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+class EwmaBaseline
+{
+public:
+   /// the weight of a value whose influence halves after the given number of updates
+   static double alphaForHalfLife(double updates)
+   {
+      return 1.0 - std::exp2(-1.0 / updates);
+   }
+
+   /// returns the z-score of the value against the baseline before it is updated with the value
+   double update(double value, double alpha)
+   {
+      const double z = zScore(value);
+      if (numUpdates == 0)
+      {
+         mean = value;
+      }
+      else
+      {
+         const double difference = value - mean;
+         const double increment = alpha * difference;
+         mean += increment;
+         variance = (1.0 - alpha) * (variance + difference * increment);
+      }
+      if (numUpdates < UINT32_MAX)
+         numUpdates++;
+      return z;
+   }
+
+   double zScore(double value) const
+   {
+      const double deviation = std::max({std::sqrt(variance), std::sqrt(mean), 1.0});
+      return (value - mean) / deviation;
+   }
+
+   double average() const
+   {
+      return mean;
+   }
+
+   uint32_t updates() const
+   {
+      return numUpdates;
+   }
+
+   /// set while the rate is above the alert threshold, so a lasting anomaly is reported once
+   bool alerting {false};
+
+private:
+   double mean {0};
+   double variance {0};
+   uint32_t numUpdates {0};
+};
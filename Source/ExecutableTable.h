@@ -0,0 +1,106 @@
+// Interns executables by the (device, inode) pair of their file.
+//
+// Executables with the same name but different files get different ids, while hard links and
+// repeated executions of the same file share one. Looking up an executable only hashes two integers,
+// the path is copied once when the executable is seen for the first time and names are derived from
+// it when they are needed for reporting.
+//
+// The handler interns the same executables several times per message, so every thread remembers its
+// last few lookups and finds them again without taking the mutex; ids never change once assigned.
+// The table is never pruned: it and the vectors indexed by its ids (watched apps, event store and
+// group-by ids) grow with the number of distinct executable files seen, about the length of a path
+// plus 50 bytes per file, i.e. a few MB for tens of thousands of files.
+
+#pragma once
+
+#include "EndpointSecurity/EndpointSecurity.h"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+struct ExecutableKey
+{
+   dev_t device;
+   ino_t inode;
+
+   bool operator==(const ExecutableKey&) const = default;
+};
+
+struct ExecutableKeyHash
+{
+   size_t operator()(const ExecutableKey& key) const
+   {
+      // 64 bit mix of both integers
+      uint64_t hash = static_cast<uint64_t>(key.inode) * 0x9e3779b97f4a7c15ull;
+      hash ^= static_cast<uint64_t>(key.device) + 0x7f4a7c159e3779b9ull + (hash << 6) + (hash >> 2);
+      return static_cast<size_t>(hash);
+   }
+};
+
+class ExecutableTable
+{
+public:
+   using Id = uint32_t;
+
+   static ExecutableKey keyOf(const es_file_t* executable)
+   {
+      return {executable->stat.st_dev, executable->stat.st_ino};
+   }
+
+   /// returns the id of the executable, assigning a new one if it has not been seen before
+   Id intern(const es_file_t* executable)
+   {
+      const ExecutableKey key = keyOf(executable);
+      auto& cached = recentIds[ExecutableKeyHash {}(key) % recentIds.size()];
+      if (cached.table == this && cached.key == key)
+         return cached.id;
+      
+      std::scoped_lock lock {mutex};
+      auto [it, inserted] = ids.try_emplace(key, static_cast<Id>(paths.size()));
+      if (inserted)
+         paths.emplace_back(executable->path.data, executable->path.length);
+      cached = {this, key, it->second};
+      return it->second;
+   }
+
+   /// the path under which the executable was first seen
+   std::string path(Id id) const
+   {
+      std::scoped_lock lock {mutex};
+      return paths.at(id);
+   }
+
+   std::string name(Id id) const
+   {
+      const auto executablePath = path(id);
+      const auto pos = executablePath.rfind('/');
+      return pos == std::string::npos ? executablePath : executablePath.substr(pos + 1);
+   }
+
+   size_t size() const
+   {
+      std::scoped_lock lock {mutex};
+      return paths.size();
+   }
+
+private:
+   struct RecentId
+   {
+      const ExecutableTable* table;
+      ExecutableKey key;
+      Id id;
+   };
+
+   /// the last lookups of the thread, shared by all tables
+   static inline thread_local std::array<RecentId, 16> recentIds {};
+
+   mutable std::mutex mutex;
+   std::unordered_map<ExecutableKey, Id, ExecutableKeyHash> ids {};
+   std::vector<std::string> paths {};
+};
@@ -0,0 +1,634 @@
+// Filter expressions which decide per ES message whether it is taken into account.
+//
+// Example:
+//    exec.target.path =~ "/usr/bin/*" && process.uid == 501 && !(signing_id =~ "com.apple.*")
+//
+// An expression is compiled once at startup into a flat list of instructions for an accumulator machine:
+// every comparison writes its result into the accumulator, && and || are compiled into conditional jumps
+// which short-circuit the evaluation. The fields referenced by the program are extracted from the message
+// once before the program runs, string literals are interned and the glob patterns of each field are compiled
+// into one automaton (see PathMatcher.h for the glob syntax), so a field is read once per message no matter how
+// many globs test it. Alternatives of an || which compare the same field with == or =~ are joined into a single
+// lookup in a sorted set of literals, numbers or patterns.
+
+#pragma once
+
+#include "Types.h"
+#include "PathMatcher.h"
+#include "EndpointSecurity/EndpointSecurity.h"
+#include <bsm/libbsm.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace Filter
+{
+   /// message fields which can be used in filter expressions, string fields come first
+   enum class Field : uint8_t
+   {
+      ProcessPath,
+      ProcessName,
+      SigningId,
+      TeamId,
+      TargetPath,
+      TargetName,
+      // integer fields
+      ProcessPid,
+      ProcessPpid,
+      ProcessUid,
+      PlatformBinary,
+      TargetPid,
+      Event,
+      Count
+   };
+
+   constexpr size_t numStringFields = static_cast<size_t>(Field::ProcessPid);
+   constexpr size_t numIntFields = static_cast<size_t>(Field::Count) - numStringFields;
+
+   const std::unordered_map<std::string_view, Field> name2field {
+      {"process.path", Field::ProcessPath},
+      {"process.name", Field::ProcessName},
+      {"signing_id", Field::SigningId},
+      {"process.signing_id", Field::SigningId},
+      {"team_id", Field::TeamId},
+      {"process.team_id", Field::TeamId},
+      {"exec.target.path", Field::TargetPath},
+      {"exec.target.name", Field::TargetName},
+      {"process.pid", Field::ProcessPid},
+      {"process.ppid", Field::ProcessPpid},
+      {"process.uid", Field::ProcessUid},
+      {"process.platform_binary", Field::PlatformBinary},
+      {"exec.target.pid", Field::TargetPid},
+      {"event", Field::Event},
+   };
+
+   inline bool isStringField(Field field)
+   {
+      return static_cast<size_t>(field) < numStringFields;
+   }
+
+   inline std::string_view toStringView(const es_string_token_t& token)
+   {
+      return token.length > 0 ? std::string_view {token.data, token.length} : std::string_view {};
+   }
+
+   inline std::string_view basename(std::string_view path)
+   {
+      const auto pos = path.rfind('/');
+      return pos == std::string_view::npos ? path : path.substr(pos + 1);
+   }
+
+   /// the values of the fields a program references, extracted once per message
+   struct MessageFields
+   {
+      std::array<std::string_view, numStringFields> strings {};
+      std::array<int64_t, numIntFields> numbers {};
+   };
+
+   enum class OpCode : uint8_t
+   {
+      StringEqual,
+      StringNotEqual,
+      GlobMatch,
+      GlobNoMatch,
+      IntEqual,
+      IntNotEqual,
+      IntLess,
+      IntLessEqual,
+      IntGreater,
+      IntGreaterEqual,
+      Not,
+      JumpIfFalse,
+      JumpIfTrue,
+      // alternatives joined by joinAlternatives
+      StringIn,
+      GlobAny,
+      IntIn,
+   };
+
+   struct Instruction
+   {
+      OpCode op;
+      /// index into MessageFields::strings or MessageFields::numbers
+      uint8_t field;
+      /// literal index, pattern id in the automaton of the field or number index for comparisons, set index for the
+      /// joined alternatives, target instruction for jumps
+      uint32_t argument;
+   };
+
+   class Program
+   {
+   public:
+      /// throws std::invalid_argument if the expression is malformed
+      static Program compile(std::string_view expression)
+      {
+         Program program {};
+         Parser parser {expression, program};
+         parser.parseExpression();
+         parser.expectEnd();
+         for (size_t field = 0; field < numStringFields; ++field)
+         {
+            if (!program.globPatterns[field].empty())
+               program.globs[field].emplace(program.globPatterns[field]);
+         }
+         return program;
+      }
+
+      bool matches(const es_message_t* msg) const
+      {
+         MessageFields& fields = messageFields;
+         extract(msg, fields);
+         globMatches.fill(nullptr);
+
+         bool accumulator = true;
+         const size_t size = code.size();
+         for (size_t pc = 0; pc < size; ++pc)
+         {
+            const Instruction& instruction = code[pc];
+            switch (instruction.op)
+            {
+               case OpCode::StringEqual: accumulator = fields.strings[instruction.field] == literals[instruction.argument]; break;
+               case OpCode::StringNotEqual: accumulator = fields.strings[instruction.field] != literals[instruction.argument]; break;
+               case OpCode::GlobMatch: accumulator = matchesGlob(instruction.field, instruction.argument); break;
+               case OpCode::GlobNoMatch: accumulator = !matchesGlob(instruction.field, instruction.argument); break;
+               case OpCode::IntEqual: accumulator = fields.numbers[instruction.field] == numbers[instruction.argument]; break;
+               case OpCode::IntNotEqual: accumulator = fields.numbers[instruction.field] != numbers[instruction.argument]; break;
+               case OpCode::IntLess: accumulator = fields.numbers[instruction.field] < numbers[instruction.argument]; break;
+               case OpCode::IntLessEqual: accumulator = fields.numbers[instruction.field] <= numbers[instruction.argument]; break;
+               case OpCode::IntGreater: accumulator = fields.numbers[instruction.field] > numbers[instruction.argument]; break;
+               case OpCode::IntGreaterEqual: accumulator = fields.numbers[instruction.field] >= numbers[instruction.argument]; break;
+               case OpCode::Not: accumulator = !accumulator; break;
+               case OpCode::JumpIfFalse: if (!accumulator) pc = instruction.argument - 1; break;
+               case OpCode::JumpIfTrue: if (accumulator) pc = instruction.argument - 1; break;
+               case OpCode::StringIn:
+               {
+                  const auto& set = literalSets[instruction.argument];
+                  accumulator = std::binary_search(set.begin(), set.end(), fields.strings[instruction.field], std::less<> {});
+                  break;
+               }
+               case OpCode::GlobAny: accumulator = matchesAnyGlob(instruction.field, instruction.argument); break;
+               case OpCode::IntIn:
+               {
+                  const auto& set = numberSets[instruction.argument];
+                  accumulator = std::binary_search(set.begin(), set.end(), fields.numbers[instruction.field]);
+                  break;
+               }
+            }
+         }
+         return accumulator;
+      }
+
+      size_t numInstructions() const
+      {
+         return code.size();
+      }
+
+   private:
+      class Parser
+      {
+      public:
+         Parser(std::string_view expression, Program& program) : input {expression}, program {program} {}
+
+         /// expression := and ('||' and)*
+         void parseExpression()
+         {
+            const size_t start = program.code.size();
+            std::vector<std::pair<size_t, size_t>> alternatives {};
+            do
+            {
+               const size_t begin = program.code.size();
+               parseAnd();
+               alternatives.emplace_back(begin, program.code.size());
+            } while (consume("||"));
+            program.joinAlternatives(start, alternatives);
+         }
+
+         void expectEnd()
+         {
+            skipWhitespace();
+            if (pos != input.size())
+               fail("unexpected input");
+         }
+
+      private:
+         /// and := unary ('&&' unary)*
+         void parseAnd()
+         {
+            std::vector<size_t> jumps {};
+            parseUnary();
+            while (consume("&&"))
+            {
+               jumps.push_back(program.emit(OpCode::JumpIfFalse, 0, 0));
+               parseUnary();
+            }
+            patch(jumps);
+         }
+
+         /// unary := '!' unary | '(' expression ')' | comparison
+         void parseUnary()
+         {
+            skipWhitespace();
+            if (peek() == '!' && !lookingAt("!="))
+            {
+               ++pos;
+               parseUnary();
+               program.emit(OpCode::Not, 0, 0);
+            }
+            else if (consume("("))
+            {
+               parseExpression();
+               if (!consume(")"))
+                  fail("expected ')'");
+            }
+            else
+            {
+               parseComparison();
+            }
+         }
+
+         /// comparison := field operator literal
+         void parseComparison()
+         {
+            const auto fieldName = parseIdentifier();
+            if (!name2field.contains(fieldName))
+               fail("unknown field '" + std::string(fieldName) + "'");
+            const Field field = name2field.at(fieldName);
+
+            skipWhitespace();
+            std::string_view op {};
+            for (std::string_view candidate : {"==", "!=", "=~", "!~", "<=", ">=", "<", ">"})
+            {
+               if (consume(candidate))
+               {
+                  op = candidate;
+                  break;
+               }
+            }
+            if (op.empty())
+               fail("expected a comparison operator");
+
+            if (isStringField(field))
+               compileStringComparison(field, op);
+            else
+               compileIntComparison(field, op);
+         }
+
+         void compileStringComparison(Field field, std::string_view op)
+         {
+            const bool isGlob = op == "=~" || op == "!~";
+            const auto literal = parseString(isGlob);
+            const auto index = static_cast<uint8_t>(field);
+            if (op == "==" || op == "!=")
+               program.emit(op == "==" ? OpCode::StringEqual : OpCode::StringNotEqual, index, program.internLiteral(literal));
+            else if (isGlob)
+               program.emit(op == "=~" ? OpCode::GlobMatch : OpCode::GlobNoMatch, index, program.internGlob(index, literal));
+            else
+               fail("operator " + std::string(op) + " is not supported for string fields");
+            program.useField(field);
+         }
+
+         void compileIntComparison(Field field, std::string_view op)
+         {
+            int64_t value {0};
+            if (field == Field::Event)
+            {
+               const auto eventName = parseString(false);
+               if (!ESEventTypes::name2event.contains(eventName))
+                  fail("'" + eventName + "' is not a valid ES event type");
+               value = ESEventTypes::name2event.at(eventName);
+            }
+            else
+            {
+               value = parseInteger();
+            }
+
+            static const std::unordered_map<std::string_view, OpCode> intOps {
+               {"==", OpCode::IntEqual}, {"!=", OpCode::IntNotEqual},
+               {"<", OpCode::IntLess}, {"<=", OpCode::IntLessEqual},
+               {">", OpCode::IntGreater}, {">=", OpCode::IntGreaterEqual},
+            };
+            if (!intOps.contains(op))
+               fail("operator " + std::string(op) + " is not supported for integer fields");
+            program.emit(intOps.at(op), static_cast<uint8_t>(static_cast<size_t>(field) - numStringFields), program.internNumber(value));
+            program.useField(field);
+         }
+
+         std::string_view parseIdentifier()
+         {
+            skipWhitespace();
+            const size_t start = pos;
+            while (pos < input.size() && (std::isalnum(static_cast<unsigned char>(input[pos])) || input[pos] == '_' || input[pos] == '.'))
+               ++pos;
+            if (start == pos)
+               fail("expected a field name");
+            return input.substr(start, pos - start);
+         }
+
+         /// keepGlobEscapes preserves escaped wildcards for the glob compiler
+         std::string parseString(bool keepGlobEscapes)
+         {
+            skipWhitespace();
+            if (peek() != '"')
+               fail("expected a string literal");
+            ++pos;
+            std::string value {};
+            while (pos < input.size() && input[pos] != '"')
+            {
+               if (input[pos] == '\\' && pos + 1 < input.size())
+               {
+                  const char escaped = input[pos + 1];
+                  if (keepGlobEscapes && (escaped == '*' || escaped == '?' || escaped == '\\'))
+                     value += '\\';
+                  ++pos;
+               }
+               value += input[pos++];
+            }
+            if (pos == input.size())
+               fail("unterminated string literal");
+            ++pos;
+            return value;
+         }
+
+         int64_t parseInteger()
+         {
+            skipWhitespace();
+            if (consume("true"))
+               return 1;
+            if (consume("false"))
+               return 0;
+            int64_t value {0};
+            const auto [end, error] = std::from_chars(input.data() + pos, input.data() + input.size(), value);
+            if (error != std::errc())
+               fail("expected an integer");
+            pos = static_cast<size_t>(end - input.data());
+            return value;
+         }
+
+         /// lets all given jumps point to the next instruction
+         void patch(const std::vector<size_t>& jumps)
+         {
+            for (const auto jump : jumps)
+               program.code[jump].argument = static_cast<uint32_t>(program.code.size());
+         }
+
+         void skipWhitespace()
+         {
+            while (pos < input.size() && std::isspace(static_cast<unsigned char>(input[pos])))
+               ++pos;
+         }
+
+         char peek() const
+         {
+            return pos < input.size() ? input[pos] : '\0';
+         }
+
+         bool lookingAt(std::string_view token) const
+         {
+            return input.substr(pos).starts_with(token);
+         }
+
+         bool consume(std::string_view token)
+         {
+            skipWhitespace();
+            if (!lookingAt(token))
+               return false;
+            pos += token.size();
+            return true;
+         }
+
+         [[noreturn]] void fail(const std::string& message) const
+         {
+            throw std::invalid_argument(message + " at position " + std::to_string(pos) + " of filter expression");
+         }
+
+         std::string_view input;
+         size_t pos {0};
+         Program& program;
+      };
+
+      size_t emit(OpCode op, uint8_t field, uint32_t argument)
+      {
+         code.push_back({op, field, argument});
+         return code.size() - 1;
+      }
+
+      /// Emits the code of the alternatives of an ||, whose code from start on is given by ranges, so that
+      /// the first true one ends the evaluation. Alternatives which are single == or =~ comparisons of the
+      /// same field become one set lookup, comparisons have no side effects so their order does not matter.
+      void joinAlternatives(size_t start, const std::vector<std::pair<size_t, size_t>>& alternatives)
+      {
+         const std::vector<Instruction> alternativesCode(code.begin() + static_cast<std::ptrdiff_t>(start), code.end());
+         code.resize(start);
+         auto isJoinable = [](const Instruction& instruction) {
+            return instruction.op == OpCode::StringEqual || instruction.op == OpCode::GlobMatch || instruction.op == OpCode::IntEqual;
+         };
+
+         // comparisons by operation and field, in the order of their first appearance
+         std::vector<std::vector<Instruction>> groups {};
+         std::vector<std::pair<size_t, size_t>> others {};
+         for (const auto& [begin, end] : alternatives)
+         {
+            const Instruction& instruction = alternativesCode[begin - start];
+            if (end - begin != 1 || !isJoinable(instruction))
+            {
+               others.emplace_back(begin, end);
+               continue;
+            }
+            auto group = std::find_if(groups.begin(), groups.end(), [&instruction](const auto& group) {
+               return group.front().op == instruction.op && group.front().field == instruction.field;
+            });
+            if (group == groups.end())
+               groups.push_back({instruction});
+            else
+               group->push_back(instruction);
+         }
+
+         std::vector<size_t> jumps {};
+         auto separate = [this, start, &jumps] {
+            if (code.size() > start)
+               jumps.push_back(emit(OpCode::JumpIfTrue, 0, 0));
+         };
+         for (const auto& group : groups)
+         {
+            separate();
+            if (group.size() == 1)
+               code.push_back(group.front());
+            else
+               emitSetLookup(group);
+         }
+         for (const auto& [begin, end] : others)
+         {
+            separate();
+            // jumps within an alternative target its own code or its end
+            const size_t newBegin = code.size();
+            for (size_t i = begin; i < end; ++i)
+            {
+               Instruction instruction = alternativesCode[i - start];
+               if (instruction.op == OpCode::JumpIfFalse || instruction.op == OpCode::JumpIfTrue)
+                  instruction.argument = static_cast<uint32_t>(instruction.argument - begin + newBegin);
+               code.push_back(instruction);
+            }
+         }
+         for (const auto jump : jumps)
+            code[jump].argument = static_cast<uint32_t>(code.size());
+      }
+
+      /// emits one lookup for comparisons of the same operation and field
+      void emitSetLookup(const std::vector<Instruction>& comparisons)
+      {
+         const Instruction& first = comparisons.front();
+         auto sorted = [](auto values) {
+            std::sort(values.begin(), values.end());
+            values.erase(std::unique(values.begin(), values.end()), values.end());
+            return values;
+         };
+         std::vector<std::string> literalSet {};
+         std::vector<PathMatcher::PatternId> patternSet {};
+         std::vector<int64_t> numberSet {};
+         for (const auto& comparison : comparisons)
+         {
+            switch (comparison.op)
+            {
+               case OpCode::StringEqual: literalSet.push_back(literals[comparison.argument]); break;
+               case OpCode::GlobMatch: patternSet.push_back(comparison.argument); break;
+               default: numberSet.push_back(numbers[comparison.argument]); break;
+            }
+         }
+         switch (first.op)
+         {
+            case OpCode::StringEqual:
+               literalSets.push_back(sorted(std::move(literalSet)));
+               emit(OpCode::StringIn, first.field, static_cast<uint32_t>(literalSets.size() - 1));
+               break;
+            case OpCode::GlobMatch:
+               patternSets.push_back(sorted(std::move(patternSet)));
+               emit(OpCode::GlobAny, first.field, static_cast<uint32_t>(patternSets.size() - 1));
+               break;
+            default:
+               numberSets.push_back(sorted(std::move(numberSet)));
+               emit(OpCode::IntIn, first.field, static_cast<uint32_t>(numberSets.size() - 1));
+               break;
+         }
+      }
+
+      uint32_t internLiteral(const std::string& literal)
+      {
+         for (size_t i = 0; i < literals.size(); ++i)
+         {
+            if (literals[i] == literal)
+               return static_cast<uint32_t>(i);
+         }
+         literals.push_back(literal);
+         return static_cast<uint32_t>(literals.size() - 1);
+      }
+
+      /// the pattern id of the glob in the automaton of the field
+      uint32_t internGlob(uint8_t field, const std::string& pattern)
+      {
+         auto& patterns = globPatterns[field];
+         for (size_t i = 0; i < patterns.size(); ++i)
+         {
+            if (patterns[i] == pattern)
+               return static_cast<uint32_t>(i);
+         }
+         patterns.push_back(pattern);
+         return static_cast<uint32_t>(patterns.size() - 1);
+      }
+
+      /// the patterns matching the field, its automaton runs the first time one of its globs is evaluated for a message
+      const std::vector<PathMatcher::PatternId>& globMatchesOf(uint8_t field) const
+      {
+         auto& matches = globMatches[field];
+         if (!matches)
+            matches = &globs[field]->match(messageFields.strings[field]);
+         return *matches;
+      }
+
+      bool matchesGlob(uint8_t field, uint32_t patternId) const
+      {
+         const auto& matches = globMatchesOf(field);
+         return std::find(matches.begin(), matches.end(), patternId) != matches.end();
+      }
+
+      bool matchesAnyGlob(uint8_t field, uint32_t patternSet) const
+      {
+         const auto& set = patternSets[patternSet];
+         const auto& matches = globMatchesOf(field);
+         return std::any_of(matches.begin(), matches.end(), [&set](const auto patternId) { return std::binary_search(set.begin(), set.end(), patternId); });
+      }
+
+      uint32_t internNumber(int64_t value)
+      {
+         for (size_t i = 0; i < numbers.size(); ++i)
+         {
+            if (numbers[i] == value)
+               return static_cast<uint32_t>(i);
+         }
+         numbers.push_back(value);
+         return static_cast<uint32_t>(numbers.size() - 1);
+      }
+
+      void useField(Field field)
+      {
+         for (const auto used : usedFields)
+         {
+            if (used == field)
+               return;
+         }
+         usedFields.push_back(field);
+      }
+
+      void extract(const es_message_t* msg, MessageFields& fields) const
+      {
+         const es_process_t* target = msg->event_type == ES_EVENT_TYPE_NOTIFY_EXEC ? msg->event.exec.target : nullptr;
+         for (const auto field : usedFields)
+         {
+            const auto stringIndex = static_cast<size_t>(field);
+            const auto intIndex = stringIndex - numStringFields;
+            switch (field)
+            {
+               case Field::ProcessPath: fields.strings[stringIndex] = toStringView(msg->process->executable->path); break;
+               case Field::ProcessName: fields.strings[stringIndex] = basename(toStringView(msg->process->executable->path)); break;
+               case Field::SigningId: fields.strings[stringIndex] = toStringView(msg->process->signing_id); break;
+               case Field::TeamId: fields.strings[stringIndex] = toStringView(msg->process->team_id); break;
+               case Field::TargetPath: fields.strings[stringIndex] = target ? toStringView(target->executable->path) : std::string_view {}; break;
+               case Field::TargetName: fields.strings[stringIndex] = target ? basename(toStringView(target->executable->path)) : std::string_view {}; break;
+               case Field::ProcessPid: fields.numbers[intIndex] = audit_token_to_pid(msg->process->audit_token); break;
+               case Field::ProcessPpid: fields.numbers[intIndex] = msg->process->ppid; break;
+               case Field::ProcessUid: fields.numbers[intIndex] = audit_token_to_euid(msg->process->audit_token); break;
+               case Field::PlatformBinary: fields.numbers[intIndex] = msg->process->is_platform_binary; break;
+               case Field::TargetPid: fields.numbers[intIndex] = target ? audit_token_to_pid(target->audit_token) : -1; break;
+               case Field::Event: fields.numbers[intIndex] = msg->event_type; break;
+               case Field::Count: break;
+            }
+         }
+      }
+
+      std::vector<Instruction> code {};
+      std::vector<std::string> literals {};
+      /// the automata of the string fields with globs, they cache their transitions while matching
+      mutable std::array<std::optional<PathMatcher>, numStringFields> globs {};
+      /// the patterns matching the field in the current message, nullptr until its automaton ran
+      mutable std::array<const std::vector<PathMatcher::PatternId>*, numStringFields> globMatches {};
+      /// reused for every message instead of clearing a new one, extract overwrites all fields the program reads
+      mutable MessageFields messageFields {};
+      std::array<std::vector<std::string>, numStringFields> globPatterns {};
+      std::vector<int64_t> numbers {};
+      /// sorted sets of the joined alternatives
+      std::vector<std::vector<std::string>> literalSets {};
+      std::vector<std::vector<PathMatcher::PatternId>> patternSets {};
+      std::vector<std::vector<int64_t>> numberSets {};
+      std::vector<Field> usedFields {};
+   };
+}
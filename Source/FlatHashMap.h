@@ -0,0 +1,425 @@
+// An open-addressing hash map in the style of Swiss tables for the statistics maps.
+//
+// Entries are stored inline in one array instead of one node per entry. Next to it a control byte per
+// slot holds either "empty" or 7 bits of the hash of the entry's key. Slots are probed a group of 16 at a
+// time: one vector compare of the control bytes of the group against the 7 bits of the hash yields the
+// few slots whose keys are worth comparing, another one whether the group has an empty slot, which ends
+// the search. The table grows by doubling once it is 7/8 full. An erased entry leaves a "deleted" control
+// byte behind, which lookups probe past and inserts reuse. Deleted slots count towards the load, once they
+// fill it the table is rebuilt without them at the same size.
+//
+// Keys can be looked up by any type the hash and the equality accept, e.g. a std::string_view for a
+// std::string key, so lookups don't need to build a key. Growing moves the entries: pointers and
+// references to entries are only valid until the next insert, unless the map was reserved for all of them.
+
+#pragma once
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <algorithm>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <tuple>
+#include <utility>
+
+/// hashes strings as string_view, so maps with string keys can be searched with views without building a string
+struct FlatHash
+{
+   using is_transparent = void;
+
+   size_t operator()(std::string_view text) const
+   {
+      return std::hash<std::string_view> {}(text);
+   }
+
+   template<std::integral Integer>
+   size_t operator()(Integer value) const
+   {
+      return std::hash<Integer> {}(value);
+   }
+};
+
+template<typename Key, typename Value, typename Hash = FlatHash, typename Equal = std::equal_to<>>
+class FlatHashMap
+{
+public:
+   using value_type = std::pair<Key, Value>;
+
+   template<bool isConst>
+   class Iterator
+   {
+   public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = FlatHashMap::value_type;
+      using difference_type = std::ptrdiff_t;
+      using pointer = std::conditional_t<isConst, const value_type*, value_type*>;
+      using reference = std::conditional_t<isConst, const value_type&, value_type&>;
+
+      Iterator() = default;
+      Iterator(const FlatHashMap* map, size_t index) : map {map}, index {index}
+      {
+         skipEmpty();
+      }
+
+      reference operator*() const
+      {
+         return map->slots[index];
+      }
+
+      pointer operator->() const
+      {
+         return &map->slots[index];
+      }
+
+      Iterator& operator++()
+      {
+         ++index;
+         skipEmpty();
+         return *this;
+      }
+
+      Iterator operator++(int)
+      {
+         Iterator previous = *this;
+         ++*this;
+         return previous;
+      }
+
+      bool operator==(const Iterator& other) const
+      {
+         return index == other.index;
+      }
+
+      operator Iterator<true>() const requires (!isConst)
+      {
+         return {map, index};
+      }
+
+   private:
+      void skipEmpty()
+      {
+         while (index < map->capacity && map->control[index] < 0)
+            ++index;
+      }
+
+      const FlatHashMap* map {nullptr};
+      size_t index {0};
+   };
+
+   using iterator = Iterator<false>;
+   using const_iterator = Iterator<true>;
+
+   FlatHashMap() = default;
+
+   FlatHashMap(const FlatHashMap& other)
+   {
+      reserve(other.size());
+      for (const auto& [key, value] : other)
+         constructAt(insertSlot(hashOf(key)), key, value);
+   }
+
+   FlatHashMap(FlatHashMap&& other) noexcept
+   {
+      swap(other);
+   }
+
+   FlatHashMap& operator=(FlatHashMap other) noexcept
+   {
+      swap(other);
+      return *this;
+   }
+
+   ~FlatHashMap()
+   {
+      destroy();
+   }
+
+   void swap(FlatHashMap& other) noexcept
+   {
+      std::swap(control, other.control);
+      std::swap(slots, other.slots);
+      std::swap(capacity, other.capacity);
+      std::swap(numEntries, other.numEntries);
+      std::swap(numDeleted, other.numDeleted);
+   }
+
+   iterator begin()
+   {
+      return {this, 0};
+   }
+
+   iterator end()
+   {
+      return {this, capacity};
+   }
+
+   const_iterator begin() const
+   {
+      return {this, 0};
+   }
+
+   const_iterator end() const
+   {
+      return {this, capacity};
+   }
+
+   size_t size() const
+   {
+      return numEntries;
+   }
+
+   bool empty() const
+   {
+      return numEntries == 0;
+   }
+
+   /// makes room for size entries, so inserting them neither rehashes nor moves entries
+   void reserve(size_t size)
+   {
+      size_t newCapacity = std::max(capacity, groupSize);
+      while (newCapacity * 7 / 8 < size)
+         newCapacity *= 2;
+      if (newCapacity > capacity)
+         rehash(newCapacity);
+   }
+
+   /// removes all entries but keeps the memory
+   void clear()
+   {
+      for (size_t i = 0; i < capacity; ++i)
+      {
+         if (control[i] >= 0)
+            std::destroy_at(&slots[i]);
+      }
+      if (capacity > 0)
+         std::memset(control.get(), emptySlot, capacity);
+      numEntries = 0;
+      numDeleted = 0;
+   }
+
+   template<typename K>
+   iterator find(const K& key)
+   {
+      return {this, findIndex(key)};
+   }
+
+   template<typename K>
+   const_iterator find(const K& key) const
+   {
+      return {this, findIndex(key)};
+   }
+
+   template<typename K>
+   bool contains(const K& key) const
+   {
+      return findIndex(key) != capacity;
+   }
+
+   template<typename K>
+   Value& at(const K& key)
+   {
+      const size_t index = findIndex(key);
+      if (index == capacity)
+         throw std::out_of_range("FlatHashMap::at");
+      return slots[index].second;
+   }
+
+   template<typename K>
+   const Value& at(const K& key) const
+   {
+      const size_t index = findIndex(key);
+      if (index == capacity)
+         throw std::out_of_range("FlatHashMap::at");
+      return slots[index].second;
+   }
+
+   /// the value of the key, a default constructed value is inserted if there is none, the key is only built then
+   template<typename K>
+   Value& operator[](K&& key)
+   {
+      return try_emplace(std::forward<K>(key)).first->second;
+   }
+
+   template<typename K, typename... Args>
+   std::pair<iterator, bool> try_emplace(K&& key, Args&&... args)
+   {
+      const size_t hash = hashOf(key);
+      if (const size_t index = findIndex(key, hash); index != capacity)
+         return {{this, index}, false};
+      const size_t index = insertSlot(hash);
+      constructAt(index, std::forward<K>(key), std::forward<Args>(args)...);
+      return {{this, index}, true};
+   }
+
+   template<typename K, typename V>
+   std::pair<iterator, bool> emplace(K&& key, V&& value)
+   {
+      return try_emplace(std::forward<K>(key), std::forward<V>(value));
+   }
+
+   /// removes the entry of the key, returns whether there was one
+   template<typename K>
+   bool erase(const K& key)
+   {
+      const size_t index = findIndex(key);
+      if (index == capacity)
+         return false;
+      std::destroy_at(&slots[index]);
+      control[index] = deletedSlot;
+      numEntries--;
+      numDeleted++;
+      return true;
+   }
+
+private:
+   static constexpr size_t groupSize = 16;
+   static constexpr int8_t emptySlot = -128;
+   static constexpr int8_t deletedSlot = -2;
+
+   /// bits of the slots of a group whose control byte equals the given one, see slotOf
+   static uint64_t matchGroup(const int8_t* group, int8_t byte)
+   {
+#if defined(__SSE2__)
+      const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+      return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(byte))));
+#elif defined(__ARM_NEON)
+      const uint8x16_t equal = vceqq_s8(vld1q_s8(group), vdupq_n_s8(byte));
+      // narrowing leaves 4 bits per slot, one of them is enough
+      return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(equal), 4)), 0) & 0x8888888888888888ull;
+#else
+      uint64_t bits {0};
+      for (size_t i = 0; i < groupSize; ++i)
+         bits |= static_cast<uint64_t>(group[i] == byte) << i;
+      return bits;
+#endif
+   }
+
+   /// the slot in its group of the lowest bit of a match
+   static size_t slotOf(uint64_t bits)
+   {
+#if !defined(__SSE2__) && defined(__ARM_NEON)
+      return static_cast<size_t>(std::countr_zero(bits)) / 4;
+#else
+      return static_cast<size_t>(std::countr_zero(bits));
+#endif
+   }
+
+   template<typename K>
+   size_t hashOf(const K& key) const
+   {
+      // spreads hashes like the identity hash of integers over all bits: the halves of the 128 bit product
+      // both depend on all bits of the hash, so the 7 bits of the control byte and the bits choosing the
+      // group don't go together
+      const unsigned __int128 product = static_cast<unsigned __int128>(Hash {}(key)) * 0x9e3779b97f4a7c15ull;
+      return static_cast<size_t>(static_cast<uint64_t>(product >> 64) ^ static_cast<uint64_t>(product));
+   }
+
+   static int8_t controlOf(size_t hash)
+   {
+      return static_cast<int8_t>(hash & 0x7f);
+   }
+
+   template<typename K>
+   size_t findIndex(const K& key) const
+   {
+      return findIndex(key, hashOf(key));
+   }
+
+   /// the slot of the key, capacity if it is not in the map
+   template<typename K>
+   size_t findIndex(const K& key, size_t hash) const
+   {
+      if (capacity == 0)
+         return capacity;
+      const size_t groupMask = capacity / groupSize - 1;
+      const int8_t control = controlOf(hash);
+      // triangular probing visits every group once, as the number of groups is a power of 2
+      for (size_t group = (hash >> 7) & groupMask, step = 1;; group = (group + step++) & groupMask)
+      {
+         const int8_t* groupControl = this->control.get() + group * groupSize;
+         for (uint64_t bits = matchGroup(groupControl, control); bits != 0; bits &= bits - 1)
+         {
+            const size_t index = group * groupSize + slotOf(bits);
+            if (Equal {}(slots[index].first, key))
+               return index;
+         }
+         if (matchGroup(groupControl, emptySlot) != 0)
+            return capacity;
+      }
+   }
+
+   /// marks the first empty or deleted slot on the probe sequence of the hash as used, growing the table if needed
+   size_t insertSlot(size_t hash)
+   {
+      if (numEntries + numDeleted + 1 > capacity * 7 / 8)
+      {
+         // mostly deleted slots are dropped without growing
+         rehash(numEntries + 1 > capacity * 7 / 16 ? std::max(groupSize, capacity * 2) : capacity);
+      }
+      const size_t groupMask = capacity / groupSize - 1;
+      for (size_t group = (hash >> 7) & groupMask, step = 1;; group = (group + step++) & groupMask)
+      {
+         const int8_t* groupControl = control.get() + group * groupSize;
+         if (const uint64_t free = matchGroup(groupControl, emptySlot) | matchGroup(groupControl, deletedSlot))
+         {
+            const size_t index = group * groupSize + slotOf(free);
+            if (control[index] == deletedSlot)
+               numDeleted--;
+            control[index] = controlOf(hash);
+            numEntries++;
+            return index;
+         }
+      }
+   }
+
+   template<typename K, typename... Args>
+   void constructAt(size_t index, K&& key, Args&&... args)
+   {
+      std::construct_at(&slots[index], std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)),
+                        std::forward_as_tuple(std::forward<Args>(args)...));
+   }
+
+   void rehash(size_t newCapacity)
+   {
+      FlatHashMap previous {};
+      swap(previous);
+      control = std::make_unique<int8_t[]>(newCapacity);
+      std::memset(control.get(), emptySlot, newCapacity);
+      slots = std::allocator<value_type> {}.allocate(newCapacity);
+      capacity = newCapacity;
+      for (size_t i = 0; i < previous.capacity; ++i)
+      {
+         if (previous.control[i] < 0)
+            continue;
+         auto& [key, value] = previous.slots[i];
+         constructAt(insertSlot(hashOf(key)), std::move(key), std::move(value));
+      }
+   }
+
+   void destroy()
+   {
+      clear();
+      if (slots)
+         std::allocator<value_type> {}.deallocate(slots, capacity);
+      slots = nullptr;
+   }
+
+   std::unique_ptr<int8_t[]> control {};
+   value_type* slots {nullptr};
+   /// a multiple of groupSize and a power of 2, or 0
+   size_t capacity {0};
+   size_t numEntries {0};
+   size_t numDeleted {0};
+};
@@ -0,0 +1,221 @@
+// Keeps the most recent messages in a fixed-size ring, so the messages leading up to an incident
+// can be written to a capture file after the fact.
+//
+// The ring is a single anonymous mapping, optionally backed by 2 MB superpages, whose pages are all
+// touched up front, so recording never allocates or faults: it copies the record header and two
+// paths behind the newest record and drops the oldest records to make room. Records never wrap
+// around the end of the ring, the space left there is filled with a marker record.
+//
+// Freezing swaps in a second ring of the same size, recording continues in it right away while the
+// frozen one is written to a capture file by CaptureWriter. Until that dump is released further
+// freezes are refused.
+
+#pragma once
+
+#include "Capture.h"
+#include "CaptureWriter.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+#if __has_include(<mach/vm_statistics.h>)
+#include <mach/vm_statistics.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+class FlightRecorder
+{
+public:
+   /// the capacity in bytes is rounded up to whole pages, or 2 MB superpages if they are requested
+   FlightRecorder(size_t capacity, bool superpages)
+      : rings {Ring {capacity, superpages}, Ring {capacity, superpages}}
+   {
+   }
+
+   FlightRecorder(const FlightRecorder&) = delete;
+   FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+   bool valid() const
+   {
+      return rings[0].data != nullptr && rings[1].data != nullptr;
+   }
+
+   bool usesSuperpages() const
+   {
+      return rings[0].superpages;
+   }
+
+   size_t capacity() const
+   {
+      return rings[0].capacity;
+   }
+
+   /// header.size must be Capture::recordSize of the two paths
+   void record(const Capture::RecordHeader& header, std::string_view executable, std::string_view file)
+   {
+      std::scoped_lock lock {mutex};
+      rings[active].append(header, executable, file);
+   }
+
+   /// Freezes the recorded messages and continues in the spare ring.
+   /// Returns false if the previous dump was not released yet.
+   bool freeze()
+   {
+      std::scoped_lock lock {mutex};
+      if (frozen)
+         return false;
+      frozen = true;
+      active ^= 1;
+      return true;
+   }
+
+   /// Writes the frozen messages to a capture file, must only be called between freeze and release.
+   /// Returns nothing if the file could not be written.
+   std::optional<CaptureWriter::Statistics> dump(const std::string& path, const Capture::FileHeader& fileHeader, Capture::Compressor compressor,
+                                                 WorkStealingPool* pool) const
+   {
+      const Ring& ring = rings[active ^ 1];
+      Capture::FileHeader header {fileHeader};
+      header.numOverwritten = ring.numOverwritten;
+
+      CaptureWriter writer {path, header, compressor, pool};
+      ring.forEachRecord([&writer](const Capture::RecordHeader& record) {
+         writer.add(record);
+      });
+      if (!writer.finish())
+         return std::nullopt;
+      return writer.statistics();
+   }
+
+   /// Empties the frozen ring, so it can take over at the next freeze.
+   void release()
+   {
+      std::scoped_lock lock {mutex};
+      rings[active ^ 1].clear();
+      frozen = false;
+   }
+
+private:
+   struct Ring
+   {
+      Ring(size_t requestedCapacity, [[maybe_unused]] bool useSuperpages)
+      {
+#ifdef VM_FLAGS_SUPERPAGE_SIZE_2MB
+         if (useSuperpages)
+         {
+            constexpr size_t superpageSize = 2 * 1024 * 1024;
+            capacity = (requestedCapacity + superpageSize - 1) / superpageSize * superpageSize;
+            // for anonymous mappings the file descriptor carries the VM flags
+            void* mapping = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, VM_FLAGS_SUPERPAGE_SIZE_2MB, 0);
+            if (mapping != MAP_FAILED)
+            {
+               data = static_cast<std::byte*>(mapping);
+               superpages = true;
+            }
+         }
+#endif
+         if (!data)
+         {
+            const auto pageSize = static_cast<size_t>(getpagesize());
+            capacity = (requestedCapacity + pageSize - 1) / pageSize * pageSize;
+            void* mapping = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+            data = mapping != MAP_FAILED ? static_cast<std::byte*>(mapping) : nullptr;
+         }
+         // fault all pages in now instead of while recording
+         if (data)
+            std::memset(data, 0, capacity);
+      }
+
+      Ring(Ring&& other) noexcept
+         : data {std::exchange(other.data, nullptr)}, capacity {other.capacity}, superpages {other.superpages}
+      {
+      }
+
+      ~Ring()
+      {
+         if (data)
+            munmap(data, capacity);
+      }
+
+      void append(const Capture::RecordHeader& header, std::string_view executable, std::string_view file)
+      {
+         size_t offset = head % capacity;
+         if (capacity - offset < header.size)
+         {
+            const auto fillerSize = static_cast<uint32_t>(capacity - offset);
+            makeRoom(fillerSize);
+            Capture::RecordHeader filler {};
+            filler.size = fillerSize;
+            filler.eventType = Capture::wrapMarker;
+            // only size and event type have to fit, records and capacity are multiples of 8
+            std::memcpy(data + offset, &filler, std::min<size_t>(fillerSize, sizeof(filler)));
+            head += fillerSize;
+            offset = 0;
+         }
+         makeRoom(header.size);
+
+         std::byte* record = data + offset;
+         std::memcpy(record, &header, sizeof(header));
+         std::memcpy(record + sizeof(header), executable.data(), executable.size());
+         std::memcpy(record + sizeof(header) + executable.size(), file.data(), file.size());
+         const size_t used = sizeof(header) + executable.size() + file.size();
+         std::memset(record + used, 0, header.size - used);
+         head += header.size;
+      }
+
+      /// drops the oldest records until size bytes are free
+      void makeRoom(size_t size)
+      {
+         while (head + size - tail > capacity)
+         {
+            const auto& oldest = *reinterpret_cast<const Capture::RecordHeader*>(data + tail % capacity);
+            if (oldest.eventType != Capture::wrapMarker)
+               numOverwritten++;
+            tail += oldest.size;
+         }
+      }
+
+      /// calls f for the records from the oldest to the newest
+      template<typename F>
+      void forEachRecord(F&& f) const
+      {
+         for (uint64_t position = tail; position < head;)
+         {
+            const auto& record = *reinterpret_cast<const Capture::RecordHeader*>(data + position % capacity);
+            if (record.eventType != Capture::wrapMarker)
+               f(record);
+            position += record.size;
+         }
+      }
+
+      void clear()
+      {
+         head = 0;
+         tail = 0;
+         numOverwritten = 0;
+      }
+
+      std::byte* data {nullptr};
+      size_t capacity {0};
+      bool superpages {false};
+      /// positions since the start of the recording, their offsets in the ring are position % capacity
+      uint64_t head {0};
+      uint64_t tail {0};
+      uint64_t numOverwritten {0};
+   };
+
+   std::mutex mutex;
+   std::array<Ring, 2> rings;
+   /// index of the ring being recorded into
+   size_t active {0};
+   bool frozen {false};
+};
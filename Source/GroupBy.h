@@ -0,0 +1,280 @@
+// Counts messages per combination of the values of user-chosen dimensions, e.g. --group-by event,exe,uid.
+//
+// The value of every dimension is turned into a small integer, either directly like a pid or by interning
+// it into the dense ids of its dimension like an executable name, and the integers are packed into a
+// single 64 bit key. Counts are kept in an open-addressing table of such keys with linear probing, so a
+// message costs one hash of an integer and usually a single cache line. Both the table and the ids of each
+// dimension have a fixed capacity chosen up front: values which find no id anymore share the id of
+// "<other>", groups which find no slot anymore are only counted as overflow, so memory stays flat.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class GroupBy
+{
+public:
+   enum class Dimension : uint8_t
+   {
+      Event,
+      Executable,
+      Target,
+      Uid,
+      Tty,
+      Pid,
+      Ppid,
+   };
+
+   struct DimensionInfo
+   {
+      std::string_view name;
+      unsigned bits;
+      /// values are interned into dense ids instead of being packed as they are
+      bool interned;
+   };
+
+   static constexpr std::array<std::pair<Dimension, DimensionInfo>, 7> dimensionInfos {{
+      {Dimension::Event, {"event", 8, false}},
+      {Dimension::Executable, {"exe", 20, true}},
+      {Dimension::Target, {"target", 20, true}},
+      {Dimension::Uid, {"uid", 16, true}},
+      {Dimension::Tty, {"tty", 12, true}},
+      {Dimension::Pid, {"pid", 20, false}},
+      {Dimension::Ppid, {"ppid", 20, false}},
+   }};
+
+   static const DimensionInfo& infoOf(Dimension dimension)
+   {
+      return dimensionInfos[static_cast<size_t>(dimension)].second;
+   }
+
+   /// id of the values which did not fit into the ids of an interned dimension
+   static constexpr uint32_t otherId = 0;
+   /// id of "-", the value of an interned dimension a message has none of, e.g. the target of a message which is not an exec
+   static constexpr uint32_t noValueId = 1;
+
+   /// Parses dimension names, throws std::invalid_argument if one is unknown or the keys don't fit into 63 bits.
+   static std::vector<Dimension> parse(const std::vector<std::string>& names)
+   {
+      std::vector<Dimension> dimensions {};
+      unsigned bits {0};
+      for (const auto& name : names)
+      {
+         const auto entry = std::find_if(dimensionInfos.begin(), dimensionInfos.end(), [&name](const auto& entry) { return entry.second.name == name; });
+         if (entry == dimensionInfos.end())
+            throw std::invalid_argument("unknown dimension '" + name + "'");
+         if (std::find(dimensions.begin(), dimensions.end(), entry->first) != dimensions.end())
+            throw std::invalid_argument("dimension '" + name + "' is given twice");
+         bits += entry->second.bits;
+         dimensions.push_back(entry->first);
+      }
+      if (bits > 63)
+         throw std::invalid_argument("the dimensions need " + std::to_string(bits) + " bits, at most 63 fit into a key");
+      return dimensions;
+   }
+
+   GroupBy(std::vector<Dimension> dimensions, size_t maxGroups) : dimensions {std::move(dimensions)}, ids(this->dimensions.size())
+   {
+      size_t capacity {16};
+      // the table is never filled beyond 7/8, so probe sequences stay short
+      while (capacity * 7 / 8 < maxGroups)
+         capacity *= 2;
+      slots.assign(capacity, {emptyKey, 0});
+      this->maxGroups = maxGroups;
+      for (size_t d = 0; d < this->dimensions.size(); ++d)
+      {
+         if (infoOf(this->dimensions[d]).interned)
+         {
+            ids[d].labels.emplace_back("<other>");
+            addLabel(d, "-");
+         }
+      }
+   }
+
+   const std::vector<Dimension>& allDimensions() const
+   {
+      return dimensions;
+   }
+
+   /// the dense id of a string value of the d-th dimension
+   uint32_t intern(size_t d, std::string_view label)
+   {
+      auto& dimensionIds = ids[d];
+      if (const auto it = dimensionIds.byLabel.find(label); it != dimensionIds.byLabel.end())
+         return it->second;
+      return addLabel(d, std::string(label));
+   }
+
+   /// the dense id of a numeric value of the d-th dimension
+   uint32_t intern(size_t d, int64_t value)
+   {
+      auto& dimensionIds = ids[d];
+      if (const auto it = dimensionIds.byNumber.find(value); it != dimensionIds.byNumber.end())
+         return it->second;
+      const uint32_t id = addLabel(d, std::to_string(value));
+      dimensionIds.byNumber.emplace(value, id);
+      return id;
+   }
+
+   /// Builds the key of a group from the values of its dimensions in order, ids for interned dimensions.
+   /// Values which don't fit into the bits of their dimension are truncated.
+   uint64_t pack(std::span<const uint32_t> values) const
+   {
+      uint64_t key {0};
+      for (size_t d = 0; d < dimensions.size(); ++d)
+      {
+         const unsigned bits = infoOf(dimensions[d]).bits;
+         key = key << bits | (values[d] & ((uint64_t {1} << bits) - 1));
+      }
+      return key;
+   }
+
+   void add(uint64_t key, uint64_t count = 1)
+   {
+      numMessages += count;
+      const size_t mask = slots.size() - 1;
+      for (size_t i = hash(key) & mask;; i = (i + 1) & mask)
+      {
+         auto& slot = slots[i];
+         if (slot.first == key)
+         {
+            slot.second += count;
+            return;
+         }
+         if (slot.first == emptyKey)
+         {
+            if (numGroups == maxGroups)
+            {
+               numOverflow += count;
+               return;
+            }
+            slot = {key, count};
+            numGroups++;
+            return;
+         }
+      }
+   }
+
+   /// a group with the values of its dimensions
+   struct Row
+   {
+      std::vector<uint32_t> values {};
+      uint64_t count {0};
+   };
+
+   /// the groups with the most messages, ordered by count
+   std::vector<Row> top(size_t k) const
+   {
+      std::vector<std::pair<uint64_t, uint64_t>> groups {};
+      groups.reserve(numGroups);
+      for (const auto& slot : slots)
+      {
+         if (slot.first != emptyKey)
+            groups.push_back(slot);
+      }
+      const size_t numRows = std::min(k, groups.size());
+      std::partial_sort(groups.begin(), groups.begin() + static_cast<std::ptrdiff_t>(numRows), groups.end(), [](const auto& a, const auto& b) {
+         return a.second > b.second || (a.second == b.second && a.first < b.first);
+      });
+
+      std::vector<Row> rows(numRows);
+      for (size_t r = 0; r < numRows; ++r)
+      {
+         rows[r].count = groups[r].second;
+         uint64_t key = groups[r].first;
+         rows[r].values.resize(dimensions.size());
+         for (size_t d = dimensions.size(); d-- > 0;)
+         {
+            const unsigned bits = infoOf(dimensions[d]).bits;
+            rows[r].values[d] = static_cast<uint32_t>(key & ((uint64_t {1} << bits) - 1));
+            key >>= bits;
+         }
+      }
+      return rows;
+   }
+
+   /// the label of an id of an interned dimension, the number itself otherwise
+   std::string label(size_t d, uint32_t value) const
+   {
+      return infoOf(dimensions[d]).interned ? ids[d].labels[value] : std::to_string(value);
+   }
+
+   uint64_t size() const
+   {
+      return numGroups;
+   }
+
+   /// messages counted since the last clear, including the overflow
+   uint64_t total() const
+   {
+      return numMessages;
+   }
+
+   /// messages of groups which did not fit into the table anymore
+   uint64_t overflow() const
+   {
+      return numOverflow;
+   }
+
+   /// forgets the counts but keeps the ids, so the next interval does not intern the same values again
+   void clear()
+   {
+      std::fill(slots.begin(), slots.end(), std::pair {emptyKey, uint64_t {0}});
+      numGroups = 0;
+      numMessages = 0;
+      numOverflow = 0;
+   }
+
+   /// memory of the table, the ids come on top
+   size_t tableBytes() const
+   {
+      return slots.size() * sizeof(slots.front());
+   }
+
+private:
+   /// keys have at most 63 bits
+   static constexpr uint64_t emptyKey = UINT64_MAX;
+
+   struct Ids
+   {
+      /// by id, the deque keeps the strings in place, so the keys of byLabel stay valid
+      std::deque<std::string> labels {};
+      std::unordered_map<std::string_view, uint32_t> byLabel {};
+      std::unordered_map<int64_t, uint32_t> byNumber {};
+   };
+
+   uint32_t addLabel(size_t d, std::string label)
+   {
+      auto& dimensionIds = ids[d];
+      if (dimensionIds.labels.size() >= (size_t {1} << infoOf(dimensions[d]).bits))
+         return otherId;
+      const auto id = static_cast<uint32_t>(dimensionIds.labels.size());
+      dimensionIds.byLabel.emplace(dimensionIds.labels.emplace_back(std::move(label)), id);
+      return id;
+   }
+
+   static size_t hash(uint64_t key)
+   {
+      // the upper bits of the product depend on all bits of the key
+      return static_cast<size_t>((key * 0x9e3779b97f4a7c15ull) >> 32);
+   }
+
+   std::vector<Dimension> dimensions;
+   std::vector<Ids> ids;
+   std::vector<std::pair<uint64_t, uint64_t>> slots {};
+   size_t maxGroups {0};
+   uint64_t numGroups {0};
+   uint64_t numMessages {0};
+   uint64_t numOverflow {0};
+};
@@ -0,0 +1,249 @@
+// Writes JSON into a large buffer which is flushed to a file descriptor with a single write.
+//
+// Strings are escaped by skipping over the bytes which need no escaping a vector at a time: printable
+// ASCII other than the quote and the backslash. Only the bytes found that way are looked at one by
+// one, control characters are escaped and multi-byte UTF-8 sequences are validated and copied, bytes
+// which are not valid UTF-8 become U+FFFD, so the output is always valid JSON. Paths are nearly always
+// ASCII, so escaping them costs little more than copying them.
+
+#pragma once
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <unistd.h>
+
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+namespace Json
+{
+
+/// length of the prefix of data which can be copied into a JSON string as is
+inline size_t plainLength(const char* data, size_t size)
+{
+   size_t i {0};
+#if defined(__AVX2__)
+   // bytes below 0x20 and above 0x7f are both below 0x20 when compared as signed bytes
+   for (; i + 32 <= size; i += 32)
+   {
+      const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+      const __m256i special = _mm256_or_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(0x20), bytes),
+                                              _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('"')),
+                                                              _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\\'))));
+      if (const auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(special)))
+         return i + static_cast<size_t>(std::countr_zero(mask));
+   }
+#endif
+#if defined(__SSE2__)
+   for (; i + 16 <= size; i += 16)
+   {
+      const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+      const __m128i special = _mm_or_si128(_mm_cmplt_epi8(bytes, _mm_set1_epi8(0x20)),
+                                           _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('"')), _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\\'))));
+      if (const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(special)))
+         return i + static_cast<size_t>(std::countr_zero(mask));
+   }
+#elif defined(__ARM_NEON)
+   for (; i + 16 <= size; i += 16)
+   {
+      const uint8x16_t bytes = vld1q_u8(reinterpret_cast<const uint8_t*>(data + i));
+      const uint8x16_t special = vorrq_u8(vcltq_s8(vreinterpretq_s8_u8(bytes), vdupq_n_s8(0x20)),
+                                          vorrq_u8(vceqq_u8(bytes, vdupq_n_u8('"')), vceqq_u8(bytes, vdupq_n_u8('\\'))));
+      // narrowing leaves 4 bits per byte, the first special byte is the first set nibble
+      const uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(special), 4)), 0);
+      if (mask != 0)
+         return i + static_cast<size_t>(std::countr_zero(mask)) / 4;
+   }
+#endif
+   for (; i < size; ++i)
+   {
+      const auto byte = static_cast<uint8_t>(data[i]);
+      if (byte < 0x20 || byte >= 0x80 || byte == '"' || byte == '\\')
+         return i;
+   }
+   return size;
+}
+
+/// length of the valid UTF-8 sequence starting with a byte above 0x7f, 0 if it is not valid
+inline size_t utf8SequenceLength(const uint8_t* data, size_t size)
+{
+   auto continuation = [&](size_t i, uint8_t low = 0x80, uint8_t high = 0xbf) { return i < size && data[i] >= low && data[i] <= high; };
+   const uint8_t lead = data[0];
+   if (lead >= 0xc2 && lead <= 0xdf)
+      return continuation(1) ? 2 : 0;
+   if (lead >= 0xe0 && lead <= 0xef)
+   {
+      // no overlong encodings and no surrogates
+      const bool second = lead == 0xe0 ? continuation(1, 0xa0) : lead == 0xed ? continuation(1, 0x80, 0x9f) : continuation(1);
+      return second && continuation(2) ? 3 : 0;
+   }
+   if (lead >= 0xf0 && lead <= 0xf4)
+   {
+      const bool second = lead == 0xf0 ? continuation(1, 0x90) : lead == 0xf4 ? continuation(1, 0x80, 0x8f) : continuation(1);
+      return second && continuation(2) && continuation(3) ? 4 : 0;
+   }
+   return 0;
+}
+
+/// bytes escape writes at most for a text of the given size
+constexpr size_t maxEscapedSize(size_t size)
+{
+   return size * 6;
+}
+
+/// Writes text escaped for a JSON string to out, which must have room for maxEscapedSize(text.size()) bytes.
+/// Returns the end of the escaped text.
+inline char* escape(std::string_view text, char* out)
+{
+   constexpr std::string_view hexDigits {"0123456789abcdef"};
+   const char* data = text.data();
+   size_t position {0};
+   while (true)
+   {
+      const size_t plain = plainLength(data + position, text.size() - position);
+      std::memcpy(out, data + position, plain);
+      out += plain;
+      position += plain;
+      if (position == text.size())
+         return out;
+
+      const auto byte = static_cast<uint8_t>(data[position]);
+      if (byte >= 0x80)
+      {
+         if (const size_t length = utf8SequenceLength(reinterpret_cast<const uint8_t*>(data + position), text.size() - position))
+         {
+            std::memcpy(out, data + position, length);
+            out += length;
+            position += length;
+         }
+         else
+         {
+            std::memcpy(out, "\\ufffd", 6);
+            out += 6;
+            position++;
+         }
+         continue;
+      }
+
+      *out++ = '\\';
+      switch (byte)
+      {
+         case '"': *out++ = '"'; break;
+         case '\\': *out++ = '\\'; break;
+         case '\n': *out++ = 'n'; break;
+         case '\r': *out++ = 'r'; break;
+         case '\t': *out++ = 't'; break;
+         case '\b': *out++ = 'b'; break;
+         case '\f': *out++ = 'f'; break;
+         default:
+            std::memcpy(out, "u00", 3);
+            out[3] = hexDigits[byte >> 4];
+            out[4] = hexDigits[byte & 0xf];
+            out += 5;
+            break;
+      }
+      position++;
+   }
+}
+
+/// collects output and writes it to a file descriptor whenever it is full
+class Buffer
+{
+public:
+   explicit Buffer(int fd, size_t capacity = 1024 * 1024) : fd {fd}, data(capacity)
+   {
+   }
+
+   Buffer(const Buffer&) = delete;
+   Buffer& operator=(const Buffer&) = delete;
+
+   ~Buffer()
+   {
+      flush();
+   }
+
+   void append(std::string_view text)
+   {
+      char* out = reserve(text.size());
+      std::memcpy(out, text.data(), text.size());
+      used += text.size();
+   }
+
+   void append(char c)
+   {
+      *reserve(1) = c;
+      used++;
+   }
+
+   template<typename Integer>
+   void appendNumber(Integer value)
+   {
+      char* out = reserve(24);
+      used = static_cast<size_t>(std::to_chars(out, out + 24, value).ptr - data.data());
+   }
+
+   /// appends text as JSON string including the quotes
+   void appendString(std::string_view text)
+   {
+      char* out = reserve(maxEscapedSize(text.size()) + 2);
+      *out++ = '"';
+      out = escape(text, out);
+      *out++ = '"';
+      used = static_cast<size_t>(out - data.data());
+   }
+
+   /// Writes the buffered output, returns false if it or any earlier output could not be written.
+   bool flush()
+   {
+      size_t written {0};
+      while (written < used && !failed)
+      {
+         const ssize_t result = ::write(fd, data.data() + written, used - written);
+         if (result < 0 && errno != EINTR)
+            failed = true;
+         else if (result > 0)
+            written += static_cast<size_t>(result);
+      }
+      bytesWritten += written;
+      used = 0;
+      return !failed;
+   }
+
+   /// bytes written to the file descriptor so far
+   uint64_t size() const
+   {
+      return bytesWritten;
+   }
+
+private:
+   /// room for size more bytes
+   char* reserve(size_t size)
+   {
+      if (used + size > data.size())
+      {
+         flush();
+         if (size > data.size())
+            data.resize(size);
+      }
+      return data.data() + used;
+   }
+
+   int fd;
+   std::vector<char> data;
+   size_t used {0};
+   uint64_t bytesWritten {0};
+   bool failed {false};
+};
+
+}
@@ -0,0 +1,87 @@
+// Histogram of durations in logarithmic buckets.
+//
+// Each power of two is split into eight linear sub-buckets, so a recorded value is known with a
+// relative error of at most 12.5% while the histogram keeps a fixed size of 4 KB for the whole
+// range of 64 bit nanoseconds. Recording is a few shifts and an increment.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+
+class LogHistogram
+{
+public:
+   void record(uint64_t value)
+   {
+      buckets[bucketOf(value)]++;
+      count++;
+      max = std::max(max, value);
+   }
+
+   void merge(const LogHistogram& other)
+   {
+      for (size_t i = 0; i < numBuckets; ++i)
+         buckets[i] += other.buckets[i];
+      count += other.count;
+      max = std::max(max, other.max);
+   }
+
+   /// upper bound of the bucket containing the value at the given quantile (0..1), never above the maximum
+   uint64_t percentile(double quantile) const
+   {
+      if (count == 0)
+         return 0;
+      const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(quantile * static_cast<double>(count) + 0.5));
+      uint64_t seen {0};
+      for (size_t i = 0; i < numBuckets; ++i)
+      {
+         seen += buckets[i];
+         if (seen >= rank)
+            return std::min(upperBoundOf(i), max);
+      }
+      return max;
+   }
+
+   uint64_t numValues() const
+   {
+      return count;
+   }
+
+   uint64_t maximum() const
+   {
+      return max;
+   }
+
+private:
+   static constexpr unsigned subBucketBits = 3;
+   static constexpr uint64_t numSubBuckets = 1u << subBucketBits;
+   static constexpr size_t numBuckets = (64 - subBucketBits + 1) * numSubBuckets;
+
+   /// values below numSubBuckets get a bucket of their own, above the top bits after the leading one select the sub-bucket
+   static size_t bucketOf(uint64_t value)
+   {
+      if (value < numSubBuckets)
+         return static_cast<size_t>(value);
+      const auto exponent = static_cast<unsigned>(std::bit_width(value)) - 1;
+      const auto subBucket = (value >> (exponent - subBucketBits)) & (numSubBuckets - 1);
+      return static_cast<size_t>((exponent - subBucketBits + 1) * numSubBuckets + subBucket);
+   }
+
+   static uint64_t upperBoundOf(size_t bucket)
+   {
+      if (bucket < numSubBuckets)
+         return bucket;
+      const auto exponent = static_cast<unsigned>(bucket / numSubBuckets) + subBucketBits - 1;
+      const auto subBucket = bucket % numSubBuckets;
+      const auto shift = exponent - subBucketBits;
+      const uint64_t lowerBound = (numSubBuckets + subBucket) << shift;
+      return lowerBound + ((uint64_t {1} << shift) - 1);
+   }
+
+   std::array<uint64_t, numBuckets> buckets {};
+   uint64_t count {0};
+   uint64_t max {0};
+};
@@ -0,0 +1,259 @@
+// Matches a path against many glob patterns at once in a single pass without backtracking.
+//
+// All patterns are compiled into one NFA whose states are the positions within the patterns.
+// The NFA is turned into a DFA lazily: a DFA state is the set of NFA positions which are active
+// after reading a prefix of the path, its transitions are computed the first time they are taken and
+// cached. Input bytes are mapped to equivalence classes first, so the transition table only has one
+// column per byte which makes a difference for the patterns. If the cache exceeds its memory budget
+// it is flushed and rebuilt on demand.
+//
+// Patterns: '*' matches any sequence without '/', '**' any sequence, '?' a single character other
+// than '/' and '\' escapes the next character.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class PathMatcher
+{
+public:
+   using PatternId = uint32_t;
+
+   explicit PathMatcher(const std::vector<std::string>& patterns, size_t cacheBudgetBytes = 16 * 1024 * 1024)
+   {
+      std::array<bool, 256> significant {};
+      significant['/'] = true;
+
+      for (PatternId id = 0; id < patterns.size(); ++id)
+      {
+         compilePattern(patterns[id], id, significant);
+      }
+      buildByteClasses(significant);
+      maxStates = std::max<size_t>(64, cacheBudgetBytes / (numClasses * sizeof(int32_t)));
+      reset();
+   }
+
+   /// Returns the ids of all patterns matching the whole path.
+   /// The reference stays valid until the next call, the matcher must not be used concurrently.
+   const std::vector<PatternId>& match(std::string_view path)
+   {
+      int32_t state = startState;
+      if (state == deadState)
+         return noMatches;
+      for (const char c : path)
+      {
+         const size_t byteClass = byteClasses[static_cast<unsigned char>(c)];
+         int32_t next = transitions[static_cast<size_t>(state) * numClasses + byteClass];
+         if (next == unknownState)
+            next = computeTransition(state, byteClass);
+         if (next == deadState)
+            return noMatches;
+         state = next;
+      }
+      return states[static_cast<size_t>(state)].accepting;
+   }
+
+   bool matches(std::string_view path)
+   {
+      return !match(path).empty();
+   }
+
+   size_t numCachedStates() const
+   {
+      return states.size();
+   }
+
+private:
+   enum class TokenType : uint8_t
+   {
+      Literal,
+      AnyChar,
+      Star,
+      DoubleStar,
+      Accept
+   };
+
+   struct Token
+   {
+      TokenType type;
+      char literal;
+      PatternId pattern;
+   };
+
+   struct DfaState
+   {
+      std::vector<uint32_t> positions;
+      std::vector<PatternId> accepting;
+   };
+
+   struct PositionsHash
+   {
+      size_t operator()(const std::vector<uint32_t>& positions) const
+      {
+         size_t hash = positions.size();
+         for (const auto position : positions)
+            hash ^= position + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+         return hash;
+      }
+   };
+
+   static constexpr int32_t unknownState = -1;
+   static constexpr int32_t deadState = -2;
+
+   void compilePattern(const std::string& pattern, PatternId id, std::array<bool, 256>& significant)
+   {
+      startPositions.push_back(static_cast<uint32_t>(tokens.size()));
+      for (size_t i = 0; i < pattern.size(); ++i)
+      {
+         const char c = pattern[i];
+         if (c == '*')
+         {
+            bool crossesDirectories = false;
+            while (i + 1 < pattern.size() && pattern[i + 1] == '*')
+            {
+               crossesDirectories = true;
+               ++i;
+            }
+            // consecutive stars are merged, the widest one wins
+            if (!tokens.empty() && tokens.back().pattern == id && tokens.size() > startPositions.back()
+                && (tokens.back().type == TokenType::Star || tokens.back().type == TokenType::DoubleStar))
+            {
+               if (crossesDirectories)
+                  tokens.back().type = TokenType::DoubleStar;
+               continue;
+            }
+            tokens.push_back({crossesDirectories ? TokenType::DoubleStar : TokenType::Star, '\0', id});
+         }
+         else if (c == '?')
+         {
+            tokens.push_back({TokenType::AnyChar, '\0', id});
+         }
+         else
+         {
+            const char literal = (c == '\\' && i + 1 < pattern.size()) ? pattern[++i] : c;
+            significant[static_cast<unsigned char>(literal)] = true;
+            tokens.push_back({TokenType::Literal, literal, id});
+         }
+      }
+      tokens.push_back({TokenType::Accept, '\0', id});
+   }
+
+   /// bytes which do not occur in any pattern behave identically and share class 0
+   void buildByteClasses(const std::array<bool, 256>& significant)
+   {
+      numClasses = 1;
+      for (size_t b = 0; b < byteClasses.size(); ++b)
+      {
+         if (significant[b])
+         {
+            byteClasses[b] = static_cast<uint16_t>(numClasses);
+            representatives.push_back(static_cast<char>(b));
+            ++numClasses;
+         }
+      }
+      // any byte which is not significant serves as representative of class 0
+      auto other = std::find(significant.begin(), significant.end(), false);
+      representatives.insert(representatives.begin(), static_cast<char>(other - significant.begin()));
+   }
+
+   /// drops all cached states and transitions
+   void reset()
+   {
+      states.clear();
+      stateIds.clear();
+      transitions.clear();
+      std::vector<uint32_t> start = startPositions;
+      closure(start);
+      startState = addState(std::move(start));
+   }
+
+   /// stars can match the empty string, so their successors are active as well
+   void closure(std::vector<uint32_t>& positions) const
+   {
+      const size_t initialSize = positions.size();
+      for (size_t i = 0; i < initialSize; ++i)
+      {
+         auto position = positions[i];
+         while (tokens[position].type == TokenType::Star || tokens[position].type == TokenType::DoubleStar)
+         {
+            positions.push_back(++position);
+         }
+      }
+      std::sort(positions.begin(), positions.end());
+      positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+   }
+
+   int32_t addState(std::vector<uint32_t>&& positions)
+   {
+      if (positions.empty())
+         return deadState;
+      if (auto it = stateIds.find(positions); it != stateIds.end())
+         return it->second;
+
+      DfaState state {};
+      for (const auto position : positions)
+      {
+         if (tokens[position].type == TokenType::Accept)
+            state.accepting.push_back(tokens[position].pattern);
+      }
+      state.positions = positions;
+      const auto id = static_cast<int32_t>(states.size());
+      states.push_back(std::move(state));
+      stateIds.emplace(std::move(positions), id);
+      transitions.resize(states.size() * numClasses, unknownState);
+      return id;
+   }
+
+   int32_t computeTransition(int32_t state, size_t byteClass)
+   {
+      const char c = representatives[byteClass];
+      std::vector<uint32_t> next {};
+      for (const auto position : states[static_cast<size_t>(state)].positions)
+      {
+         const Token& token = tokens[position];
+         switch (token.type)
+         {
+            case TokenType::Literal: if (token.literal == c) next.push_back(position + 1); break;
+            case TokenType::AnyChar: if (c != '/') next.push_back(position + 1); break;
+            case TokenType::Star: if (c != '/') next.push_back(position); break;
+            case TokenType::DoubleStar: next.push_back(position); break;
+            case TokenType::Accept: break;
+         }
+      }
+      closure(next);
+
+      if (states.size() >= maxStates)
+      {
+         // keep the source state alive across the flush so the caller can continue
+         std::vector<uint32_t> current = states[static_cast<size_t>(state)].positions;
+         reset();
+         state = addState(std::move(current));
+      }
+      const int32_t target = addState(std::move(next));
+      transitions[static_cast<size_t>(state) * numClasses + byteClass] = target;
+      return target;
+   }
+
+   std::vector<Token> tokens {};
+   std::vector<uint32_t> startPositions {};
+
+   std::array<uint16_t, 256> byteClasses {};
+   /// one byte per class used to compute its transitions
+   std::vector<char> representatives {};
+   size_t numClasses {1};
+
+   std::vector<DfaState> states {};
+   std::unordered_map<std::vector<uint32_t>, int32_t, PositionsHash> stateIds {};
+   /// numClasses entries per state, unknownState if not computed yet
+   std::vector<int32_t> transitions {};
+   int32_t startState {0};
+   size_t maxStates {0};
+
+   static inline const std::vector<PatternId> noMatches {};
+};
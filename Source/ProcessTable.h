@@ -0,0 +1,226 @@
+// Per-process state keyed by audit token (pid and pidversion).
+//
+// Entries live in a slab which is allocated once at startup and are recycled through a free list,
+// so tracking processes never allocates while handling messages. Entries are found through an
+// open-addressing index with linear probing; deletions shift the following entries back instead of
+// leaving tombstones. If the slab is full the least recently seen entry out of a small window behind
+// a clock hand is evicted, which keeps memory bounded if exit messages are lost. Evicted entries are handed to
+// the caller's retire function, which erases them like processes which exited.
+
+#pragma once
+
+#include "EndpointSecurity/EndpointSecurity.h"
+#include <bsm/libbsm.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+struct ProcessKey
+{
+   pid_t pid {0};
+   int pidVersion {0};
+
+   static ProcessKey of(const es_process_t* process)
+   {
+      return ofToken(process->audit_token);
+   }
+
+   static ProcessKey ofToken(const audit_token_t& token)
+   {
+      return {audit_token_to_pid(token), audit_token_to_pidversion(token)};
+   }
+
+   bool operator==(const ProcessKey&) const = default;
+};
+
+struct ProcessEntry
+{
+   ProcessKey key {};
+   ProcessKey parent {};
+   uint32_t executable {0};
+   /// index of the watched app whose process tree the process belongs to, -1 if none
+   int32_t treeRoot {-1};
+   /// true if the process descends from the command esmat was started with
+   bool inCommand {false};
+   /// wall clock times of the messages in nanoseconds
+   uint64_t startTime {0};
+   uint64_t lastSeen {0};
+   /// true if the fork or exec creating the process has been observed
+   bool startSeen {false};
+   /// true if the process image was started by an exec, otherwise the start was a fork
+   bool startedByExec {false};
+   bool inUse {false};
+};
+
+class ProcessTable
+{
+public:
+   static constexpr uint32_t noSlot = UINT32_MAX;
+
+   /// numCounters is the number of per-process counters, e.g. one per subscribed event type
+   ProcessTable(size_t capacity, size_t numCounters)
+      : entries(capacity), counters(capacity * numCounters, 0), numCounters {numCounters}
+   {
+      size_t indexSize = 16;
+      while (indexSize < capacity * 2)
+         indexSize *= 2;
+      index.assign(indexSize, noSlot);
+      indexMask = indexSize - 1;
+
+      freeSlots.reserve(capacity);
+      for (size_t slot = capacity; slot > 0; --slot)
+         freeSlots.push_back(static_cast<uint32_t>(slot - 1));
+   }
+
+   ProcessEntry* find(ProcessKey key)
+   {
+      const uint32_t slot = findSlot(key);
+      return slot == noSlot ? nullptr : &entries[slot];
+   }
+
+   /// Returns the entry of the process, a new one is created if it is unknown. If the table is full an old entry is
+   /// evicted by calling retire with it, which must erase it.
+   template<typename Retire>
+   ProcessEntry& findOrInsert(ProcessKey key, bool& inserted, Retire&& retire)
+   {
+      const uint32_t existing = findSlot(key);
+      inserted = existing == noSlot;
+      if (!inserted)
+         return entries[existing];
+
+      if (freeSlots.empty())
+         evict(retire);
+      const uint32_t slot = freeSlots.back();
+      freeSlots.pop_back();
+
+      entries[slot] = ProcessEntry {};
+      entries[slot].key = key;
+      entries[slot].inUse = true;
+      std::fill_n(counters.begin() + static_cast<ptrdiff_t>(slot * numCounters), numCounters, 0);
+
+      size_t pos = hash(key) & indexMask;
+      while (index[pos] != noSlot)
+         pos = (pos + 1) & indexMask;
+      index[pos] = slot;
+      return entries[slot];
+   }
+
+   void erase(const ProcessEntry& entry)
+   {
+      const auto slot = static_cast<uint32_t>(&entry - entries.data());
+      size_t pos = hash(entry.key) & indexMask;
+      while (index[pos] != slot)
+         pos = (pos + 1) & indexMask;
+
+      // backward shift deletion: move following entries of the probe sequence into the gap
+      size_t gap = pos;
+      size_t next = (gap + 1) & indexMask;
+      while (index[next] != noSlot)
+      {
+         const size_t home = hash(entries[index[next]].key) & indexMask;
+         // the entry may fill the gap if its home slot does not lie cyclically between gap and next
+         if (((next - home) & indexMask) >= ((next - gap) & indexMask))
+         {
+            index[gap] = index[next];
+            gap = next;
+         }
+         next = (next + 1) & indexMask;
+      }
+      index[gap] = noSlot;
+
+      entries[slot].inUse = false;
+      freeSlots.push_back(slot);
+   }
+
+   uint32_t* countersOf(const ProcessEntry& entry)
+   {
+      return counters.data() + static_cast<size_t>(&entry - entries.data()) * numCounters;
+   }
+
+   uint64_t totalOf(const ProcessEntry& entry)
+   {
+      uint64_t total {0};
+      const uint32_t* entryCounters = countersOf(entry);
+      for (size_t i = 0; i < numCounters; ++i)
+         total += entryCounters[i];
+      return total;
+   }
+
+   template<typename F>
+   void forEach(F&& f)
+   {
+      for (auto& entry : entries)
+      {
+         if (entry.inUse)
+            f(entry);
+      }
+   }
+
+   size_t size() const
+   {
+      return entries.size() - freeSlots.size();
+   }
+
+   size_t capacity() const
+   {
+      return entries.size();
+   }
+
+   uint64_t numEvictions() const
+   {
+      return evictions;
+   }
+
+private:
+   static size_t hash(ProcessKey key)
+   {
+      uint64_t value = (static_cast<uint64_t>(static_cast<uint32_t>(key.pid)) << 32) | static_cast<uint32_t>(key.pidVersion);
+      value ^= value >> 33;
+      value *= 0xff51afd7ed558ccdull;
+      value ^= value >> 33;
+      return static_cast<size_t>(value);
+   }
+
+   uint32_t findSlot(ProcessKey key) const
+   {
+      size_t pos = hash(key) & indexMask;
+      while (index[pos] != noSlot)
+      {
+         if (entries[index[pos]].key == key)
+            return index[pos];
+         pos = (pos + 1) & indexMask;
+      }
+      return noSlot;
+   }
+
+   /// evicts the least recently seen entry of the next window behind the clock hand
+   template<typename Retire>
+   void evict(Retire& retire)
+   {
+      constexpr size_t window = 32;
+      ProcessEntry* oldest = nullptr;
+      for (size_t i = 0; i < window; ++i)
+      {
+         ProcessEntry& candidate = entries[clockHand];
+         clockHand = (clockHand + 1) % entries.size();
+         if (candidate.inUse && (!oldest || candidate.lastSeen < oldest->lastSeen))
+            oldest = &candidate;
+      }
+      if (oldest)
+      {
+         retire(*oldest);
+         evictions++;
+      }
+   }
+
+   std::vector<ProcessEntry> entries;
+   /// numCounters per entry, stored next to each other
+   std::vector<uint32_t> counters;
+   size_t numCounters;
+   std::vector<uint32_t> freeSlots {};
+   std::vector<uint32_t> index {};
+   size_t indexMask {0};
+   size_t clockHand {0};
+   uint64_t evictions {0};
+};
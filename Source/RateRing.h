@@ -0,0 +1,70 @@
+// Counts messages per second in a ring of the last 64 seconds.
+//
+// The ring is advanced lazily by the thread counting messages: as long as the second does not change
+// counting is a compare and an increment, buckets of seconds without messages are only zeroed once the
+// next message arrives. Readers derive the rolling rates from the buckets of the complete seconds
+// before the given time. The busiest second is tracked when a bucket is completed, so it is known
+// for intervals longer than the ring.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+class RateRing
+{
+public:
+   static constexpr uint64_t numBuckets = 64;
+
+   void add(uint64_t second, uint64_t count)
+   {
+      if (second != currentSecond)
+      {
+         if (second > currentSecond)
+            advance(second);
+         else if (second + numBuckets <= currentSecond)
+            second = currentSecond; // too late for its own bucket
+      }
+      buckets[second % numBuckets] += static_cast<uint32_t>(count);
+   }
+
+   /// average messages per second of the given number of complete seconds before now
+   double rate(uint64_t now, uint64_t seconds) const
+   {
+      seconds = std::min(seconds, numBuckets - 1);
+      uint64_t sum {0};
+      for (uint64_t second = now - seconds; second < now; ++second)
+      {
+         // buckets after the current second were not written yet, the ones before the ring are overwritten
+         if (second <= currentSecond && second + numBuckets > currentSecond)
+            sum += buckets[second % numBuckets];
+      }
+      return static_cast<double>(sum) / static_cast<double>(seconds);
+   }
+
+   /// the most messages counted in a second since the last call of resetPeak, including the current second
+   uint32_t peak() const
+   {
+      return std::max(peakSecond, buckets[currentSecond % numBuckets]);
+   }
+
+   void resetPeak()
+   {
+      peakSecond = 0;
+   }
+
+private:
+   void advance(uint64_t second)
+   {
+      peakSecond = std::max(peakSecond, buckets[currentSecond % numBuckets]);
+      const uint64_t numStale = std::min(second - currentSecond, numBuckets);
+      for (uint64_t i = 1; i <= numStale; ++i)
+         buckets[(currentSecond + i) % numBuckets] = 0;
+      currentSecond = second;
+   }
+
+   std::array<uint32_t, numBuckets> buckets {};
+   uint64_t currentSecond {0};
+   uint32_t peakSecond {0};
+};
@@ -0,0 +1,138 @@
+// Approximate counting in constant memory, safe to update from several threads without locks.
+//
+// HyperLogLog estimates the number of distinct keys: each key is hashed, the first bits of the
+// hash select a register and the register keeps the maximum number of leading zeros seen in the
+// remaining bits. With 4096 registers the standard error is about 1.6%. Two estimators can be merged
+// by taking the maximum of each register, which estimates the distinct keys of the union.
+//
+// A count-min sketch estimates how often a key occurred: every key increments one counter in each
+// of its rows, the estimate is the smallest of these counters. It never underestimates and
+// overestimates by at most e / width of all occurrences with a probability of 1 - e^-depth.
+//
+// Both take hashes, the caller hashes the keys with hashKey or mixHash.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+namespace Sketches
+{
+
+/// finalizer of splitmix64, spreads integer keys over all bits
+inline uint64_t mixHash(uint64_t value)
+{
+   value ^= value >> 30;
+   value *= 0xbf58476d1ce4e5b9ull;
+   value ^= value >> 27;
+   value *= 0x94d049bb133111ebull;
+   value ^= value >> 31;
+   return value;
+}
+
+inline uint64_t hashKey(std::string_view key)
+{
+   return mixHash(std::hash<std::string_view> {}(key));
+}
+
+class HyperLogLog
+{
+public:
+   void add(uint64_t hash)
+   {
+      auto& reg = registers[hash >> (64 - precision)];
+      // the sentinel bit limits the rank if all remaining bits are zero
+      const auto rank = static_cast<uint8_t>(std::countl_zero((hash << precision) | (uint64_t {1} << (precision - 1))) + 1);
+      uint8_t current = reg.load(std::memory_order_relaxed);
+      while (rank > current && !reg.compare_exchange_weak(current, rank, std::memory_order_relaxed))
+      {
+      }
+   }
+
+   void merge(const HyperLogLog& other)
+   {
+      for (size_t i = 0; i < numRegisters; ++i)
+      {
+         const uint8_t rank = other.registers[i].load(std::memory_order_relaxed);
+         if (rank > registers[i].load(std::memory_order_relaxed))
+            registers[i].store(rank, std::memory_order_relaxed);
+      }
+   }
+
+   uint64_t estimate() const
+   {
+      double sum {0};
+      size_t numZeros {0};
+      for (const auto& reg : registers)
+      {
+         const uint8_t rank = reg.load(std::memory_order_relaxed);
+         sum += std::ldexp(1.0, -rank);
+         numZeros += rank == 0;
+      }
+      constexpr double m = numRegisters;
+      const double alpha = 0.7213 / (1.0 + 1.079 / m);
+      const double raw = alpha * m * m / sum;
+      // linear counting is more accurate while many registers are still empty
+      if (raw <= 2.5 * m && numZeros > 0)
+         return static_cast<uint64_t>(std::llround(m * std::log(m / static_cast<double>(numZeros))));
+      return static_cast<uint64_t>(std::llround(raw));
+   }
+
+   void clear()
+   {
+      for (auto& reg : registers)
+         reg.store(0, std::memory_order_relaxed);
+   }
+
+private:
+   static constexpr unsigned precision = 12;
+   static constexpr size_t numRegisters = size_t {1} << precision;
+
+   std::array<std::atomic<uint8_t>, numRegisters> registers {};
+};
+
+class CountMinSketch
+{
+public:
+   void add(uint64_t hash)
+   {
+      for (size_t row = 0; row < depth; ++row)
+         counters[row * width + column(hash, row)].fetch_add(1, std::memory_order_relaxed);
+   }
+
+   uint64_t estimate(uint64_t hash) const
+   {
+      uint32_t minimum = UINT32_MAX;
+      for (size_t row = 0; row < depth; ++row)
+         minimum = std::min(minimum, counters[row * width + column(hash, row)].load(std::memory_order_relaxed));
+      return minimum;
+   }
+
+   void clear()
+   {
+      for (auto& counter : counters)
+         counter.store(0, std::memory_order_relaxed);
+   }
+
+private:
+   static constexpr size_t depth = 4;
+   static constexpr size_t width = 2048;
+
+   /// the rows use the hash functions h1 + row * h2 derived from both halves of the hash
+   static size_t column(uint64_t hash, size_t row)
+   {
+      const auto h1 = static_cast<uint32_t>(hash);
+      const auto h2 = static_cast<uint32_t>(hash >> 32) | 1;
+      return static_cast<size_t>(h1 + static_cast<uint32_t>(row) * h2) % width;
+   }
+
+   std::array<std::atomic<uint32_t>, depth * width> counters {};
+};
+
+}
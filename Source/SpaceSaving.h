@@ -0,0 +1,202 @@
+// Finds the most frequent keys of a stream in fixed memory (Space-Saving algorithm).
+//
+// The sketch monitors a fixed number of keys with a counter each. A key which is not monitored
+// replaces the key with the smallest counter and inherits its count as possible overestimation, so
+// every counter is an upper bound of the true count and exceeds it by at most its error, which is at
+// most total / capacity. Any key occurring more often than that is guaranteed to be monitored.
+//
+// Counters are kept in a min-heap to find the smallest one in O(1), keys are found through an
+// open-addressing index. After construction no memory is allocated except for keys longer than the
+// small string buffer of previously replaced keys.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class SpaceSaving
+{
+public:
+   struct Counter
+   {
+      std::string key {};
+      /// upper bound of the number of occurrences
+      uint64_t count {0};
+      /// maximum overestimation of count
+      uint64_t error {0};
+   };
+
+   explicit SpaceSaving(size_t capacity)
+      : capacity {std::max<size_t>(1, capacity)}
+   {
+      counters.reserve(this->capacity);
+      heap.reserve(this->capacity);
+      heapPositions.reserve(this->capacity);
+      size_t indexSize = 16;
+      while (indexSize < this->capacity * 2)
+         indexSize *= 2;
+      index.assign(indexSize, noSlot);
+      indexMask = indexSize - 1;
+   }
+
+   void add(std::string_view key)
+   {
+      total++;
+      uint32_t slot = findSlot(key);
+      if (slot == noSlot)
+      {
+         if (counters.size() < capacity)
+         {
+            slot = static_cast<uint32_t>(counters.size());
+            counters.push_back({std::string {key}, 1, 0});
+            heapPositions.push_back(static_cast<uint32_t>(heap.size()));
+            heap.push_back(slot);
+            insertIntoIndex(slot);
+            siftUp(heapPositions[slot]);
+            return;
+         }
+         // the key with the smallest count is replaced, its count becomes the error of the new key
+         slot = heap.front();
+         removeFromIndex(slot);
+         counters[slot].key.assign(key);
+         counters[slot].error = counters[slot].count;
+         insertIntoIndex(slot);
+      }
+      counters[slot].count++;
+      siftDown(heapPositions[slot]);
+   }
+
+   /// the n counters with the highest counts, highest first
+   std::vector<Counter> top(size_t n) const
+   {
+      std::vector<Counter> result {counters};
+      std::sort(result.begin(), result.end(), [](const Counter& a, const Counter& b) {
+         return a.count > b.count;
+      });
+      result.resize(std::min(n, result.size()));
+      return result;
+   }
+
+   /// number of keys added
+   uint64_t size() const
+   {
+      return total;
+   }
+
+   /// the maximum overestimation of any counter
+   uint64_t maxError() const
+   {
+      return counters.size() < capacity ? 0 : counters[heap.front()].count;
+   }
+
+   void clear()
+   {
+      counters.clear();
+      heap.clear();
+      heapPositions.clear();
+      std::fill(index.begin(), index.end(), noSlot);
+      total = 0;
+   }
+
+private:
+   static constexpr uint32_t noSlot = UINT32_MAX;
+
+   uint32_t findSlot(std::string_view key) const
+   {
+      size_t pos = std::hash<std::string_view> {}(key) & indexMask;
+      while (index[pos] != noSlot)
+      {
+         if (counters[index[pos]].key == key)
+            return index[pos];
+         pos = (pos + 1) & indexMask;
+      }
+      return noSlot;
+   }
+
+   void insertIntoIndex(uint32_t slot)
+   {
+      size_t pos = hashOf(slot) & indexMask;
+      while (index[pos] != noSlot)
+         pos = (pos + 1) & indexMask;
+      index[pos] = slot;
+   }
+
+   /// backward shift deletion like in ProcessTable
+   void removeFromIndex(uint32_t slot)
+   {
+      size_t gap = hashOf(slot) & indexMask;
+      while (index[gap] != slot)
+         gap = (gap + 1) & indexMask;
+      size_t next = (gap + 1) & indexMask;
+      while (index[next] != noSlot)
+      {
+         const size_t home = hashOf(index[next]) & indexMask;
+         if (((next - home) & indexMask) >= ((next - gap) & indexMask))
+         {
+            index[gap] = index[next];
+            gap = next;
+         }
+         next = (next + 1) & indexMask;
+      }
+      index[gap] = noSlot;
+   }
+
+   size_t hashOf(uint32_t slot) const
+   {
+      return std::hash<std::string_view> {}(counters[slot].key);
+   }
+
+   void swapHeapPositions(size_t a, size_t b)
+   {
+      std::swap(heap[a], heap[b]);
+      heapPositions[heap[a]] = static_cast<uint32_t>(a);
+      heapPositions[heap[b]] = static_cast<uint32_t>(b);
+   }
+
+   /// new counters start with the smallest possible count and move towards the root
+   void siftUp(size_t position)
+   {
+      while (position > 0)
+      {
+         const size_t parent = (position - 1) / 2;
+         if (counters[heap[parent]].count <= counters[heap[position]].count)
+            return;
+         swapHeapPositions(parent, position);
+         position = parent;
+      }
+   }
+
+   /// counts only grow, so a counter can only move towards the leaves
+   void siftDown(size_t position)
+   {
+      const size_t size = heap.size();
+      while (true)
+      {
+         size_t smallest = position;
+         const size_t left = 2 * position + 1;
+         const size_t right = left + 1;
+         if (left < size && counters[heap[left]].count < counters[heap[smallest]].count)
+            smallest = left;
+         if (right < size && counters[heap[right]].count < counters[heap[smallest]].count)
+            smallest = right;
+         if (smallest == position)
+            return;
+         swapHeapPositions(position, smallest);
+         position = smallest;
+      }
+   }
+
+   size_t capacity;
+   std::vector<Counter> counters {};
+   /// slots in counters ordered as min-heap by count
+   std::vector<uint32_t> heap {};
+   /// position in heap by slot
+   std::vector<uint32_t> heapPositions {};
+   std::vector<uint32_t> index {};
+   size_t indexMask {0};
+   uint64_t total {0};
+};
@@ -2,6 +2,9 @@
 // HEADER_PATH="/Applications/Xcode.app/Contents/Developer/Platforms/MacOSX.platform/Developer/SDKs/MacOSX.sdk/usr/include/EndpointSecurity/ESTypes.h'
 // awk '/,*ES_EVENT_TYPE/ && ! /\/\// && ! /\*/ {print $0}'  > ~/vastlimits/ESClientTest/ESClientTest/Types.h
 
+
+#pragma once
+#include <string>
 #include <unordered_map>
 #include "EndpointSecurity/EndpointSecurity.h"
 
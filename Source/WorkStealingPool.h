@@ -0,0 +1,142 @@
+// Runs batches of independent tasks on a fixed set of threads.
+//
+// Each thread owns a queue of task indices. A batch is dealt out in contiguous chunks, so neighbouring
+// tasks, which usually touch neighbouring data, run on the same thread in order. A thread whose queue
+// runs dry steals from the back of the other queues, so uneven tasks don't leave threads idle while
+// one of them works through a long queue. The threads wait for the next batch between batches.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool
+{
+public:
+   explicit WorkStealingPool(size_t numThreads)
+   {
+      numThreads = std::max<size_t>(1, numThreads);
+      for (size_t i = 0; i < numThreads; ++i)
+         queues.push_back(std::make_unique<Queue>());
+      for (size_t i = 0; i < numThreads; ++i)
+         threads.emplace_back([this, i] { work(i); });
+   }
+
+   WorkStealingPool(const WorkStealingPool&) = delete;
+   WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+   ~WorkStealingPool()
+   {
+      {
+         std::scoped_lock lock {mutex};
+         stopping = true;
+      }
+      wake.notify_all();
+      for (auto& thread : threads)
+         thread.join();
+   }
+
+   size_t size() const
+   {
+      return threads.size();
+   }
+
+   /// runs all tasks and returns once every one of them finished
+   void run(const std::vector<std::function<void()>>& tasks)
+   {
+      if (tasks.empty())
+         return;
+
+      std::unique_lock lock {mutex};
+      batch.store(&tasks, std::memory_order_release);
+      remaining = tasks.size();
+      const size_t chunkSize = (tasks.size() + queues.size() - 1) / queues.size();
+      for (size_t i = 0; i < queues.size(); ++i)
+      {
+         std::scoped_lock queueLock {queues[i]->mutex};
+         for (size_t task = i * chunkSize; task < std::min(tasks.size(), (i + 1) * chunkSize); ++task)
+            queues[i]->tasks.push_back(task);
+      }
+      generation++;
+      wake.notify_all();
+      done.wait(lock, [this] { return remaining == 0; });
+      batch.store(nullptr, std::memory_order_release);
+   }
+
+private:
+   struct Queue
+   {
+      std::mutex mutex;
+      std::deque<size_t> tasks {};
+   };
+
+   void work(size_t self)
+   {
+      uint64_t seenGeneration {0};
+      while (true)
+      {
+         {
+            std::unique_lock lock {mutex};
+            wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+            if (stopping)
+               return;
+            seenGeneration = generation;
+         }
+
+         while (const auto task = take(self))
+         {
+            // a late thread may already take tasks of the next batch, the batch stays set while any of its tasks runs
+            (*batch.load(std::memory_order_acquire))[*task]();
+            std::scoped_lock lock {mutex};
+            if (--remaining == 0)
+               done.notify_one();
+         }
+      }
+   }
+
+   /// the next task of the own queue or one stolen from the back of another queue
+   std::optional<size_t> take(size_t self)
+   {
+      for (size_t i = 0; i < queues.size(); ++i)
+      {
+         Queue& queue = *queues[(self + i) % queues.size()];
+         std::scoped_lock lock {queue.mutex};
+         if (queue.tasks.empty())
+            continue;
+         size_t task {0};
+         if (i == 0)
+         {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+         }
+         else
+         {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+         }
+         return task;
+      }
+      return std::nullopt;
+   }
+
+   std::vector<std::unique_ptr<Queue>> queues {};
+   std::vector<std::thread> threads {};
+   std::mutex mutex;
+   std::condition_variable wake;
+   std::condition_variable done;
+   std::atomic<const std::vector<std::function<void()>>*> batch {nullptr};
+   /// tasks of the batch which did not finish yet, guarded by mutex
+   size_t remaining {0};
+   uint64_t generation {0};
+   bool stopping {false};
+};
@@ -1,7 +1,30 @@
 #include <CLI11.h>
 #include "Types.h"
+#include "Filter.h"
+#include "PathMatcher.h"
+#include "ExecutableTable.h"
+#include "ProcessTable.h"
+#include "LogHistogram.h"
+#include "SpaceSaving.h"
+#include "Sketches.h"
+#include "BoundedCounts.h"
+#include "RateRing.h"
+#include "BurstRing.h"
+#include "EwmaBaseline.h"
+#include "FlightRecorder.h"
+#include "CaptureReader.h"
+#include "CaptureMerger.h"
+#include "Json.h"
+#include "EventStore.h"
+#include "EventQuery.h"
+#include "GroupBy.h"
+#include "FlatHashMap.h"
+#include "Benchmark.h"
+#include "WorkStealingPool.h"
 #include "EndpointSecurity/EndpointSecurity.h"
 #include <dispatch/dispatch.h>
+#include <mach/mach.h>
+#include <mach/mach_time.h>
 
 #include <algorithm>
 #include <iostream>
@@ -11,9 +34,22 @@
 #include <unordered_map>
 #include <filesystem>
 #include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
 #include <chrono>
 #include <locale>
+#include <map>
 #include <mutex>
+#include <optional>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+
+extern char** environ;
 
 
 constexpr const char* RESET =  "\033[0m";
@@ -46,25 +82,326 @@ const std::vector<const char*> subGroupColors {
 
 
 
-struct EventCounts
+/// Counters only ever grow, the values of an interval are the differences to the snapshot taken at the end of the previous one.
+struct MessageCounts
+{
+   uint64_t totalCount {0};
+   uint64_t numMissingMessages {0};
+   /// messages which did not match the filter expression, they are still used to detect missing messages
+   uint64_t numFilteredMessages {0};
+   /// messages copied into the flight recorder, matching the filter or not
+   uint64_t numRecordedMessages {0};
+   
+   MessageCounts operator-(const MessageCounts& snapshot) const
+   {
+      return {totalCount - snapshot.totalCount, numMissingMessages - snapshot.numMissingMessages, numFilteredMessages - snapshot.numFilteredMessages,
+              numRecordedMessages - snapshot.numRecordedMessages};
+   }
+};
+
+/// Returns the number of messages missing before the one with the given seq_num and advances the seq_num expected next.
+/// Used by the live handler and by analyze, so both count a gap the same way. A seq_num below the expected one,
+/// e.g. of a record which a merge of captures ordered by time, misses nothing.
+uint64_t countMissing(uint64_t& nextSeqNumber, uint64_t seqNumber)
+{
+   const uint64_t missing = seqNumber > nextSeqNumber ? seqNumber - nextSeqNumber : 0;
+   nextSeqNumber = std::max(nextSeqNumber, seqNumber + 1);
+   return missing;
+}
+
+struct EventCounts : MessageCounts
+{
+   /// counts at the end of the previous interval
+   MessageCounts snapshot {};
+   /// messages matching the filter per second of the message time
+   RateRing rates {};
+   /// all messages in millisecond buckets, only with --bursts
+   std::optional<BurstRing> bursts {};
+   /// seq_num of the next message of the event type if none is missing
+   uint64_t nextEventSeqNumber {0};
+   /// executables sending the most messages of the event type, only with --top
+   std::optional<SpaceSaving> topExecutables {};
+   /// matching messages per second, only updated with --alert-z
+   EwmaBaseline baseline {};
+   /// totalCount at the previous update of the baseline
+   uint64_t baselineCount {0};
+};
+
+/// which messages the flight recorder keeps, see selectedForRecording
+struct RecordSelection
+{
+   /// by es_event_type_t, all event types if empty
+   std::vector<bool> eventTypes {};
+   /// messages of the processes of the watched apps
+   bool apps {false};
+   /// messages whose executable or file path starts with one of these
+   std::vector<std::string> pathPrefixes {};
+   /// by executable id 1 if it belongs to a watched app, 0 if not and -1 if not known yet, only used by the handler
+   std::vector<int8_t> watchedExecutables {};
+};
+
+/// Counters only ever grow like MessageCounts.
+struct ProcessMessageCounts
+{
+   uint64_t numExecSourceEvents {0};
+   uint64_t numExecTargetEvents {0};
+   uint64_t numExitEvents {0};
+   uint64_t numForkEvents {0};
+   /// per counter above, the messages which were counted with a sampling weight > 1, used for its confidence interval
+   uint64_t numSampledExecSourceEvents {0};
+   uint64_t numSampledExecTargetEvents {0};
+   uint64_t numSampledExitEvents {0};
+   uint64_t numSampledForkEvents {0};
+   
+   ProcessMessageCounts operator-(const ProcessMessageCounts& snapshot) const
+   {
+      return {
+         numExecSourceEvents - snapshot.numExecSourceEvents,
+         numExecTargetEvents - snapshot.numExecTargetEvents,
+         numExitEvents - snapshot.numExitEvents,
+         numForkEvents - snapshot.numForkEvents,
+         numSampledExecSourceEvents - snapshot.numSampledExecSourceEvents,
+         numSampledExecTargetEvents - snapshot.numSampledExecTargetEvents,
+         numSampledExitEvents - snapshot.numSampledExitEvents,
+         numSampledForkEvents - snapshot.numSampledForkEvents
+      };
+   }
+   
+   bool isEstimate() const
+   {
+      return numSampledExecSourceEvents + numSampledExecTargetEvents + numSampledExitEvents + numSampledForkEvents > 0;
+   }
+   
+   int64_t delta() const
+   {
+      return static_cast<int64_t>(numExecTargetEvents + numForkEvents) - static_cast<int64_t>(numExecSourceEvents + numExitEvents);
+   }
+};
+
+/// Execs of or into an app, counted by name or in identity mode by executable, whose name is only looked up for printing.
+struct ExecCounts
 {
-   int totalCount {0};
-   int numMissingMessages {0};
-   uint64_t prevEventSeqNumber {0};
+   explicit ExecCounts(size_t maxNames)
+      : byName {maxNames}, byExecutable {maxNames}
+   {
+   }
+   
+   /// calls f with the name and count of every exec which was kept
+   template<typename F>
+   void forEach(const ExecutableTable& executables, F&& f) const
+   {
+      byName.forEach(f);
+      // executables with the same name are shown as one, like when they are counted by name
+      std::vector<std::pair<std::string, uint64_t>> named {};
+      FlatHashMap<std::string, size_t> positions {};
+      byExecutable.forEach([&](ExecutableTable::Id id, uint64_t count) {
+         auto [it, inserted] = positions.try_emplace(executables.name(id), named.size());
+         if (inserted)
+            named.emplace_back(it->first, 0);
+         named[it->second].second += count;
+      });
+      for (const auto& [name, count] : named)
+         f(name, count);
+   }
+   
+   size_t longestName(const ExecutableTable& executables) const
+   {
+      size_t longest = byName.longestName();
+      byExecutable.forEach([&](ExecutableTable::Id id, uint64_t) {
+         longest = std::max(longest, executables.name(id).length());
+      });
+      return longest;
+   }
+   
+   uint64_t other() const
+   {
+      return byName.other() + byExecutable.other();
+   }
+   
+   uint64_t numEvictions() const
+   {
+      return byName.numEvictions() + byExecutable.numEvictions();
+   }
+   
+   void resetEvictions()
+   {
+      byName.resetEvictions();
+      byExecutable.resetEvictions();
+   }
+   
+   void merge(const ExecCounts& other)
+   {
+      byName.merge(other.byName);
+      byExecutable.merge(other.byExecutable);
+   }
+   
+   void clear()
+   {
+      byName.clear();
+      byExecutable.clear();
+   }
+   
+   BoundedCounts<std::string> byName;
+   BoundedCounts<ExecutableTable::Id> byExecutable;
 };
 
-struct AppEventCounts
+struct AppEventCounts : ProcessMessageCounts
 {
-   int numExecSourceEvents {0};
-   int numExecTargetEvents {0};
-   int numExitEvents {0};
-   int numForkEvents {0};
+   explicit AppEventCounts(size_t maxNames)
+      : sourceExecs {maxNames}, parentExecs {maxNames}
+   {
+   }
+   
+   /// counts at the end of the previous interval
+   ProcessMessageCounts snapshot {};
+   /// all counted process messages per second of the message time
+   RateRing rates {};
    /// execs the observed executable performs itself and the respective counts
-   std::unordered_map<std::string, int> sourceExecs {};
-   /// map of parent processes exec'ing into the observed executable
-   std::unordered_map<std::string, int> parentExecs {};
+   ExecCounts sourceExecs;
+   /// parent processes exec'ing into the observed executable
+   ExecCounts parentExecs;
+   /// messages per second of each counter in baselineCounters, only updated with --alert-z
+   std::array<EwmaBaseline, 4> baselines {};
+   /// counts at the previous update of the baselines
+   ProcessMessageCounts baselineCounts {};
+};
+
+/// the per-app counters which have a baseline and their column names
+const std::array<std::pair<uint64_t ProcessMessageCounts::*, const char*>, 4> baselineCounters {{
+   {&ProcessMessageCounts::numExecSourceEvents, "#exec_source_events"},
+   {&ProcessMessageCounts::numExecTargetEvents, "#exec_target_events"},
+   {&ProcessMessageCounts::numForkEvents, "#fork_events"},
+   {&ProcessMessageCounts::numExitEvents, "#exit_events"},
+}};
+
+/// Switches the per-app statistics to 1-in-N sampling while the handler lags behind the kernel.
+/// Only the path parsing and map updates in countProcessMessages are sampled, event type counters stay exact.
+struct SamplingController
+{
+   /// lag between event creation and handling which activates sampling, 0 disables sampling
+   uint64_t lagThresholdNs {0};
+   /// every n-th process message is evaluated while sampling is active
+   int rate {10};
+   mach_timebase_info_data_t timebase {1, 1};
+   
+   std::atomic<bool> active {false};
+   std::atomic<uint64_t> messageCounter {0};
+   /// per interval counters
+   std::atomic<uint64_t> evaluatedMessages {0};
+   std::atomic<uint64_t> skippedMessages {0};
+   std::atomic<uint64_t> activations {0};
+   
+   bool enabled() const
+   {
+      return lagThresholdNs > 0;
+   }
+   
+   /// returns the weight a process message contributes to the per-app statistics, 0 if it is skipped
+   int weigh(const es_message_t* msg)
+   {
+      if (!enabled())
+         return 1;
+      
+      const uint64_t now = mach_absolute_time();
+      const uint64_t lagNs = now > msg->mach_time ? (now - msg->mach_time) * timebase.numer / timebase.denom : 0;
+      // hysteresis: enter above the threshold, leave below half of it
+      if (!active && lagNs > lagThresholdNs)
+      {
+         active = true;
+         activations++;
+      }
+      else if (active && lagNs < lagThresholdNs / 2)
+      {
+         active = false;
+      }
+      
+      if (!active)
+         return 1;
+      
+      if (messageCounter++ % static_cast<uint64_t>(rate) != 0)
+      {
+         skippedMessages++;
+         return 0;
+      }
+      evaluatedMessages++;
+      return rate;
+   }
+   
+   /// half width of the 95% confidence interval of a count estimated from numSampled hits
+   double confidenceInterval(uint64_t numSampled) const
+   {
+      const double n = rate;
+      return 1.96 * n * std::sqrt(static_cast<double>(numSampled) * (1.0 - 1.0 / n));
+   }
 };
 
+/// process lifecycle totals of a watched executable, collected from the process table
+struct ProcessLifetimeCounts
+{
+   uint64_t numStarted {0};
+   uint64_t numExited {0};
+   /// exits of processes whose fork or exec was never observed
+   uint64_t numExitsWithoutStart {0};
+   /// processes which exec'ed into another executable instead of exiting
+   uint64_t numReplacedByExec {0};
+   uint64_t numEventsOfExited {0};
+};
+
+/// approximate distinct counts of one event type and its messages per executable, updated without locks
+struct EventSketches
+{
+   Sketches::HyperLogLog executables {};
+   Sketches::HyperLogLog paths {};
+   Sketches::HyperLogLog processes {};
+   /// keyed by executable name, or path with -i
+   Sketches::CountMinSketch messagesByExecutable {};
+};
+
+/// durations of the processes of a watched executable in nanoseconds
+struct ProcessLatencies
+{
+   /// from the fork of a process to its exec into the executable
+   LogHistogram forkToExec {};
+   /// from the exec into the executable to the exit
+   LogHistogram lifetime {};
+};
+
+/// the command given after --, whose process tree scopes all statistics
+struct CommandScope
+{
+   pid_t pid {-1};
+   std::chrono::steady_clock::time_point start {};
+   /// the following members are guarded by appStatisticsMutex
+   bool exited {false};
+   bool exitSeen {false};
+   int exitCode {0};
+   uint64_t numRunning {0};
+   uint64_t peakRunning {0};
+   /// messages of the process tree
+   uint64_t numMessages {0};
+   /// processes of the tree evicted from the full process table, which no longer keep the command from finishing
+   uint64_t numEvicted {0};
+   /// set once the command and all of its descendants exited
+   std::atomic<bool> finished {false};
+   std::atomic<bool> reported {false};
+};
+
+/// a message rate far above its baseline
+struct RateAlert
+{
+   std::time_t time {0};
+   /// event type or app and counter
+   std::string counter {};
+   uint64_t rate {0};
+   double baseline {0};
+   double zScore {0};
+};
+
+/// index of the watched app (-a argument) an executable file belongs to, decided once per file
+using WatchedApp = int32_t;
+constexpr WatchedApp unknownApp = -2;
+constexpr WatchedApp noApp = -1;
+
 namespace global
 {
    auto intervalStart = std::chrono::steady_clock::now();
@@ -72,357 +409,2836 @@ namespace global
    std::vector<es_event_type_t> events2subscribe2 {};
    std::mutex events2subscribe2Mutex;
 
-   /// collects executable names from the command line, only written to during parsing
+   /// collects executable names and path patterns from the command line, only written to during parsing
    std::vector<std::string> apps;
-   /// maps application names to their corresponding event counts
-   std::unordered_map<std::string, AppEventCounts> appStatistics {};
+   /// maps application names to their corresponding event counts, reserved for all -a arguments, so rows never move
+   FlatHashMap<std::string, AppEventCounts> appStatistics {};
    std::mutex appStatisticsMutex;
+   
+   /// matches executable paths against all -a arguments which are patterns, guarded by appStatisticsMutex
+   std::optional<PathMatcher> pathMatcher {};
+   /// rows in appStatistics by pattern id of pathMatcher
+   std::vector<AppEventCounts*> patternStatistics {};
+   /// distinct -a arguments, indexed by WatchedApp
+   std::vector<std::string> watchedApps {};
+   /// WatchedApp of each -a argument which is an executable name
+   FlatHashMap<std::string, WatchedApp> watchedAppsByName {};
+   /// WatchedApp by pattern id of pathMatcher
+   std::vector<WatchedApp> watchedAppsByPattern {};
+   
+   /// distinguish executables by (device, inode) of their file instead of by name
+   bool identityMode {false};
+   ExecutableTable executables {};
+   /// identity mode rows of watched executable files, guarded by appStatisticsMutex
+   FlatHashMap<ExecutableTable::Id, AppEventCounts> identityStatistics {};
+   /// indexed by executable id, guarded by appStatisticsMutex
+   std::vector<WatchedApp> watchedAppsByExecutable {};
+   
+   /// per process state created on fork/exec and retired on exit, guarded by appStatisticsMutex
+   std::optional<ProcessTable> processTable {};
+   /// position of each subscribed event type in the per-process counters, indexed by event type
+   std::vector<size_t> processCounterIndex {};
+   /// lifecycle totals of watched executables, guarded by appStatisticsMutex
+   FlatHashMap<ExecutableTable::Id, ProcessLifetimeCounts> processLifetimeStatistics {};
+   /// collect fork to exec latencies and lifetimes of watched executables
+   bool trackLatencies {false};
+   /// guarded by appStatisticsMutex
+   FlatHashMap<ExecutableTable::Id, ProcessLatencies> processLatencyStatistics {};
+   
+   /// attribute the messages of all descendants of a watched app to the watched app
+   bool treeMode {false};
+   /// print the process table statistics
+   bool trackProcesses {false};
+   /// per WatchedApp the messages of its process tree by position in processCounterIndex, guarded by appStatisticsMutex
+   std::vector<std::vector<uint64_t>> treeEventCounts {};
+   /// per WatchedApp the number of processes which joined its process tree, guarded by appStatisticsMutex
+   std::vector<uint64_t> treeProcessCounts {};
+   
+   /// only set when started as esmat [options] -- command
+   std::optional<CommandScope> command {};
 
    /// maps event type names to their corresponding message counts
-   std::unordered_map<std::string, EventCounts> eventStatistics {};
+   FlatHashMap<std::string, EventCounts> eventStatistics {};
    std::mutex eventStatisticsMutex;
 
+   /// number of executables listed per event type with --top, 0 if disabled
+   size_t topK {0};
+   
+   /// indexed by event type, only allocated for subscribed event types with --distinct or --estimate
+   std::vector<std::unique_ptr<EventSketches>> eventSketches {};
+   /// executables whose number of messages per event type is estimated with --estimate
+   std::vector<std::string> estimatedExecutables {};
+   /// the distinct executable, path and process columns of -d
+   bool printDistinctCounts {false};
+   
    bool printChildProcessFlag {false};
    bool printParentProcessFlag {false};
+   /// child and parent names kept per app for -c and -p
+   size_t maxNames {32};
    bool cumulativeStatistics {false};
+   /// print the values since the start next to the ones of the interval
+   bool bothViews {false};
+   /// print the rolling message rates, the rate rings are only updated then
+   bool printRates {false};
+   /// bucket size for burst detection in milliseconds, 0 if disabled
+   uint64_t burstResolutionMs {0};
+   
+   SamplingController sampling {};
+   
+   /// z-score of a rate against its baseline from which on an alert is raised, 0 if disabled
+   double alertZ {0};
+   /// factor a rate must also exceed its baseline by for an alert, 0 for any
+   double alertRatio {0};
+   /// smoothing of the baselines, derived from --alert-half-life
+   double alertAlpha {0};
+   /// number of updates before a baseline raises alerts
+   uint32_t alertWarmup {0};
+   /// alerts since the last report, guarded by alertsMutex
+   std::vector<RateAlert> alerts {};
+   uint64_t numDroppedAlerts {0};
+   /// every alert is also written here with --alerts
+   std::ofstream alertsStream {};
+   std::mutex alertsMutex;
+   
+   /// keeps the recent messages for capture files with --record
+   std::optional<FlightRecorder> flightRecorder {};
+   std::string captureDirectory {"."};
+   /// capture files written so far and at most written because of missing messages
+   std::atomic<uint64_t> numCaptures {0};
+   std::atomic<uint64_t> numGapCaptures {0};
+   uint64_t maxGapCaptures {10};
+   /// only these messages are recorded with --record-events, --record-apps or --record-path
+   std::optional<RecordSelection> recordSelection {};
+   /// writes the capture files, so neither the handler nor the statistics wait for the disk
+   dispatch_queue_t captureQueue {nullptr};
+   /// applied to the packed blocks of capture files, which are encoded on the threads of encoderPool
+   Capture::Compressor captureCompressor {Capture::Compressor::lz4};
+   std::optional<WorkStealingPool> encoderPool {};
+   
+   /// compiled from the --filter expression, only written to during parsing
+   std::optional<Filter::Program> filter {};
+   
+   /// keeps the messages which match the filter for the --query queries, guarded by eventStoreMutex
+   std::optional<EventStore> eventStore {};
+   std::mutex eventStoreMutex;
+   /// store id by executable id, unknownStoreId if not interned yet, only used by the handler
+   std::vector<EventStore::Id> storeIds {};
+   /// compiled from the --query options, only written to during parsing
+   std::vector<EventQuery::Query> queries {};
+   
+   /// counts the messages which match the filter per group of the --group-by dimensions, guarded by groupByMutex
+   std::optional<GroupBy> groupBy {};
+   std::mutex groupByMutex;
+   /// per dimension the id of each executable id, unknownGroupId if not interned yet, guarded by groupByMutex
+   std::vector<std::vector<uint32_t>> groupByExecutableIds {};
+   /// number of groups listed per report
+   size_t groupByRows {20};
+}
+
+constexpr EventStore::Id unknownStoreId = UINT32_MAX;
+constexpr uint32_t unknownGroupId = UINT32_MAX;
+
+
+/// the file an event acts on, nullptr for events without a single file
+const es_file_t* eventFile(const es_message_t* msg)
+{
+   switch (msg->event_type)
+   {
+      case ES_EVENT_TYPE_NOTIFY_EXEC: return msg->event.exec.target->executable;
+      case ES_EVENT_TYPE_NOTIFY_OPEN: return msg->event.open.file;
+      case ES_EVENT_TYPE_NOTIFY_CLOSE: return msg->event.close.target;
+      case ES_EVENT_TYPE_NOTIFY_WRITE: return msg->event.write.target;
+      case ES_EVENT_TYPE_NOTIFY_UNLINK: return msg->event.unlink.target;
+      case ES_EVENT_TYPE_NOTIFY_TRUNCATE: return msg->event.truncate.target;
+      case ES_EVENT_TYPE_NOTIFY_MMAP: return msg->event.mmap.source;
+      case ES_EVENT_TYPE_NOTIFY_READLINK: return msg->event.readlink.source;
+      case ES_EVENT_TYPE_NOTIFY_STAT: return msg->event.stat.target;
+      case ES_EVENT_TYPE_NOTIFY_ACCESS: return msg->event.access.target;
+      case ES_EVENT_TYPE_NOTIFY_READDIR: return msg->event.readdir.target;
+      case ES_EVENT_TYPE_NOTIFY_RENAME: return msg->event.rename.source;
+      case ES_EVENT_TYPE_NOTIFY_CREATE:
+         return msg->event.create.destination_type == ES_DESTINATION_TYPE_EXISTING_FILE ? msg->event.create.destination.existing_file : nullptr;
+      default: return nullptr;
+   }
+}
+
+void addToSketches(EventSketches& sketches, const es_message_t* msg)
+{
+   const es_file_t* executable = msg->process->executable;
+   sketches.executables.add(Sketches::mixHash(ExecutableKeyHash {}(ExecutableTable::keyOf(executable))));
+   const auto token = ProcessKey::of(msg->process);
+   sketches.processes.add(Sketches::mixHash((static_cast<uint64_t>(static_cast<uint32_t>(token.pid)) << 32) | static_cast<uint32_t>(token.pidVersion)));
+   if (const es_file_t* file = eventFile(msg))
+      sketches.paths.add(Sketches::hashKey({file->path.data, file->path.length}));
+   
+   const std::string_view path {executable->path.data, executable->path.length};
+   sketches.messagesByExecutable.add(Sketches::hashKey(global::identityMode ? path : path.substr(path.rfind('/') + 1)));
 }
 
+/// Freezes the flight recorder and writes the frozen messages to a new capture file in the background.
+/// Does nothing while the previous capture is still being written. Callers may hold a statistics mutex,
+/// so only the freeze happens here and the header and path are made in the background.
+void dumpFlightRecorder(std::string_view reason)
+{
+   if (!global::flightRecorder || !global::flightRecorder->freeze())
+      return;
+   
+   const auto now = std::chrono::system_clock::now();
+   const std::string captureReason {reason};
+   
+   dispatch_async(global::captureQueue, ^{
+      Capture::FileHeader header {};
+      header.frozenAt = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count());
+      captureReason.copy(header.reason.data(), header.reason.size() - 1);
+      // seq_nums count per event type, so only selecting event types leaves the gaps of each type meaningful
+      if (global::recordSelection && (global::recordSelection->apps || !global::recordSelection->pathPrefixes.empty()))
+         header.flags |= Capture::selectedRecords;
+      
+      const std::time_t time = std::chrono::system_clock::to_time_t(now);
+      std::tm utc {};
+      gmtime_r(&time, &utc);
+      std::ostringstream path {};
+      path << global::captureDirectory << "/esmat-" << std::put_time(&utc, "%Y%m%dT%H%M%SZ") << "-" << ++global::numCaptures << ".escap";
+      const std::string capturePath = path.str();
+      
+      const auto written = global::flightRecorder->dump(capturePath, header, global::captureCompressor, &*global::encoderPool);
+      global::flightRecorder->release();
+      if (written)
+      {
+         const double ratio = written->storedBytes > 0 ? static_cast<double>(written->rawBytes) / static_cast<double>(written->storedBytes) : 1.0;
+         const double seconds = static_cast<double>(written->encodeNanoseconds) / 1e9;
+         // formatted apart, the report may be printing at the same time
+         std::ostringstream message {};
+         message << "📼 " << captureReason << ": recent messages written to " << capturePath;
+         if (written->rawBytes > 0 && seconds > 0)
+            message << ", compressed " << std::fixed << std::setprecision(1) << ratio << ":1 at " << static_cast<double>(written->rawBytes) / 1e6 / seconds
+               << " MB/s";
+         std::cout << message.str() << "\n";
+      }
+      else
+         std::cerr << "Couldn't write capture file " << capturePath << "\n";
+   });
+}
 
-void countEventMessages(const es_message_t* msg)
+/// Out of the scope of the command given after --, a message only takes part in the detection of missing messages.
+void countEventMessages(const es_message_t* msg, bool inScope, bool matchesFilter, bool recorded)
 {
+   if (inScope && matchesFilter && !global::eventSketches.empty())
+   {
+      if (const auto& sketches = global::eventSketches[msg->event_type])
+         addToSketches(*sketches, msg);
+   }
+   
+
    std::scoped_lock lock {global::eventStatisticsMutex};
    if (global::eventStatistics.contains(ESEventTypes::event2name.at(msg->event_type)))
    {
       auto& eventCounts = global::eventStatistics.at(ESEventTypes::event2name.at((msg->event_type)));
-      eventCounts.totalCount++;
-      if (msg->seq_num > 0
-          && msg->seq_num - eventCounts.prevEventSeqNumber > 1)
+      if (const uint64_t numMissing = countMissing(eventCounts.nextEventSeqNumber, msg->seq_num); numMissing > 0)
+      {
+         eventCounts.numMissingMessages += numMissing;
+         // the ring ends with the message after the gap
+         if (global::flightRecorder && global::numGapCaptures < global::maxGapCaptures)
+         {
+            global::numGapCaptures++;
+            dumpFlightRecorder("missing " + ESEventTypes::event2name.at(msg->event_type) + " messages");
+         }
+      }
+      if (!inScope)
+         return;
+      
+      if (matchesFilter)
+      {
+         eventCounts.totalCount++;
+         if (global::printRates)
+            eventCounts.rates.add(static_cast<uint64_t>(msg->time.tv_sec), 1);
+      }
+      else
+         eventCounts.numFilteredMessages++;
+      if (recorded)
+         eventCounts.numRecordedMessages++;
+      if (eventCounts.bursts)
+         eventCounts.bursts->add(static_cast<uint64_t>(msg->time.tv_sec) * 1000 + static_cast<uint64_t>(msg->time.tv_nsec) / 1'000'000);
+      
+      if (matchesFilter && eventCounts.topExecutables)
       {
-         eventCounts.numMissingMessages += msg->seq_num - eventCounts.prevEventSeqNumber;
+         const std::string_view path {msg->process->executable->path.data, msg->process->executable->path.length};
+         eventCounts.topExecutables->add(global::identityMode ? path : path.substr(path.rfind('/') + 1));
       }
-      eventCounts.prevEventSeqNumber = msg->seq_num;
    }
 }
 
-void countProcessMessages(const es_message_t* msg)
+/// Calls f for every row the executable is attributed to: its name if it was passed via -a
+/// and every -a pattern matching its full path.
+template<typename F>
+void forEachWatchedApp(const char* path, const std::string& name, F&& f)
 {
-   auto getExecutableName = [](const char* path) -> std::string {
-      return std::filesystem::path(path).filename().string();
-   };
+   if (auto it = global::appStatistics.find(name); it != global::appStatistics.end())
+   {
+      f(it->second);
+   }
+   if (global::pathMatcher)
+   {
+      for (const auto patternId : global::pathMatcher->match(path))
+      {
+         f(*global::patternStatistics[patternId]);
+      }
+   }
+}
+
+/// the watched app the executable file belongs to, must be called with appStatisticsMutex held
+WatchedApp watchedAppOf(ExecutableTable::Id id, std::string_view path)
+{
+   if (global::watchedAppsByExecutable.size() <= id)
+      global::watchedAppsByExecutable.resize(id + 1, unknownApp);
    
-   /// the process that took the action
-   const auto sourceProcessName = getExecutableName(msg->process->executable->path.data);
+   auto& watchedApp = global::watchedAppsByExecutable[id];
+   if (watchedApp == unknownApp)
+   {
+      // names and patterns are only evaluated the first time an executable file is seen, names take precedence
+      watchedApp = noApp;
+      if (auto it = global::watchedAppsByName.find(Filter::basename(path)); it != global::watchedAppsByName.end())
+      {
+         watchedApp = it->second;
+      }
+      else if (global::pathMatcher)
+      {
+         const auto& patternIds = global::pathMatcher->match(path);
+         if (!patternIds.empty())
+            watchedApp = global::watchedAppsByPattern[*std::min_element(patternIds.begin(), patternIds.end())];
+      }
+   }
+   return watchedApp;
+}
+
+bool isWatchedExecutable(ExecutableTable::Id id, std::string_view path)
+{
+   return watchedAppOf(id, path) != noApp;
+}
+
+/// adds the identity mode row of the executable if it belongs to a watched app, returns whether it does
+bool addIdentityRow(const es_file_t* executable, ExecutableTable::Id id)
+{
+   const std::string_view path {executable->path.data, executable->path.length};
+   if (!isWatchedExecutable(id, path))
+      return false;
+   global::identityStatistics.try_emplace(id, global::maxNames);
+   return true;
+}
+
+/// same as countProcessMessages but keyed by executable file instead of by name
+void countProcessMessagesByIdentity(const es_message_t* msg, int weight)
+{
+   const auto sourceId = global::executables.intern(msg->process->executable);
+   const int sampled = weight > 1 ? 1 : 0;
+   const auto second = static_cast<uint64_t>(msg->time.tv_sec);
    
    std::lock_guard guard {global::appStatisticsMutex};
+   const es_file_t* targetExecutable = msg->event_type == ES_EVENT_TYPE_NOTIFY_EXEC ? msg->event.exec.target->executable : nullptr;
+   const auto targetId = targetExecutable ? global::executables.intern(targetExecutable) : ExecutableTable::Id {0};
+   // rows move when the map grows, so both rows are added before any of them is referenced
+   const bool sourceWatched = addIdentityRow(msg->process->executable, sourceId);
+   const bool targetWatched = targetExecutable && addIdentityRow(targetExecutable, targetId);
+   AppEventCounts* sourceRow = sourceWatched ? &global::identityStatistics.at(sourceId) : nullptr;
    switch (msg->event_type) {
       case ES_EVENT_TYPE_NOTIFY_EXEC:
       {
-         /// target of exec
-         const auto targetProcessName = getExecutableName(msg->event.exec.target->executable->path.data);
-         // the observed executable is the target of exec
-         if (global::appStatistics.contains(targetProcessName))
+         if (targetWatched)
          {
-            global::appStatistics[targetProcessName].numExecTargetEvents++;
-            // store the parent process which performed the exec
-            global::appStatistics[targetProcessName].parentExecs[sourceProcessName]++;
+            AppEventCounts* targetRow = &global::identityStatistics.at(targetId);
+            targetRow->numExecTargetEvents += weight;
+            targetRow->numSampledExecTargetEvents += sampled;
+            if (global::printRates)
+               targetRow->rates.add(second, weight);
+            targetRow->parentExecs.byExecutable.add(sourceId, weight);
          }
-         // the observed executable is the source of exec
-         if (global::appStatistics.contains(sourceProcessName))
+         if (sourceRow)
          {
-            global::appStatistics[sourceProcessName].numExecSourceEvents++;
-            // store the child process in which the observed executable execs into
-            global::appStatistics[sourceProcessName].sourceExecs[targetProcessName]++;
+            sourceRow->numExecSourceEvents += weight;
+            sourceRow->numSampledExecSourceEvents += sampled;
+            if (global::printRates)
+               sourceRow->rates.add(second, weight);
+            sourceRow->sourceExecs.byExecutable.add(targetId, weight);
          }
          break;
       }
       case ES_EVENT_TYPE_NOTIFY_EXIT:
       {
-         if (global::appStatistics.contains(sourceProcessName))
+         if (sourceRow)
          {
-            global::appStatistics[sourceProcessName].numExitEvents++;
+            sourceRow->numExitEvents += weight;
+            sourceRow->numSampledExitEvents += sampled;
+            if (global::printRates)
+               sourceRow->rates.add(second, weight);
          }
          break;
       }
       case ES_EVENT_TYPE_NOTIFY_FORK:
       {
-         if (global::appStatistics.contains(sourceProcessName))
+         if (sourceRow)
          {
-            global::appStatistics[sourceProcessName].numForkEvents++;
+            sourceRow->numForkEvents += weight;
+            sourceRow->numSampledForkEvents += sampled;
+            if (global::printRates)
+               sourceRow->rates.add(second, weight);
          }
          break;
       }
          
       default:
          break;
-
    }
 }
 
-void handle_event([[maybe_unused]] es_client_t* client, const es_message_t* msg)
+/// weight is the number of messages the given message stands for, > 1 while sampling is active
+void countProcessMessages(const es_message_t* msg, int weight)
 {
-   switch (msg->event_type)
+   if (global::identityMode)
    {
+      countProcessMessagesByIdentity(msg, weight);
+      return;
+   }
+   
+   auto getExecutableName = [](const char* path) -> std::string {
+      return std::filesystem::path(path).filename().string();
+   };
+   
+   /// the process that took the action
+   const char* sourceProcessPath = msg->process->executable->path.data;
+   const auto sourceProcessName = getExecutableName(sourceProcessPath);
+   const int sampled = weight > 1 ? 1 : 0;
+   const auto second = static_cast<uint64_t>(msg->time.tv_sec);
+   
+   std::lock_guard guard {global::appStatisticsMutex};
+   switch (msg->event_type) {
       case ES_EVENT_TYPE_NOTIFY_EXEC:
+      {
+         /// target of exec
+         const char* targetProcessPath = msg->event.exec.target->executable->path.data;
+         const auto targetProcessName = getExecutableName(targetProcessPath);
+         // the observed executable is the target of exec
+         forEachWatchedApp(targetProcessPath, targetProcessName, [&](AppEventCounts& appEventCounts) {
+            appEventCounts.numExecTargetEvents += weight;
+            appEventCounts.numSampledExecTargetEvents += sampled;
+            if (global::printRates)
+               appEventCounts.rates.add(second, weight);
+            // store the parent process which performed the exec
+            appEventCounts.parentExecs.byName.add(sourceProcessName, weight);
+         });
+         // the observed executable is the source of exec
+         forEachWatchedApp(sourceProcessPath, sourceProcessName, [&](AppEventCounts& appEventCounts) {
+            appEventCounts.numExecSourceEvents += weight;
+            appEventCounts.numSampledExecSourceEvents += sampled;
+            if (global::printRates)
+               appEventCounts.rates.add(second, weight);
+            // store the child process in which the observed executable execs into
+            appEventCounts.sourceExecs.byName.add(targetProcessName, weight);
+         });
+         break;
+      }
       case ES_EVENT_TYPE_NOTIFY_EXIT:
-      case ES_EVENT_TYPE_NOTIFY_FORK: countProcessMessages(msg);
+      {
+         forEachWatchedApp(sourceProcessPath, sourceProcessName, [&](AppEventCounts& appEventCounts) {
+            appEventCounts.numExitEvents += weight;
+            appEventCounts.numSampledExitEvents += sampled;
+            if (global::printRates)
+               appEventCounts.rates.add(second, weight);
+         });
+         break;
+      }
+      case ES_EVENT_TYPE_NOTIFY_FORK:
+      {
+         forEachWatchedApp(sourceProcessPath, sourceProcessName, [&](AppEventCounts& appEventCounts) {
+            appEventCounts.numForkEvents += weight;
+            appEventCounts.numSampledForkEvents += sampled;
+            if (global::printRates)
+               appEventCounts.rates.add(second, weight);
+         });
+         break;
+      }
          
-      default: countEventMessages(msg);
+      default:
+         break;
+
    }
 }
 
+uint64_t toNanoseconds(const struct timespec& time)
+{
+   return static_cast<uint64_t>(time.tv_sec) * 1'000'000'000 + static_cast<uint64_t>(time.tv_nsec);
+}
 
-template<size_t SIZE>
-void printHeader(const std::string& separator, const std::array<std::string, SIZE>& headers, const std::unordered_map<std::string, size_t>& maxColumnWidths)
+/// a process belongs to the tree it inherited from its parent or former image, otherwise to the tree of its own app
+void joinProcessTree(ProcessEntry& process, WatchedApp inheritedRoot, WatchedApp ownApp)
 {
-   using namespace std;
-   cout << separator << "\n" << left;
-   for (const auto& header : headers)
-   {
-      cout << "| " << setw(static_cast<int>(maxColumnWidths.at(header))) << header << " ";
-   }
-   cout << "|\n";
-   cout << separator << "\n";
+   const WatchedApp previousRoot = process.treeRoot;
+   process.treeRoot = inheritedRoot != noApp ? inheritedRoot : ownApp;
+   if (global::treeMode && process.treeRoot != noApp && process.treeRoot != previousRoot)
+      global::treeProcessCounts[static_cast<size_t>(process.treeRoot)]++;
 }
 
-void printStatisticsByExecutable()
+/// a process is in the scope of the command if its parent or former image was, the command itself is recognized by its pid
+void joinCommandScope(ProcessEntry& process, bool inherited)
 {
-   using namespace std;
-   constexpr size_t numColumns = 6;
+   auto& command = global::command;
+   if (!command || process.inCommand || !(inherited || process.key.pid == command->pid))
+      return;
+   process.inCommand = true;
+   command->numRunning++;
+   command->peakRunning = std::max(command->peakRunning, command->numRunning);
+}
+
+/// the command is finished once it has been reaped and all processes of its tree exited
+void retireProcess(ProcessEntry& process)
+{
+   if (process.inCommand)
+      global::command->numRunning--;
+   global::processTable->erase(process);
+}
+
+/// retires a process which is evicted from the full process table although it may still run
+void evictProcess(ProcessEntry& process)
+{
+   if (process.inCommand)
+      global::command->numEvicted++;
+   retireProcess(process);
+}
+
+/// Whether the process still runs: its pid must have a task whose audit token has the same pidversion, a reused pid
+/// belongs to another process. Exited processes, zombies included, have no task anymore.
+bool isRunning(ProcessKey key)
+{
+   mach_port_t task {MACH_PORT_NULL};
+   if (task_name_for_pid(mach_task_self(), key.pid, &task) != KERN_SUCCESS)
+      return false;
+   audit_token_t token {};
+   mach_msg_type_number_t count = TASK_AUDIT_TOKEN_COUNT;
+   const kern_return_t result = task_info(task, TASK_AUDIT_TOKEN, reinterpret_cast<task_info_t>(&token), &count);
+   mach_port_deallocate(mach_task_self(), task);
+   return result == KERN_SUCCESS && ProcessKey::ofToken(token) == key;
+}
+
+/// Sets finished once the command exited and no process of its tree is left. The EXIT messages may have been missed,
+/// with checkPids the exit of the command counts as seen and processes which no longer run are retired.
+void checkCommandFinished(bool checkPids = false)
+{
+   auto& command = *global::command;
+   if (!command.exited || !(command.exitSeen || checkPids))
+      return;
+   bool running {false};
+   global::processTable->forEach([&](ProcessEntry& process) {
+      if (process.inCommand && checkPids && !isRunning(process.key))
+         retireProcess(process);
+      else
+         running = running || process.inCommand;
+   });
+   if (!running)
+      command.finished = true;
+}
+
+/// marks a process as started by an observed fork or exec
+void startProcess(ProcessEntry& process, const es_process_t* esProcess, ProcessKey parent, WatchedApp inheritedRoot, bool inheritedScope, uint64_t time)
+{
+   process.executable = global::executables.intern(esProcess->executable);
+   process.parent = parent;
+   process.startTime = time;
+   process.lastSeen = time;
+   process.startSeen = true;
    
-   string executableColumn {"executable"};
-   string execSourceColumn {"#exec_source_events"};
-   string execTargetColumn {"#exec_target_events"};
-   string forkColumn {"#fork_events"};
-   string exitColumn {"#exit_events"};
-   string deltaColumn {" delta "};
+   const std::string_view path {esProcess->executable->path.data, esProcess->executable->path.length};
+   const WatchedApp watchedApp = watchedAppOf(process.executable, path);
+   if (watchedApp != noApp)
+      global::processLifetimeStatistics[process.executable].numStarted++;
+   joinProcessTree(process, inheritedRoot, watchedApp);
+   joinCommandScope(process, inheritedScope);
+}
+
+/// updates the process table with a message of any subscribed event type
+/// returns whether the process of the message is in the scope of the command, always true without a command
+bool trackProcess(const es_message_t* msg)
+{
+   const uint64_t time = toNanoseconds(msg->time);
    
-   const array<string, numColumns> headers {
-      executableColumn,
-      execSourceColumn,
-      execTargetColumn,
-      forkColumn,
-      exitColumn,
-      deltaColumn,
-   };
-   // calculate approriate column widths
+   std::lock_guard guard {global::appStatisticsMutex};
+   auto& processTable = *global::processTable;
+   
+   bool inserted {false};
+   ProcessEntry& process = processTable.findOrInsert(ProcessKey::of(msg->process), inserted, evictProcess);
+   if (inserted)
+   {
+      // the process was started before esmat or its start was missed
+      process.executable = global::executables.intern(msg->process->executable);
+      process.parent = msg->version >= 4 ? ProcessKey::ofToken(msg->process->parent_audit_token) : ProcessKey {msg->process->ppid, 0};
+      process.startTime = time;
+      
+      const ProcessEntry* parent = processTable.find(process.parent);
+      const std::string_view path {msg->process->executable->path.data, msg->process->executable->path.length};
+      joinProcessTree(process, parent ? parent->treeRoot : noApp, watchedAppOf(process.executable, path));
+      joinCommandScope(process, parent && parent->inCommand);
+   }
+   process.lastSeen = time;
+   const bool inScope = !global::command || process.inCommand;
+   if (global::command && inScope)
+      global::command->numMessages++;
+   const size_t counterIndex = global::processCounterIndex[msg->event_type];
+   processTable.countersOf(process)[counterIndex]++;
+   if (global::treeMode && process.treeRoot != noApp)
+      global::treeEventCounts[static_cast<size_t>(process.treeRoot)][counterIndex]++;
+   
+   switch (msg->event_type)
+   {
+      case ES_EVENT_TYPE_NOTIFY_FORK:
+      {
+         // inserting the child may evict the parent's slot or reuse it
+         const es_process_t* child = msg->event.fork.child;
+         const ProcessKey parent = process.key;
+         const WatchedApp treeRoot = process.treeRoot;
+         const bool inCommand = process.inCommand;
+         ProcessEntry& childProcess = processTable.findOrInsert(ProcessKey::of(child), inserted, evictProcess);
+         startProcess(childProcess, child, parent, treeRoot, inCommand, time);
+         break;
+      }
+      case ES_EVENT_TYPE_NOTIFY_EXEC:
+      {
+         // exec replaces the image and bumps the pidversion, the new image continues as its own entry
+         const es_process_t* target = msg->event.exec.target;
+         const ProcessKey parent = process.parent;
+         const WatchedApp treeRoot = process.treeRoot;
+         const bool inCommand = process.inCommand;
+         const bool forked = process.startSeen && !process.startedByExec;
+         const uint64_t forkTime = process.startTime;
+         const ProcessKey targetKey = ProcessKey::of(target);
+         const std::string_view path {msg->process->executable->path.data, msg->process->executable->path.length};
+         if (process.startSeen && isWatchedExecutable(process.executable, path))
+            global::processLifetimeStatistics[process.executable].numReplacedByExec++;
+         if (!(targetKey == process.key))
+            retireProcess(process);
+         ProcessEntry& targetProcess = processTable.findOrInsert(targetKey, inserted, evictProcess);
+         // the new image stays in the tree of the former one, which must not count it a second time
+         targetProcess.treeRoot = treeRoot;
+         startProcess(targetProcess, target, parent, treeRoot, inCommand, time);
+         targetProcess.startedByExec = true;
+         if (global::trackLatencies && forked && time >= forkTime)
+         {
+            const std::string_view targetPath {target->executable->path.data, target->executable->path.length};
+            if (isWatchedExecutable(targetProcess.executable, targetPath))
+               global::processLatencyStatistics[targetProcess.executable].forkToExec.record(time - forkTime);
+         }
+         break;
+      }
+      case ES_EVENT_TYPE_NOTIFY_EXIT:
+      {
+         const std::string_view path {msg->process->executable->path.data, msg->process->executable->path.length};
+         if (isWatchedExecutable(process.executable, path))
+         {
+            auto& lifetimeCounts = global::processLifetimeStatistics[process.executable];
+            lifetimeCounts.numExited++;
+            lifetimeCounts.numEventsOfExited += processTable.totalOf(process);
+            if (!process.startSeen)
+               lifetimeCounts.numExitsWithoutStart++;
+            if (global::trackLatencies && process.startSeen && process.startedByExec && time >= process.startTime)
+               global::processLatencyStatistics[process.executable].lifetime.record(time - process.startTime);
+         }
+         const bool commandExited = global::command && process.inCommand && process.key.pid == global::command->pid;
+         retireProcess(process);
+         if (commandExited)
+            global::command->exitSeen = true;
+         if (global::command && inScope)
+            checkCommandFinished();
+         break;
+      }
+      default:
+         break;
+   }
+   return inScope;
+}
+
+/// Whether the flight recorder keeps the message: it must have a selected event type and, if apps or path prefixes are
+/// selected, come from or exec into a watched app or have an executable or file path with a selected prefix.
+bool selectedForRecording(const es_message_t* msg)
+{
+   if (!global::recordSelection)
+      return true;
+   auto& selection = *global::recordSelection;
+   if (!selection.eventTypes.empty() && (msg->event_type >= selection.eventTypes.size() || !selection.eventTypes[msg->event_type]))
+      return false;
+   if (!selection.apps && selection.pathPrefixes.empty())
+      return true;
+   
+   auto isWatched = [&selection](const es_file_t* executable) {
+      const auto id = global::executables.intern(executable);
+      if (selection.watchedExecutables.size() <= id)
+         selection.watchedExecutables.resize(id + 1, -1);
+      auto& watched = selection.watchedExecutables[id];
+      if (watched < 0)
+      {
+         std::lock_guard guard {global::appStatisticsMutex};
+         watched = isWatchedExecutable(id, {executable->path.data, executable->path.length}) ? 1 : 0;
+      }
+      return watched == 1;
+   };
+   if (selection.apps
+       && (isWatched(msg->process->executable) || (msg->event_type == ES_EVENT_TYPE_NOTIFY_EXEC && isWatched(msg->event.exec.target->executable))))
+      return true;
+   
+   auto hasSelectedPrefix = [&selection](const es_file_t* file) {
+      const std::string_view path {file->path.data, file->path.length};
+      return std::any_of(selection.pathPrefixes.begin(), selection.pathPrefixes.end(), [path](const std::string& prefix) { return path.starts_with(prefix); });
+   };
+   const es_file_t* file = eventFile(msg);
+   return hasSelectedPrefix(msg->process->executable) || (file && hasSelectedPrefix(file));
+}
+
+/// Copies the message into the flight recorder, the paths are the only variable-sized part.
+void recordMessage(const es_message_t* msg, bool matchesFilter)
+{
+   const es_file_t* executable = msg->process->executable;
+   const es_file_t* file = eventFile(msg);
+   const std::string_view executablePath {executable->path.data, std::min(executable->path.length, Capture::maxPathLength)};
+   const std::string_view filePath = file ? std::string_view {file->path.data, std::min(file->path.length, Capture::maxPathLength)}
+                                          : std::string_view {};
+   
+   Capture::RecordHeader header {};
+   header.size = Capture::recordSize(executablePath.size(), filePath.size());
+   header.eventType = static_cast<uint16_t>(msg->event_type);
+   header.flags = matchesFilter ? Capture::matchedFilter : 0;
+   header.time = toNanoseconds(msg->time);
+   header.seqNum = msg->seq_num;
+   const auto process = ProcessKey::of(msg->process);
+   header.pid = process.pid;
+   header.pidVersion = process.pidVersion;
+   header.ppid = msg->process->ppid;
+   header.uid = audit_token_to_euid(msg->process->audit_token);
+   ProcessKey related {};
+   switch (msg->event_type)
+   {
+      case ES_EVENT_TYPE_NOTIFY_FORK: related = ProcessKey::of(msg->event.fork.child); break;
+      case ES_EVENT_TYPE_NOTIFY_EXEC: related = ProcessKey::of(msg->event.exec.target); break;
+      case ES_EVENT_TYPE_NOTIFY_EXIT: header.status = msg->event.exit.stat; break;
+      default: break;
+   }
+   header.relatedPid = related.pid;
+   header.relatedPidVersion = related.pidVersion;
+   header.executableLength = static_cast<uint16_t>(executablePath.size());
+   header.fileLength = static_cast<uint16_t>(filePath.size());
+   
+   global::flightRecorder->record(header, executablePath, filePath);
+}
+
+/// Appends the message to the event store, the path of an executable is looked up in the store only once.
+void storeMessage(const es_message_t* msg)
+{
+   auto storeId = [](const es_file_t* executable) {
+      const auto id = global::executables.intern(executable);
+      if (global::storeIds.size() <= id)
+         global::storeIds.resize(id + 1, unknownStoreId);
+      auto& storeId = global::storeIds[id];
+      if (storeId == unknownStoreId)
+      {
+         std::scoped_lock lock {global::eventStoreMutex};
+         storeId = global::eventStore->intern({executable->path.data, executable->path.length});
+      }
+      return storeId;
+   };
+   const EventStore::Id source = storeId(msg->process->executable);
+   const EventStore::Id target = msg->event_type == ES_EVENT_TYPE_NOTIFY_EXEC ? storeId(msg->event.exec.target->executable) : EventStore::noPath;
+   
+   std::scoped_lock lock {global::eventStoreMutex};
+   global::eventStore->append(toNanoseconds(msg->time), static_cast<uint16_t>(msg->event_type), source, target,
+                              audit_token_to_pid(msg->process->audit_token), msg->process->ppid);
+}
+
+/// Counts the message in the group of its values of the --group-by dimensions.
+void countGroup(const es_message_t* msg)
+{
+   auto& groupBy = *global::groupBy;
+   std::scoped_lock lock {global::groupByMutex};
+   // executables are interned once per executable id, by name or with -i by path like in the executable table
+   auto executableId = [&groupBy](size_t d, const es_file_t* executable) {
+      const auto id = global::executables.intern(executable);
+      auto& ids = global::groupByExecutableIds[d];
+      if (ids.size() <= id)
+         ids.resize(id + 1, unknownGroupId);
+      if (ids[id] == unknownGroupId)
+      {
+         const std::string_view path {executable->path.data, executable->path.length};
+         ids[id] = groupBy.intern(d, global::identityMode ? path : Filter::basename(path));
+      }
+      return ids[id];
+   };
+   
+   std::array<uint32_t, GroupBy::dimensionInfos.size()> values {};
+   const auto& dimensions = groupBy.allDimensions();
+   for (size_t d = 0; d < dimensions.size(); ++d)
+   {
+      switch (dimensions[d])
+      {
+         case GroupBy::Dimension::Event: values[d] = msg->event_type; break;
+         case GroupBy::Dimension::Executable: values[d] = executableId(d, msg->process->executable); break;
+         case GroupBy::Dimension::Target:
+            values[d] = msg->event_type == ES_EVENT_TYPE_NOTIFY_EXEC ? executableId(d, msg->event.exec.target->executable) : GroupBy::noValueId;
+            break;
+         case GroupBy::Dimension::Uid: values[d] = groupBy.intern(d, int64_t {audit_token_to_euid(msg->process->audit_token)}); break;
+         case GroupBy::Dimension::Tty:
+            // the tty is only part of messages of version 2 and later
+            values[d] = msg->version >= 2 && msg->process->tty ? groupBy.intern(d, std::string_view {msg->process->tty->path.data, msg->process->tty->path.length})
+                                                             : GroupBy::noValueId;
+            break;
+         case GroupBy::Dimension::Pid: values[d] = static_cast<uint32_t>(audit_token_to_pid(msg->process->audit_token)); break;
+         case GroupBy::Dimension::Ppid: values[d] = static_cast<uint32_t>(msg->process->ppid); break;
+      }
+   }
+   groupBy.add(groupBy.pack({values.data(), dimensions.size()}));
+}
+
+void reportCommandIfFinished();
+
+void handle_event([[maybe_unused]] es_client_t* client, const es_message_t* msg)
+{
+   if (global::processTable && !trackProcess(msg))
+   {
+      countEventMessages(msg, false, false, false);
+      return;
+   }
+   
+   const bool matchesFilter = !global::filter || global::filter->matches(msg);
+   // unselected messages are dropped before anything is copied
+   const bool recorded = global::flightRecorder && selectedForRecording(msg);
+   if (recorded)
+      recordMessage(msg, matchesFilter);
+   if (global::eventStore && matchesFilter)
+      storeMessage(msg);
+   if (global::groupBy && matchesFilter)
+      countGroup(msg);
+   
+   switch (msg->event_type)
+   {
+      case ES_EVENT_TYPE_NOTIFY_EXEC:
+      case ES_EVENT_TYPE_NOTIFY_EXIT:
+      case ES_EVENT_TYPE_NOTIFY_FORK:
+      {
+         // event type counters below stay exact, only the per-app statistics are sampled
+         const int weight = matchesFilter ? global::sampling.weigh(msg) : 0;
+         if (weight > 0)
+            countProcessMessages(msg, weight);
+      }
+         
+      default: countEventMessages(msg, true, matchesFilter, recorded);
+   }
+   
+   if (global::command)
+      reportCommandIfFinished();
+}
+
+
+template<typename Headers>
+void printHeader(const std::string& separator, const Headers& headers, const std::unordered_map<std::string, size_t>& maxColumnWidths)
+{
+   using namespace std;
+   cout << separator << "\n" << left;
+   for (const auto& header : headers)
+   {
+      cout << "| " << setw(static_cast<int>(maxColumnWidths.at(header))) << header << " ";
+   }
+   cout << "|\n";
+   cout << separator << "\n";
+}
+
+/// headers of the columns printed with -r
+const std::array<std::string, 4> rateColumns {"msgs/s_1s", "msgs/s_10s", "msgs/s_60s", "peak/s"};
+
+/// Prints the rolling rates and the busiest second of the interval as cells of a row, dashes for rows without rates.
+void printRateColumns(RateRing* rates, const std::unordered_map<std::string, size_t>& maxColumnWidths)
+{
+   using namespace std::chrono;
+   const auto now = static_cast<uint64_t>(duration_cast<seconds>(system_clock::now().time_since_epoch()).count());
+   const std::array<uint64_t, 3> windows {1, 10, 60};
+   for (size_t i = 0; i < windows.size(); ++i)
+   {
+      std::cout << " | " << std::setw(static_cast<int>(maxColumnWidths.at(rateColumns[i])));
+      if (rates)
+         std::cout << std::llround(rates->rate(now, windows[i]));
+      else
+         std::cout << "-";
+   }
+   std::cout << " | " << std::setw(static_cast<int>(maxColumnWidths.at(rateColumns[3])));
+   if (rates)
+   {
+      std::cout << rates->peak();
+      rates->resetPeak();
+   }
+   else
+   {
+      std::cout << "-";
+   }
+}
+
+void printStatisticsByExecutable()
+{
+   using namespace std;
+   
+   string executableColumn {"executable"};
+   string execSourceColumn {"#exec_source_events"};
+   string execTargetColumn {"#exec_target_events"};
+   string forkColumn {"#fork_events"};
+   string exitColumn {"#exit_events"};
+   string deltaColumn {" delta "};
+   
+   vector<string> headers {
+      executableColumn,
+      execSourceColumn,
+      execTargetColumn,
+      forkColumn,
+      exitColumn,
+      deltaColumn,
+   };
+   if (global::printRates)
+      headers.insert(headers.end(), rateColumns.begin(), rateColumns.end());
+   scoped_lock lock {global::appStatisticsMutex};
+   
+   // rows are either the watched apps or, in identity mode, the distinct executable files seen for them
+   vector<pair<string, AppEventCounts*>> rows {};
+   if (global::identityMode)
+   {
+      for (auto& [executableId, appEventCounts] : global::identityStatistics)
+      {
+         rows.emplace_back(global::executables.name(executableId) + " (" + global::executables.path(executableId) + ")", &appEventCounts);
+      }
+   }
+   else
+   {
+      for (auto& [appName, appEventCounts] : global::appStatistics)
+      {
+         rows.emplace_back(appName, &appEventCounts);
+      }
+   }
+   
+   // calculate approriate column widths
    
    // use the longest element in the first column (consisting of header + app names) for the maximum width
-   static const size_t longestAppNameLength = std::max_element(global::apps.begin(), global::apps.end(), [](const auto& a, const auto& b) {
-      return a.length() < b.length();
-   })->length();
-   static auto maxColumnWidth_c1 = std::max(longestAppNameLength, headers[0].length());
+   size_t longestAppNameLength {0};
+   for (const auto& [label, _] : rows)
+   {
+      longestAppNameLength = std::max(longestAppNameLength, label.length());
+   }
+   
+   const string otherName {"other"};
+   const string sinceStartLabel {"  Σ since start"};
+   
+   size_t longestChildNameLength {0};
+   if (global::printChildProcessFlag)
+   {
+      for (const auto& [_, appStats] : rows)
+      {
+         longestChildNameLength = std::max(longestChildNameLength, appStats->sourceExecs.longestName(global::executables));
+         if (appStats->sourceExecs.other() > 0)
+            longestChildNameLength = std::max(longestChildNameLength, otherName.length());
+      }
+      longestChildNameLength += 2; // account for formatting with --
+   }
+   
+   size_t longestParentNameLength {0};
+   if (global::printParentProcessFlag)
+   {
+      for (const auto& [_, appStats] : rows)
+      {
+         longestParentNameLength = std::max(longestParentNameLength, appStats->parentExecs.longestName(global::executables));
+         if (appStats->parentExecs.other() > 0)
+            longestParentNameLength = std::max(longestParentNameLength, otherName.length());
+      }
+      longestParentNameLength += 2; // account for formatting with --
+   }
+   
+   const size_t sinceStartLength = global::bothViews ? sinceStartLabel.length() - 1 : 0; // Σ takes two bytes
+   vector<size_t> longestLengths {longestAppNameLength, longestChildNameLength, longestParentNameLength, sinceStartLength, headers[0].length()};
+   const auto maxColumnWidth_c1 = *std::max_element(longestLengths.begin(), longestLengths.end());
+   
+   unordered_map<string, size_t> maxColumnWidths {};
+   for (const auto& header : headers)
+   {
+      if (header == executableColumn)
+         maxColumnWidths[header] = maxColumnWidth_c1;
+      else
+         maxColumnWidths[header] = header.length();
+   }
+   
+   // create and print separator
+   string separator {"+"};
+   for (const auto& header : headers)
+   {
+      separator += string(maxColumnWidths.at(header) + 2, '-');
+      separator += "+";
+   }
+   
+   printHeader(separator, headers, maxColumnWidths);
+   
+   // gather and print statistics lines
+   int colorIdx = 0;
+   uint64_t numEvictedNames {0};
+   for (auto& [appName, appEventCountsPtr] : rows)
+   {
+      auto& appEventCounts = *appEventCountsPtr;
+      const ProcessMessageCounts& sinceStart = appEventCounts;
+      const ProcessMessageCounts interval = sinceStart - appEventCounts.snapshot;
+      
+      colorIdx %= groupColors.size();
+      auto printCounts = [&](const string& label, const char* color, const ProcessMessageCounts& counts, RateRing* rates) {
+         const int64_t delta = counts.delta();
+         const bool isEstimate = counts.isEstimate();
+         cout << "| " << left << color << std::setw(static_cast<int>(maxColumnWidths[executableColumn])) << label << RESET
+            << " | " << std::setw(static_cast<int>(maxColumnWidths[execSourceColumn])) << right << counts.numExecSourceEvents
+            << " | " << std::setw(static_cast<int>(maxColumnWidths[execTargetColumn])) << counts.numExecTargetEvents
+            << " | " << std::setw(static_cast<int>(maxColumnWidths[forkColumn])) << counts.numForkEvents
+            << " | " << std::setw(static_cast<int>(maxColumnWidths[exitColumn])) << counts.numExitEvents
+            << " | " << (delta != 0 ? RED : GREEN) << setw(static_cast<int>(maxColumnWidths[deltaColumn])) << delta << RESET;
+         if (global::printRates)
+            printRateColumns(rates, maxColumnWidths);
+         cout << " | " << (isEstimate ? "〰" : (delta != 0 ? "❌" : "✅"));
+         if (isEstimate)
+         {
+            // each estimated column gets the interval of its own sampled messages
+            cout << " estimates, 95% CI:";
+            const std::array<std::pair<uint64_t, const string*>, 4> sampledColumns {{
+               {counts.numSampledExecSourceEvents, &execSourceColumn},
+               {counts.numSampledExecTargetEvents, &execTargetColumn},
+               {counts.numSampledForkEvents, &forkColumn},
+               {counts.numSampledExitEvents, &exitColumn},
+            }};
+            for (const auto& [numSampled, column] : sampledColumns)
+            {
+               if (numSampled > 0)
+                  cout << " " << *column << " ±" << std::lround(global::sampling.confidenceInterval(numSampled));
+            }
+         }
+         cout << "\n";
+         cout << separator << "\n";
+      };
+      const char* groupColor = (global::printChildProcessFlag || global::printParentProcessFlag) ? groupColors[colorIdx] : "";
+      printCounts(appName, groupColor, global::cumulativeStatistics ? sinceStart : interval, &appEventCounts.rates);
+      if (global::bothViews)
+         printCounts(sinceStartLabel, groupColor, sinceStart, nullptr);
+      
+      if (global::printChildProcessFlag)
+      {
+         // the source execs of the observed app are listed in their own target exec column
+         auto printSourceExec = [&](const string& sourceExecApp, uint64_t sourceExecAppCount) {
+            cout << "| " << left << subGroupColors[colorIdx] << std::setw(static_cast<int>(maxColumnWidths[executableColumn])) << "--" + sourceExecApp << RESET
+               << " | " << std::setw(static_cast<int>(maxColumnWidths[execSourceColumn])) << right << "-"
+               << " | " << std::setw(static_cast<int>(maxColumnWidths[execTargetColumn])) << sourceExecAppCount
+               << " | " << std::setw(static_cast<int>(maxColumnWidths[forkColumn])) << "-"
+               << " | " << std::setw(static_cast<int>(maxColumnWidths[exitColumn])) << "-"
+               << " | " << setw(static_cast<int>(maxColumnWidths[deltaColumn])) << "-";
+            if (global::printRates)
+               printRateColumns(nullptr, maxColumnWidths);
+            cout << " | " << "🐣" <<"\n";
+            cout << separator << "\n";
+         };
+         appEventCounts.sourceExecs.forEach(global::executables, printSourceExec);
+         if (appEventCounts.sourceExecs.other() > 0)
+            printSourceExec(otherName, appEventCounts.sourceExecs.other());
+      }
+      
+      if (global::printParentProcessFlag)
+      {
+         auto printParentExec = [&](const string& parentApp, uint64_t parentExecAppCount) {
+            cout << "| " << left << subGroupColors[colorIdx] << std::setw(static_cast<int>(maxColumnWidths[executableColumn])) << "--" + parentApp << RESET
+               << " | " << std::setw(static_cast<int>(maxColumnWidths[execSourceColumn])) << right << parentExecAppCount
+               << " | " << std::setw(static_cast<int>(maxColumnWidths[execTargetColumn])) << "-"
+               << " | " << std::setw(static_cast<int>(maxColumnWidths[forkColumn])) << "-"
+               << " | " << std::setw(static_cast<int>(maxColumnWidths[exitColumn])) << "-"
+               << " | " << setw(static_cast<int>(maxColumnWidths[deltaColumn])) << "-";
+            if (global::printRates)
+               printRateColumns(nullptr, maxColumnWidths);
+            cout << " | " << "👨‍👩‍👦" <<"\n";
+            cout << separator << "\n";
+         };
+         appEventCounts.parentExecs.forEach(global::executables, printParentExec);
+         if (appEventCounts.parentExecs.other() > 0)
+            printParentExec(otherName, appEventCounts.parentExecs.other());
+      }
+      
+      numEvictedNames += appEventCounts.sourceExecs.numEvictions() + appEventCounts.parentExecs.numEvictions();
+      appEventCounts.sourceExecs.resetEvictions();
+      appEventCounts.parentExecs.resetEvictions();
+      
+      // the next interval starts here, the counters themselves are never reset
+      appEventCounts.snapshot = sinceStart;
+      if (!global::cumulativeStatistics)
+      {
+         appEventCounts.sourceExecs.clear();
+         appEventCounts.parentExecs.clear();
+      }
+         
+      colorIdx++;
+   }
+   
+   if (numEvictedNames > 0)
+      cout << "🧹 " << numEvictedNames << " child/parent names were moved into other, at most " << global::maxNames << " are kept per app\n";
+   
+   if (global::identityMode && !global::cumulativeStatistics && !global::bothViews && global::alertZ == 0)
+   {
+      // executables reappear once they are active again, with --alert-z the rows keep their baselines
+      global::identityStatistics.clear();
+   }
+   
+   if (global::sampling.enabled())
+   {
+      const uint64_t evaluated = global::sampling.evaluatedMessages;
+      const uint64_t skipped = global::sampling.skippedMessages;
+      if (evaluated + skipped > 0)
+      {
+         cout << "〰 sampling 1-in-" << global::sampling.rate << " was activated " << global::sampling.activations << " time(s): "
+              << evaluated << " of " << evaluated + skipped << " process messages evaluated during sampling, "
+              << "per-app numbers are scaled estimates\n";
+      }
+      if (!global::cumulativeStatistics)
+      {
+         global::sampling.evaluatedMessages = 0;
+         global::sampling.skippedMessages = 0;
+         global::sampling.activations = 0;
+      }
+   }
+}
+
+/// Lists the lifecycle of the processes of watched executables: instead of a delta of counts every process
+/// which was started without exiting yet and every exit without an observed start is accounted for.
+void printProcessStatistics()
+{
+   using namespace std;
+   constexpr size_t numColumns = 7;
+   constexpr size_t maxListedProcesses = 50;
+   
+   string executableColumn {"executable"};
+   string startedColumn {"#started"};
+   string exitedColumn {"#exited"};
+   string execColumn {"#exec_replaced"};
+   string exitWithoutStartColumn {"#exits_without_start"};
+   string runningColumn {"#running"};
+   string eventsPerProcessColumn {"#events/exited_process"};
+   
+   const array<string, numColumns> headers {
+      executableColumn,
+      startedColumn,
+      exitedColumn,
+      execColumn,
+      exitWithoutStartColumn,
+      runningColumn,
+      eventsPerProcessColumn,
+   };
+   
+   scoped_lock lock {global::appStatisticsMutex};
+   auto& processTable = *global::processTable;
+   
+   auto label = [](ExecutableTable::Id executableId) {
+      return global::identityMode ? global::executables.name(executableId) + " (" + global::executables.path(executableId) + ")"
+                                  : global::executables.name(executableId);
+   };
    
-   auto getLongestStringKey = [](const auto& a, const auto& b) {
-      return a.first.length() < b.first.length();
+   // rows are labeled like the executable table, so without -i executable files with the same name are merged
+   struct ProcessRow
+   {
+      ProcessLifetimeCounts lifetimeCounts {};
+      /// processes whose start was observed but which did not exit yet
+      vector<const ProcessEntry*> running {};
    };
+   map<string, ProcessRow> rows {};
+   for (const auto& [executableId, lifetimeCounts] : global::processLifetimeStatistics)
+   {
+      auto& rowCounts = rows[label(executableId)].lifetimeCounts;
+      rowCounts.numStarted += lifetimeCounts.numStarted;
+      rowCounts.numExited += lifetimeCounts.numExited;
+      rowCounts.numExitsWithoutStart += lifetimeCounts.numExitsWithoutStart;
+      rowCounts.numReplacedByExec += lifetimeCounts.numReplacedByExec;
+      rowCounts.numEventsOfExited += lifetimeCounts.numEventsOfExited;
+   }
+   processTable.forEach([&](const ProcessEntry& process) {
+      if (process.startSeen && isWatchedExecutable(process.executable, global::executables.path(process.executable)))
+         rows[label(process.executable)].running.push_back(&process);
+   });
+   
+   unordered_map<string, size_t> maxColumnWidths {};
+   for (const auto& header : headers)
+      maxColumnWidths[header] = header.length();
+   for (const auto& [rowLabel, _] : rows)
+      maxColumnWidths[executableColumn] = std::max(maxColumnWidths[executableColumn], rowLabel.length());
+   
+   string separator {"+"};
+   for (const auto& header : headers)
+   {
+      separator += string(maxColumnWidths.at(header) + 2, '-');
+      separator += "+";
+   }
+   
+   printHeader(separator, headers, maxColumnWidths);
+   
+   const auto now = static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count());
+   size_t numListedProcesses {0};
+   size_t numUnlistedProcesses {0};
+   for (const auto& [rowLabel, row] : rows)
+   {
+      const auto& lifetimeCounts = row.lifetimeCounts;
+      const auto& running = row.running;
+      const bool isMatched = running.empty() && lifetimeCounts.numExitsWithoutStart == 0;
+      
+      cout << "| " << left << std::setw(static_cast<int>(maxColumnWidths[executableColumn])) << rowLabel
+         << " | " << right << std::setw(static_cast<int>(maxColumnWidths[startedColumn])) << lifetimeCounts.numStarted
+         << " | " << std::setw(static_cast<int>(maxColumnWidths[exitedColumn])) << lifetimeCounts.numExited
+         << " | " << std::setw(static_cast<int>(maxColumnWidths[execColumn])) << lifetimeCounts.numReplacedByExec
+         << " | " << std::setw(static_cast<int>(maxColumnWidths[exitWithoutStartColumn])) << lifetimeCounts.numExitsWithoutStart
+         << " | " << (running.empty() ? GREEN : RED) << std::setw(static_cast<int>(maxColumnWidths[runningColumn])) << running.size() << RESET
+         << " | " << std::setw(static_cast<int>(maxColumnWidths[eventsPerProcessColumn]))
+         << (lifetimeCounts.numExited > 0 ? lifetimeCounts.numEventsOfExited / lifetimeCounts.numExited : 0)
+         << " | " << (isMatched ? "✅" : "❌") << "\n";
+      cout << separator << "\n";
+   }
+   
+   // the exact list of processes behind a non-zero delta
+   for (const auto& [rowLabel, row] : rows)
+   {
+      for (const ProcessEntry* process : row.running)
+      {
+         if (numListedProcesses++ >= maxListedProcesses)
+         {
+            numUnlistedProcesses++;
+            continue;
+         }
+         const auto runningSeconds = now > process->startTime ? (now - process->startTime) / 1'000'000'000 : 0;
+         cout << "🏃 " << rowLabel << " pid " << process->key.pid << " (parent " << process->parent.pid << ")"
+              << " running for " << runningSeconds << " seconds, " << processTable.totalOf(*process) << " events\n";
+      }
+   }
+   if (numUnlistedProcesses > 0)
+      cout << "   ... and " << numUnlistedProcesses << " more running processes\n";
+   
+   cout << "🗂 process table: " << processTable.size() << " of " << processTable.capacity() << " entries in use, "
+        << processTable.numEvictions() << " evicted, " << global::executables.size() << " executables seen\n";
+   
+   if (!global::cumulativeStatistics)
+      global::processLifetimeStatistics.clear();
+}
+
+/// formats nanoseconds with the largest unit which keeps at least one digit before the decimal point
+std::string formatDuration(uint64_t nanoseconds)
+{
+   constexpr std::array<std::pair<uint64_t, const char*>, 4> units {{
+      {1'000'000'000, "s"}, {1'000'000, "ms"}, {1'000, "µs"}, {1, "ns"}
+   }};
+   for (const auto& [scale, unit] : units)
+   {
+      if (nanoseconds >= scale || scale == 1)
+      {
+         std::ostringstream formatted {};
+         formatted << std::fixed << std::setprecision(scale == 1 ? 0 : 1) << static_cast<double>(nanoseconds) / static_cast<double>(scale) << unit;
+         return formatted.str();
+      }
+   }
+   return {};
+}
+
+/// Prints percentiles of the fork to exec latency and the lifetime of the processes of the watched executables.
+void printLatencyStatistics()
+{
+   using namespace std;
+   constexpr size_t numColumns = 9;
+   
+   string executableColumn {"executable"};
+   string forkExecCountColumn {"#fork_exec"};
+   string forkExecP50Column {"fork_exec_p50"};
+   string forkExecP99Column {"fork_exec_p99"};
+   string forkExecMaxColumn {"fork_exec_max"};
+   string lifetimeCountColumn {"#lifetimes"};
+   string lifetimeP50Column {"lifetime_p50"};
+   string lifetimeP99Column {"lifetime_p99"};
+   string lifetimeMaxColumn {"lifetime_max"};
+   
+   const array<string, numColumns> headers {
+      executableColumn,
+      forkExecCountColumn,
+      forkExecP50Column,
+      forkExecP99Column,
+      forkExecMaxColumn,
+      lifetimeCountColumn,
+      lifetimeP50Column,
+      lifetimeP99Column,
+      lifetimeMaxColumn,
+   };
+   
+   scoped_lock lock {global::appStatisticsMutex};
+   
+   // rows are labeled like the executable table, so without -i executable files with the same name are merged
+   map<string, ProcessLatencies> rows {};
+   for (const auto& [executableId, latencies] : global::processLatencyStatistics)
+   {
+      const auto rowLabel = global::identityMode ? global::executables.name(executableId) + " (" + global::executables.path(executableId) + ")"
+                                                 : global::executables.name(executableId);
+      auto& row = rows[rowLabel];
+      row.forkToExec.merge(latencies.forkToExec);
+      row.lifetime.merge(latencies.lifetime);
+   }
+   
+   unordered_map<string, size_t> maxColumnWidths {};
+   for (const auto& header : headers)
+      maxColumnWidths[header] = header.length();
+   for (const auto& [rowLabel, _] : rows)
+      maxColumnWidths[executableColumn] = std::max(maxColumnWidths[executableColumn], rowLabel.length());
+   
+   string separator {"+"};
+   for (const auto& header : headers)
+   {
+      separator += string(maxColumnWidths.at(header) + 2, '-');
+      separator += "+";
+   }
+   
+   printHeader(separator, headers, maxColumnWidths);
+   
+   auto durationOrDash = [](const LogHistogram& histogram, uint64_t value) {
+      return histogram.numValues() > 0 ? formatDuration(value) : string {"-"};
+   };
+   for (const auto& [rowLabel, row] : rows)
+   {
+      const auto& forkToExec = row.forkToExec;
+      const auto& lifetime = row.lifetime;
+      cout << "| " << left << std::setw(static_cast<int>(maxColumnWidths[executableColumn])) << rowLabel
+         << " | " << right << std::setw(static_cast<int>(maxColumnWidths[forkExecCountColumn])) << forkToExec.numValues()
+         << " | " << std::setw(static_cast<int>(maxColumnWidths[forkExecP50Column])) << durationOrDash(forkToExec, forkToExec.percentile(0.5))
+         << " | " << std::setw(static_cast<int>(maxColumnWidths[forkExecP99Column])) << durationOrDash(forkToExec, forkToExec.percentile(0.99))
+         << " | " << std::setw(static_cast<int>(maxColumnWidths[forkExecMaxColumn])) << durationOrDash(forkToExec, forkToExec.maximum())
+         << " | " << std::setw(static_cast<int>(maxColumnWidths[lifetimeCountColumn])) << lifetime.numValues()
+         << " | " << std::setw(static_cast<int>(maxColumnWidths[lifetimeP50Column])) << durationOrDash(lifetime, lifetime.percentile(0.5))
+         << " | " << std::setw(static_cast<int>(maxColumnWidths[lifetimeP99Column])) << durationOrDash(lifetime, lifetime.percentile(0.99))
+         << " | " << std::setw(static_cast<int>(maxColumnWidths[lifetimeMaxColumn])) << durationOrDash(lifetime, lifetime.maximum())
+         << " | " << "⏳" << "\n";
+      cout << separator << "\n";
+   }
+   
+   if (!global::cumulativeStatistics)
+      global::processLatencyStatistics.clear();
+}
+
+/// Prints the messages of the process trees of the watched apps, grouped by event type.
+void printTreeStatistics()
+{
+   using namespace std;
+   constexpr size_t numColumns = 4;
+   
+   string treeColumn {"process_tree"};
+   string processesColumn {"#processes"};
+   string runningColumn {"#running"};
+   string messagesColumn {"#messages"};
+   
+   const array<string, numColumns> headers {
+      treeColumn,
+      processesColumn,
+      runningColumn,
+      messagesColumn,
+   };
+   
+   scoped_lock lock {global::appStatisticsMutex};
+   
+   vector<uint64_t> runningProcesses(global::watchedApps.size(), 0);
+   global::processTable->forEach([&](const ProcessEntry& process) {
+      if (process.treeRoot != noApp)
+         runningProcesses[static_cast<size_t>(process.treeRoot)]++;
+   });
+   
+   unordered_map<string, size_t> maxColumnWidths {};
+   for (const auto& header : headers)
+      maxColumnWidths[header] = header.length();
+   for (const auto& appName : global::watchedApps)
+      maxColumnWidths[treeColumn] = std::max(maxColumnWidths[treeColumn], appName.length());
+   for (const auto eventType : global::events2subscribe2)
+      maxColumnWidths[treeColumn] = std::max(maxColumnWidths[treeColumn], ESEventTypes::event2name.at(eventType).length() + 2);
+   
+   string separator {"+"};
+   for (const auto& header : headers)
+   {
+      separator += string(maxColumnWidths.at(header) + 2, '-');
+      separator += "+";
+   }
+   
+   printHeader(separator, headers, maxColumnWidths);
+   
+   for (size_t root = 0; root < global::watchedApps.size(); ++root)
+   {
+      auto& eventCounts = global::treeEventCounts[root];
+      uint64_t totalMessages {0};
+      for (const auto count : eventCounts)
+         totalMessages += count;
+      
+      const auto colorIdx = root % groupColors.size();
+      cout << "| " << left << groupColors[colorIdx] << std::setw(static_cast<int>(maxColumnWidths[treeColumn])) << global::watchedApps[root] << RESET
+         << " | " << right << std::setw(static_cast<int>(maxColumnWidths[processesColumn])) << global::treeProcessCounts[root]
+         << " | " << std::setw(static_cast<int>(maxColumnWidths[runningColumn])) << runningProcesses[root]
+         << " | " << std::setw(static_cast<int>(maxColumnWidths[messagesColumn])) << totalMessages
+         << " | " << "🌳" << "\n";
+      cout << separator << "\n";
+      
+      for (size_t i = 0; i < global::events2subscribe2.size(); ++i)
+      {
+         const auto eventType = global::events2subscribe2[i];
+         // duplicate subscriptions share the counter of the last one
+         if (global::processCounterIndex[eventType] != i || eventCounts[i] == 0)
+            continue;
+         cout << "| " << left << subGroupColors[colorIdx] << std::setw(static_cast<int>(maxColumnWidths[treeColumn])) << "--" + ESEventTypes::event2name.at(eventType) << RESET
+            << " | " << right << std::setw(static_cast<int>(maxColumnWidths[processesColumn])) << "-"
+            << " | " << std::setw(static_cast<int>(maxColumnWidths[runningColumn])) << "-"
+            << " | " << std::setw(static_cast<int>(maxColumnWidths[messagesColumn])) << eventCounts[i]
+            << " |\n";
+         cout << separator << "\n";
+      }
+      
+      if (!global::cumulativeStatistics)
+      {
+         std::fill(eventCounts.begin(), eventCounts.end(), 0);
+         global::treeProcessCounts[root] = 0;
+      }
+   }
+}
+
+/// the width of the event type column, analyze lists the event types found in the capture instead of the subscribed ones
+size_t getMaximumEventColumnWidth(const std::string& header, const FlatHashMap<std::string, EventCounts>& eventStatistics)
+{
+   size_t width = header.length();
+   for (const auto& [eventName, _] : eventStatistics)
+      width = std::max(width, eventName.length());
+   return width;
+}
+
+void printStatisticsByEventType()
+{
+   using namespace std;
+   
+   string eventTypeColumn = "ES_event_type";
+   string messagesReceivedColumn = "#messages_received";
+   string messagesMissingColumn = "#messages_missing";
+   string messagesRecordedColumn = "#messages_recorded";
+   string receivedSinceStartColumn = "#received_since_start";
+   string missingSinceStartColumn = "#missing_since_start";
+   string max10MsColumn = "max/10ms";
+   string max100MsColumn = "max/100ms";
+   string executablesColumn = "~#executables";
+   string pathsColumn = "~#paths";
+   string processesColumn = "~#processes";
+   
+   vector<string> headers = {
+      eventTypeColumn,
+      messagesReceivedColumn,
+      messagesMissingColumn
+   };
+   // what was recorded next to what arrived, when the record selection drops messages
+   const bool printRecorded = global::flightRecorder && global::recordSelection;
+   if (printRecorded)
+      headers.push_back(messagesRecordedColumn);
+   if (global::bothViews)
+      headers.insert(headers.end(), {receivedSinceStartColumn, missingSinceStartColumn});
+   if (global::printRates)
+      headers.insert(headers.end(), rateColumns.begin(), rateColumns.end());
+   if (global::burstResolutionMs > 0)
+      headers.insert(headers.end(), {max10MsColumn, max100MsColumn});
+   if (global::printDistinctCounts)
+      headers.insert(headers.end(), {executablesColumn, pathsColumn, processesColumn});
+   
+   scoped_lock lock {global::eventStatisticsMutex};
+   unordered_map<string, size_t> maxColumnWidths {};
+   for (const auto& header : headers)
+      maxColumnWidths[header] = header.length();
+   maxColumnWidths[eventTypeColumn] = getMaximumEventColumnWidth(eventTypeColumn, global::eventStatistics);
+   
+   string separator {"+"};
+   for (const auto& header : headers)
+   {
+      separator += string(maxColumnWidths.at(header) + 2, '-');
+      separator += "+";
+   }
+
+   printHeader(separator, headers, maxColumnWidths);
+   
+   MessageCounts total {};
+   MessageCounts totalSinceStart {};
+   // the distinct counts of all event types together are estimated by merging the estimators
+   unique_ptr<EventSketches> totalSketches = global::printDistinctCounts ? make_unique<EventSketches>() : nullptr;
+   auto printCounts = [&](const MessageCounts& counts, const MessageCounts& sinceStart) {
+      const MessageCounts& shown = global::cumulativeStatistics ? sinceStart : counts;
+      std::cout << " | " << std::setw(static_cast<int>(maxColumnWidths.at(messagesReceivedColumn))) << right << shown.totalCount
+               << " | " << (shown.numMissingMessages != 0 ? RED : GREEN) << std::setw(static_cast<int>(maxColumnWidths.at(messagesMissingColumn))) << shown.numMissingMessages << RESET;
+      if (printRecorded)
+         std::cout << " | " << std::setw(static_cast<int>(maxColumnWidths.at(messagesRecordedColumn))) << shown.numRecordedMessages;
+      if (global::bothViews)
+      {
+         std::cout << " | " << std::setw(static_cast<int>(maxColumnWidths.at(receivedSinceStartColumn))) << sinceStart.totalCount
+                  << " | " << (sinceStart.numMissingMessages != 0 ? RED : GREEN) << std::setw(static_cast<int>(maxColumnWidths.at(missingSinceStartColumn))) << sinceStart.numMissingMessages << RESET;
+      }
+      return shown.numMissingMessages;
+   };
+   auto printDistinctColumns = [&](const EventSketches& sketches) {
+      cout << " | " << std::setw(static_cast<int>(maxColumnWidths.at(executablesColumn))) << sketches.executables.estimate()
+           << " | " << std::setw(static_cast<int>(maxColumnWidths.at(pathsColumn))) << sketches.paths.estimate()
+           << " | " << std::setw(static_cast<int>(maxColumnWidths.at(processesColumn))) << sketches.processes.estimate();
+   };
+   
+   for (auto& [eventName, eventCounts] : global::eventStatistics)
+   {
+      const MessageCounts& sinceStart = eventCounts;
+      const MessageCounts interval = sinceStart - eventCounts.snapshot;
+      total.totalCount += interval.totalCount;
+      total.numMissingMessages += interval.numMissingMessages;
+      total.numFilteredMessages += interval.numFilteredMessages;
+      total.numRecordedMessages += interval.numRecordedMessages;
+      totalSinceStart.totalCount += sinceStart.totalCount;
+      totalSinceStart.numMissingMessages += sinceStart.numMissingMessages;
+      totalSinceStart.numFilteredMessages += sinceStart.numFilteredMessages;
+      totalSinceStart.numRecordedMessages += sinceStart.numRecordedMessages;
+      
+      std::cout << "| " << left << std::setw(static_cast<int>(maxColumnWidths.at(eventTypeColumn))) << eventName;
+      const auto numMissingMessages = printCounts(interval, sinceStart);
+      if (global::printRates)
+         printRateColumns(&eventCounts.rates, maxColumnWidths);
+      if (eventCounts.bursts)
+      {
+         std::cout << " | " << std::setw(static_cast<int>(maxColumnWidths.at(max10MsColumn))) << eventCounts.bursts->max10Ms()
+                  << " | " << std::setw(static_cast<int>(maxColumnWidths.at(max100MsColumn))) << eventCounts.bursts->max100Ms();
+      }
+      if (global::printDistinctCounts)
+      {
+         const auto& sketches = *global::eventSketches[ESEventTypes::name2event.at(eventName)];
+         printDistinctColumns(sketches);
+         totalSketches->executables.merge(sketches.executables);
+         totalSketches->paths.merge(sketches.paths);
+         totalSketches->processes.merge(sketches.processes);
+      }
+      std::cout << " | " << (numMissingMessages != 0 ? "❌" : "✅") << "\n";
+      std::cout << separator << "\n";
+      
+      // the next interval starts here, the counters themselves are never reset
+      eventCounts.snapshot = sinceStart;
+   }
+   
+   std::cout << "| " << right << std::setw(static_cast<int>(maxColumnWidths.at(eventTypeColumn))) << "total:";
+   const auto totalMissedMessages = printCounts(total, totalSinceStart);
+   if (global::printRates)
+      printRateColumns(nullptr, maxColumnWidths);
+   if (global::burstResolutionMs > 0)
+   {
+      std::cout << " | " << std::setw(static_cast<int>(maxColumnWidths.at(max10MsColumn))) << "-"
+               << " | " << std::setw(static_cast<int>(maxColumnWidths.at(max100MsColumn))) << "-";
+   }
+   if (global::printDistinctCounts)
+      printDistinctColumns(*totalSketches);
+   std::cout << " | " << (totalMissedMessages != 0 ? "❌" : "✅") << "\n";
+   std::cout << separator << "\n";
+   
+   const uint64_t totalFilteredMessages = global::cumulativeStatistics ? totalSinceStart.numFilteredMessages : total.numFilteredMessages;
+   if (global::filter)
+      std::cout << "🔍 " << totalFilteredMessages << " messages did not match the filter expression\n";
+   if (printRecorded)
+   {
+      const MessageCounts& shown = global::cumulativeStatistics ? totalSinceStart : total;
+      std::cout << "📼 " << shown.numRecordedMessages << " of " << shown.totalCount + shown.numFilteredMessages
+         << " messages which arrived were selected for recording\n";
+   }
+   
+   for (const auto& executable : global::estimatedExecutables)
+   {
+      std::cout << "🔢 estimated messages of " << executable << ":";
+      const auto hash = Sketches::hashKey(executable);
+      for (const auto& [eventName, _] : global::eventStatistics)
+         std::cout << " " << eventName << " ~" << global::eventSketches[ESEventTypes::name2event.at(eventName)]->messagesByExecutable.estimate(hash);
+      std::cout << "\n";
+   }
+   if (global::burstResolutionMs > 0)
+   {
+      // the burst profile tells whether drops coincide with a few large bursts or a high base load
+      for (auto& [eventName, eventCounts] : global::eventStatistics)
+      {
+         std::cout << "💥 " << eventName << " 10 ms windows by messages:";
+         const auto& profile = eventCounts.bursts->profile();
+         for (size_t bin = 0; bin < profile.size(); ++bin)
+         {
+            if (profile[bin] > 0)
+               std::cout << " " << BurstRing::profileBinLabel(bin) << ":" << profile[bin];
+         }
+         std::cout << "\n";
+         eventCounts.bursts->reset();
+      }
+   }
+   if (global::printDistinctCounts)
+      std::cout << "≈ columns starting with ~ are estimates, distinct counts are accurate to about 2%\n";
+   
+   if (!global::cumulativeStatistics)
+   {
+      for (const auto& sketches : global::eventSketches)
+      {
+         if (!sketches)
+            continue;
+         sketches->executables.clear();
+         sketches->paths.clear();
+         sketches->processes.clear();
+         sketches->messagesByExecutable.clear();
+      }
+   }
+}
+
+
+/// Prints the executables which sent the most messages per event type.
+void printTopExecutables()
+{
+   constexpr size_t numColumns = 3;
+   using namespace std;
+   
+   string executableColumn = "ES_event_type/executable";
+   string messagesColumn = "#messages";
+   string errorColumn = "max_overestimate";
+   
+   const array<string, numColumns> headers = {
+      executableColumn,
+      messagesColumn,
+      errorColumn
+   };
+   
+   scoped_lock lock {global::eventStatisticsMutex};
+   
+   struct TopRows
+   {
+      const string* eventName;
+      uint64_t total;
+      vector<SpaceSaving::Counter> top;
+   };
+   vector<TopRows> groups {};
+   unordered_map<string, size_t> maxColumnWidths {};
+   for (const auto& header : headers)
+      maxColumnWidths[header] = header.length();
+   for (auto& [eventName, eventCounts] : global::eventStatistics)
+   {
+      auto& sketch = *eventCounts.topExecutables;
+      groups.push_back({&eventName, sketch.size(), sketch.top(global::topK)});
+      maxColumnWidths[executableColumn] = std::max(maxColumnWidths[executableColumn], eventName.length());
+      for (const auto& counter : groups.back().top)
+         maxColumnWidths[executableColumn] = std::max(maxColumnWidths[executableColumn], counter.key.length() + 2);
+   }
+   
+   string separator {"+"};
+   for (const auto& header : headers)
+   {
+      separator += string(maxColumnWidths.at(header) + 2, '-');
+      separator += "+";
+   }
+   
+   printHeader(separator, headers, maxColumnWidths);
+   
+   size_t groupIdx {0};
+   for (const auto& group : groups)
+   {
+      const auto colorIdx = groupIdx++ % groupColors.size();
+      std::cout << "| " << left << groupColors[colorIdx] << std::setw(static_cast<int>(maxColumnWidths[executableColumn])) << *group.eventName << RESET
+               << " | " << right << std::setw(static_cast<int>(maxColumnWidths[messagesColumn])) << group.total
+               << " | " << std::setw(static_cast<int>(maxColumnWidths[errorColumn])) << "-"
+               << " |\n";
+      std::cout << separator << "\n";
+      
+      uint64_t listedMessages {0};
+      for (const auto& counter : group.top)
+      {
+         listedMessages += counter.count;
+         std::cout << "| " << left << subGroupColors[colorIdx] << std::setw(static_cast<int>(maxColumnWidths[executableColumn])) << "--" + counter.key << RESET
+                  << " | " << right << std::setw(static_cast<int>(maxColumnWidths[messagesColumn])) << counter.count
+                  << " | " << std::setw(static_cast<int>(maxColumnWidths[errorColumn])) << counter.error
+                  << " |\n";
+         std::cout << separator << "\n";
+      }
+      // the listed counts are upper bounds, so the remainder is a lower bound
+      std::cout << "| " << left << subGroupColors[colorIdx] << std::setw(static_cast<int>(maxColumnWidths[executableColumn])) << "--others" << RESET
+               << " | " << right << std::setw(static_cast<int>(maxColumnWidths[messagesColumn])) << (group.total > listedMessages ? group.total - listedMessages : 0)
+               << " | " << std::setw(static_cast<int>(maxColumnWidths[errorColumn])) << "-"
+               << " |\n";
+      std::cout << separator << "\n";
+   }
+   std::cout << "📊 counts of the top " << global::topK << " executables exceed the true count by at most max_overestimate\n";
+   
+   if (!global::cumulativeStatistics)
+   {
+      for (auto& [_, eventCounts] : global::eventStatistics)
+         eventCounts.topExecutables->clear();
+   }
+}
+
+/// Prints the rows as table below the headers, the last column holds counts and is right aligned.
+void printCountsTable(const std::vector<std::string>& headers, const std::vector<std::vector<std::string>>& rows)
+{
+   using namespace std;
+   unordered_map<string, size_t> maxColumnWidths {};
+   for (const auto& header : headers)
+      maxColumnWidths[header] = header.length();
+   for (const auto& row : rows)
+   {
+      for (size_t c = 0; c < row.size(); ++c)
+         maxColumnWidths[headers[c]] = std::max(maxColumnWidths[headers[c]], row[c].length());
+   }
+   string separator {"+"};
+   for (const auto& header : headers)
+   {
+      separator += string(maxColumnWidths.at(header) + 2, '-');
+      separator += "+";
+   }
+   
+   printHeader(separator, headers, maxColumnWidths);
+   for (const auto& row : rows)
+   {
+      for (size_t c = 0; c + 1 < row.size(); ++c)
+         cout << "| " << left << setw(static_cast<int>(maxColumnWidths[headers[c]])) << row[c] << " ";
+      cout << "| " << right << setw(static_cast<int>(maxColumnWidths[headers.back()])) << row.back() << " |\n";
+      cout << separator << "\n";
+   }
+}
+
+/// formatted with the thousands separator of the other tables
+std::string formatCount(uint64_t count)
+{
+   std::ostringstream text {};
+   text.imbue(std::cout.getloc());
+   text << count;
+   return text.str();
+}
+
+/// Prints the groups of the --group-by dimensions with the most messages.
+void printGroups()
+{
+   using namespace std;
+   scoped_lock lock {global::groupByMutex};
+   auto& groupBy = *global::groupBy;
+   const auto& dimensions = groupBy.allDimensions();
+   vector<string> headers {};
+   for (const auto dimension : dimensions)
+      headers.emplace_back(GroupBy::infoOf(dimension).name);
+   headers.push_back("#messages");
+   
+   vector<vector<string>> rows {};
+   uint64_t listedMessages {0};
+   for (const auto& group : groupBy.top(global::groupByRows))
+   {
+      auto& row = rows.emplace_back();
+      for (size_t d = 0; d < dimensions.size(); ++d)
+      {
+         if (dimensions[d] == GroupBy::Dimension::Event)
+         {
+            const auto name = ESEventTypes::event2name.find(static_cast<es_event_type_t>(group.values[d]));
+            row.push_back(name != ESEventTypes::event2name.end() ? name->second : "EVENT_" + to_string(group.values[d]));
+         }
+         else
+         {
+            row.push_back(groupBy.label(d, group.values[d]));
+         }
+      }
+      row.push_back(formatCount(group.count));
+      listedMessages += group.count;
+   }
+   
+   printCountsTable(headers, rows);
+   cout << "📊 " << rows.size() << " of " << groupBy.size() << " groups listed with " << listedMessages << " of " << groupBy.total() << " messages";
+   if (groupBy.overflow() > 0)
+      cout << ", " << groupBy.overflow() << " messages of groups beyond --group-by-max were not grouped";
+   cout << "\n";
+   
+   if (!global::cumulativeStatistics)
+      groupBy.clear();
+}
+
+/// Updates the baseline with the rate of the last tick.
+/// Returns true and fills in the alert if the rate just became anomalous, a lasting anomaly is reported only once.
+bool updateBaseline(EwmaBaseline& baseline, uint64_t count, double tickSeconds, RateAlert& alert)
+{
+   const double rate = static_cast<double>(count) / tickSeconds;
+   const double previousMean = baseline.average();
+   const bool warm = baseline.updates() >= global::alertWarmup;
+   const double z = baseline.update(rate, global::alertAlpha);
+   if (!warm || z < global::alertZ || rate < global::alertRatio * previousMean)
+   {
+      baseline.alerting = false;
+      return false;
+   }
+   if (baseline.alerting)
+      return false;
+   
+   baseline.alerting = true;
+   alert.rate = static_cast<uint64_t>(std::llround(rate));
+   alert.baseline = previousMean;
+   alert.zScore = z;
+   return true;
+}
+
+/// the time is local for the report and UTC for the alerts stream
+std::string formatAlert(const RateAlert& alert, bool utc)
+{
+   std::tm time {};
+   if (utc)
+      gmtime_r(&alert.time, &time);
+   else
+      localtime_r(&alert.time, &time);
+   std::ostringstream line {};
+   line << std::put_time(&time, utc ? "%Y-%m-%dT%H:%M:%SZ" : "%H:%M:%S") << " " << alert.counter << ": " << alert.rate << "/s, baseline "
+        << std::llround(alert.baseline) << "/s, z-score " << std::llround(alert.zScore);
+   return line.str();
+}
+
+/// Is called every second with --alert-z. Updates the baselines of all event types and app counters with the
+/// messages counted since the previous call, the cost only depends on the number of counters.
+void checkRateBaselines()
+{
+   using namespace std::chrono;
+   static auto previousTick = steady_clock::now();
+   const auto tick = steady_clock::now();
+   const double tickSeconds = std::max(duration<double>(tick - previousTick).count(), 0.001);
+   previousTick = tick;
+   
+   const std::time_t now = std::time(nullptr);
+   std::vector<RateAlert> alerts {};
+   RateAlert alert {now};
+   {
+      std::scoped_lock lock {global::eventStatisticsMutex};
+      for (auto& [eventName, eventCounts] : global::eventStatistics)
+      {
+         if (updateBaseline(eventCounts.baseline, eventCounts.totalCount - eventCounts.baselineCount, tickSeconds, alert))
+         {
+            alert.counter = eventName;
+            alerts.push_back(alert);
+         }
+         eventCounts.baselineCount = eventCounts.totalCount;
+      }
+   }
+   {
+      std::scoped_lock lock {global::appStatisticsMutex};
+      // the label is only built for alerts, updating thousands of rows every second stays cheap
+      auto updateApp = [&](AppEventCounts& appEventCounts, auto&& label) {
+         for (size_t i = 0; i < baselineCounters.size(); ++i)
+         {
+            const auto [counter, column] = baselineCounters[i];
+            if (updateBaseline(appEventCounts.baselines[i], appEventCounts.*counter - appEventCounts.baselineCounts.*counter, tickSeconds, alert))
+            {
+               alert.counter = label() + " " + column;
+               alerts.push_back(alert);
+            }
+         }
+         appEventCounts.baselineCounts = static_cast<const ProcessMessageCounts&>(appEventCounts);
+      };
+      if (global::identityMode)
+      {
+         for (auto& [executableId, appEventCounts] : global::identityStatistics)
+         {
+            updateApp(appEventCounts, [executableId] {
+               return global::executables.name(executableId) + " (" + global::executables.path(executableId) + ")";
+            });
+         }
+      }
+      else
+      {
+         for (auto& [appName, appEventCounts] : global::appStatistics)
+            updateApp(appEventCounts, [&appName] { return appName; });
+      }
+   }
+   
+   if (alerts.empty())
+      return;
+   
+   // at most this many alerts are kept for the next report, the alerts stream gets all of them
+   constexpr size_t maxReportedAlerts = 100;
+   std::scoped_lock lock {global::alertsMutex};
+   for (auto& rateAlert : alerts)
+   {
+      if (global::alertsStream.is_open())
+         global::alertsStream << formatAlert(rateAlert, true) << "\n";
+      if (global::alerts.size() < maxReportedAlerts)
+         global::alerts.push_back(std::move(rateAlert));
+      else
+         global::numDroppedAlerts++;
+   }
+   if (global::alertsStream.is_open())
+      global::alertsStream.flush();
+}
+
+/// Prints the alerts raised since the last report.
+void printAlerts()
+{
+   std::scoped_lock lock {global::alertsMutex};
+   if (global::alerts.empty())
+   {
+      std::cout << "🚨 no rate alerts\n";
+      return;
+   }
+   for (const auto& alert : global::alerts)
+      std::cout << "🚨 " << formatAlert(alert, false) << "\n";
+   if (global::numDroppedAlerts > 0)
+      std::cout << "🚨 " << global::numDroppedAlerts << " more alerts were not kept for the report\n";
+   global::alerts.clear();
+   global::numDroppedAlerts = 0;
+}
+
+/// Runs the query on the snapshot of the store and prints the matching groups as table.
+void printQueryResult(const EventQuery::Query& query, const EventStore::Snapshot& store)
+{
+   using namespace std;
+   const auto start = chrono::steady_clock::now();
+   const auto result = query.run(store);
+   const double milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+   
+   cout << "🔎 " << query.source() << ": " << result.numMatched << " of " << result.numScanned << " messages";
+   if (!query.groupedFields().empty())
+      cout << " in " << result.numGroups << " groups";
+   cout << ", " << result.numChunksSkipped << " of " << result.numChunksScanned + result.numChunksSkipped << " chunks skipped, "
+      << fixed << setprecision(1) << milliseconds << " ms\n";
+   if (query.groupedFields().empty() || result.rows.empty())
+      return;
+   
+   vector<string> headers {};
+   for (const auto field : query.groupedFields())
+      headers.emplace_back(EventQuery::nameOf(field));
+   headers.push_back("#messages");
+   vector<vector<string>> rows {};
+   for (const auto& row : result.rows)
+   {
+      rows.push_back(row.values);
+      rows.back().push_back(formatCount(row.count));
+   }
+   printCountsTable(headers, rows);
+}
+
+/// Prints the results of the --query queries on the messages in the event store.
+void printQueries()
+{
+   // the handler keeps appending while the queries run on the snapshot
+   std::ostringstream summary {};
+   summary.imbue(std::cout.getloc());
+   EventStore::Snapshot snapshot {};
+   {
+      std::scoped_lock lock {global::eventStoreMutex};
+      const auto& store = *global::eventStore;
+      summary << "🗃 event store: " << store.numRows() << " messages in " << store.memoryUsage() / (1024 * 1024) << " MB, "
+         << store.dictionarySize() << " paths, " << store.numDropped() << " older messages dropped\n";
+      snapshot = store.snapshot();
+   }
+   std::cout << summary.str();
+   for (const auto& query : global::queries)
+      printQueryResult(query, snapshot);
+}
+
+/// Is called when the user presses ctrl + t to send SIGINFO
+void sigHandler()
+{
+   using namespace std;
+   using namespace std::chrono;
+   static int signalCounter {0};
+   signalCounter++;
+   
+   std::cout << "\n🚀 ES client statistics #" << signalCounter << ":" << "\n";
+   dumpFlightRecorder("SIGINFO");
+   
+   if (!global::apps.empty())
+      printStatisticsByExecutable();
+   if (global::trackLatencies)
+   {
+      std::cout << "\n";
+      printLatencyStatistics();
+   }
+   if (global::trackProcesses)
+   {
+      std::cout << "\n";
+      printProcessStatistics();
+   }
+   if (global::treeMode)
+   {
+      std::cout << "\n";
+      printTreeStatistics();
+   }
+   std::cout << "\n";
+   printStatisticsByEventType();
+   if (global::topK > 0)
+   {
+      std::cout << "\n";
+      printTopExecutables();
+   }
+   if (global::groupBy)
+   {
+      std::cout << "\n";
+      printGroups();
+   }
+   if (global::alertZ > 0)
+   {
+      std::cout << "\n";
+      printAlerts();
+   }
+   if (global::eventStore)
+   {
+      std::cout << "\n";
+      printQueries();
+   }
+   
+   auto intervalEnd = steady_clock::now();
+   auto intervalDuration = intervalEnd - global::intervalStart;
+
+   std::cout << "⏱ interval duration: " << duration_cast<seconds>(intervalDuration).count() << " seconds\n";
+   global::intervalStart = steady_clock::now();
+}
+
+/// Prints the final statistics once the command given after -- and all of its descendants exited and exits with its exit code.
+void reportCommandIfFinished()
+{
+   using namespace std::chrono;
+   if (!global::command->finished || global::command->reported.exchange(true))
+      return;
+   
+   dispatch_async(dispatch_get_main_queue(), ^{
+      sigHandler();
+      
+      const auto& command = *global::command;
+      const double wallTime = duration<double>(steady_clock::now() - command.start).count();
+      std::scoped_lock lock {global::appStatisticsMutex};
+      std::cout << "⌛ wall time: " << std::fixed << std::setprecision(3) << wallTime << " seconds\n";
+      std::cout << "📈 messages/second: " << (wallTime > 0 ? static_cast<uint64_t>(static_cast<double>(command.numMessages) / wallTime) : 0)
+         << " (" << command.numMessages << " messages)\n";
+      std::cout << "👥 peak concurrent processes: " << command.peakRunning << "\n";
+      if (command.numEvicted > 0)
+         std::cout << "⚠️ " << command.numEvicted << " processes of the command were evicted from the full process table and may have "
+            "outlived it, raise --max-processes\n";
+      std::cout << "🚪 exit code: " << command.exitCode << std::endl;
+      std::exit(command.exitCode);
+   });
+}
+
+/// Spawns the command given after -- suspended, so its pid is known before it can fork, and resumes it.
+/// Returns false if the command could not be started.
+bool startCommand(const std::vector<std::string>& arguments)
+{
+   std::vector<char*> argv {};
+   for (const auto& argument : arguments)
+      argv.push_back(const_cast<char*>(argument.c_str()));
+   argv.push_back(nullptr);
+   
+   posix_spawnattr_t attributes;
+   posix_spawnattr_init(&attributes);
+   posix_spawnattr_setflags(&attributes, POSIX_SPAWN_START_SUSPENDED);
+   pid_t pid {0};
+   const int error = posix_spawnp(&pid, argv[0], nullptr, &attributes, argv.data(), environ);
+   posix_spawnattr_destroy(&attributes);
+   if (error != 0)
+   {
+      std::cerr << "Couldn't start " << arguments[0] << ": " << strerror(error) << "\n";
+      return false;
+   }
+   
+   auto& command = *global::command;
+   {
+      std::scoped_lock lock {global::appStatisticsMutex};
+      command.pid = pid;
+      command.start = std::chrono::steady_clock::now();
+      // the fork of the command may have been handled before its pid was known
+      global::processTable->forEach([](ProcessEntry& process) {
+         if (process.key.pid == global::command->pid)
+            joinCommandScope(process, false);
+      });
+   }
+   
+   dispatch_source_t exitSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_PROC, static_cast<uintptr_t>(pid), DISPATCH_PROC_EXIT,
+                                                         dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0));
+   dispatch_source_set_event_handler(exitSource, ^{
+      int status {0};
+      waitpid(global::command->pid, &status, 0);
+      {
+         std::scoped_lock lock {global::appStatisticsMutex};
+         global::command->exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+         global::command->exited = true;
+         checkCommandFinished();
+      }
+      dispatch_source_cancel(exitSource);
+      reportCommandIfFinished();
+      if (global::command->finished)
+         return;
+      
+      // a missed EXIT message would keep esmat waiting, the processes of the tree are checked once a second instead
+      dispatch_source_t pidTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0));
+      dispatch_source_set_timer(pidTimer, dispatch_time(DISPATCH_TIME_NOW, NSEC_PER_SEC), NSEC_PER_SEC, NSEC_PER_SEC / 10);
+      dispatch_source_set_event_handler(pidTimer, ^{
+         {
+            std::scoped_lock lock {global::appStatisticsMutex};
+            checkCommandFinished(true);
+         }
+         if (global::command->finished)
+            dispatch_source_cancel(pidTimer);
+         reportCommandIfFinished();
+      });
+      dispatch_resume(pidTimer);
+   });
+   dispatch_resume(exitSource);
+   
+   kill(pid, SIGCONT);
+   return true;
+}
+
+/// Creates the rows of the -a arguments and compiles the patterns among them.
+void watchApps()
+{
+   std::vector<std::string> patterns {};
+   // the rows of the patterns are referenced by pointer
+   global::appStatistics.reserve(global::apps.size());
+   global::watchedAppsByName.reserve(global::apps.size());
+   for (const auto& appName : global::apps)
+   {
+      auto [row, inserted] = global::appStatistics.emplace(appName, AppEventCounts {global::maxNames});
+      if (!inserted)
+         continue;
+      
+      const auto watchedApp = static_cast<WatchedApp>(global::watchedApps.size());
+      global::watchedApps.push_back(appName);
+      if (appName.find_first_of("/*?") != std::string::npos)
+      {
+         patterns.push_back(appName.starts_with("/") ? appName : "**/" + appName);
+         global::patternStatistics.push_back(&row->second);
+         global::watchedAppsByPattern.push_back(watchedApp);
+      }
+      else
+      {
+         global::watchedAppsByName.emplace(appName, watchedApp);
+      }
+   }
+   if (!patterns.empty())
+      global::pathMatcher.emplace(patterns);
+}
+
+/// Parses seconds since the epoch, a UTC time like 2024-05-01T12:00:00Z or a local time of today like 12:00 or 12:00:30
+/// into nanoseconds since the epoch.
+std::optional<uint64_t> parseTime(const std::string& text)
+{
+   if (!text.empty() && std::all_of(text.begin(), text.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); }))
+      return std::stoull(text) * 1'000'000'000;
+   
+   std::tm time {};
+   if (text.size() <= 8 && text.find('T') == std::string::npos)
+   {
+      const std::time_t now = std::time(nullptr);
+      localtime_r(&now, &time);
+      std::istringstream stream {text};
+      stream >> std::get_time(&time, text.size() > 5 ? "%H:%M:%S" : "%H:%M");
+      if (stream.fail() || stream.peek() != EOF)
+         return std::nullopt;
+      if (text.size() <= 5)
+         time.tm_sec = 0;
+      time.tm_isdst = -1;
+      const std::time_t seconds = std::mktime(&time);
+      if (seconds < 0)
+         return std::nullopt;
+      return static_cast<uint64_t>(seconds) * 1'000'000'000;
+   }
+   std::istringstream stream {text};
+   stream >> std::get_time(&time, "%Y-%m-%dT%H:%M:%S");
+   if (stream.fail() || (stream.peek() != EOF && stream.get() != 'Z'))
+      return std::nullopt;
+   const std::time_t seconds = timegm(&time);
+   if (seconds < 0)
+      return std::nullopt;
+   return static_cast<uint64_t>(seconds) * 1'000'000'000;
+}
+
+/// Builds the filter of the --from, --to and --events options of the capture subcommands, prints the first invalid value.
+std::optional<CaptureFilter> parseCaptureFilter(const std::string& fromTime, const std::string& toTime, const std::vector<std::string>& eventTypes)
+{
+   CaptureFilter filter {};
+   for (const auto& [text, time] : {std::pair {&fromTime, &filter.from}, std::pair {&toTime, &filter.to}})
+   {
+      if (text->empty())
+         continue;
+      const auto parsed = parseTime(*text);
+      if (!parsed)
+      {
+         std::cerr << *text << " is not a valid time\n";
+         return std::nullopt;
+      }
+      *time = *parsed;
+   }
+   for (const auto& eventName : eventTypes)
+   {
+      std::string eventNameUpper = eventName;
+      std::transform(eventNameUpper.begin(), eventNameUpper.end(), eventNameUpper.begin(), toupper);
+      if (!ESEventTypes::name2event.contains(eventNameUpper))
+      {
+         std::cerr << eventNameUpper << " is not a valid ES event type" << "\n";
+         return std::nullopt;
+      }
+      filter.addEventType(static_cast<uint16_t>(ESEventTypes::name2event.at(eventNameUpper)));
+   }
+   return filter;
+}
+
+/// a process image started by an exec in a capture
+struct CapturedImage
+{
+   uint64_t time {0};
+   WatchedApp app {noApp};
+   /// the image ended with the exit of its process, not with an exec into another one
+   bool exited {false};
+};
+
+/// first seq_num of an event type of one source in a range of capture blocks and the one expected after the range
+struct CapturedSeqNumbers
+{
+   uint64_t first {0};
+   uint64_t next {0};
+};
+
+/// What a worker aggregates from a contiguous range of capture blocks. Counters of adjacent ranges are
+/// simply added, sequence numbers and process images which cross the boundary are stitched by merge.
+struct CapturePartition
+{
+   /// by event type, named when the result is printed
+   FlatHashMap<uint16_t, EventCounts> events {};
+   /// by seqNumbersKey, the sources of a merged capture each have their own seq_nums
+   FlatHashMap<uint32_t, CapturedSeqNumbers> seqNumbers {};
+   FlatHashMap<std::string, AppEventCounts> apps {};
+   /// images of watched apps which were started but did not end in the range, by process token
+   std::unordered_map<uint64_t, CapturedImage> running {};
+   /// images of watched apps which ended in the range without their start, they may have started in an earlier range
+   std::unordered_map<uint64_t, CapturedImage> endedWithoutStart {};
+   /// lifetimes of the images started and ended in the range, by WatchedApp
+   std::vector<LogHistogram> lifetimes {};
+   uint64_t numRecords {0};
+   /// blocks which could not be decoded
+   uint64_t numDamagedBlocks {0};
+};
+
+/// pids stay below 2^24, the top byte of the token tells the source of a merged capture apart
+uint64_t processToken(int32_t pid, int32_t pidVersion, uint8_t source)
+{
+   return ((static_cast<uint64_t>(source) << 56) ^ (static_cast<uint64_t>(static_cast<uint32_t>(pid)) << 32)) | static_cast<uint32_t>(pidVersion);
+}
+
+uint32_t seqNumbersKey(uint16_t eventType, uint8_t source)
+{
+   return static_cast<uint32_t>(source) << 16 | eventType;
+}
+
+std::string capturedEventName(uint16_t eventType)
+{
+   const auto name = ESEventTypes::event2name.find(static_cast<es_event_type_t>(eventType));
+   return name != ESEventTypes::event2name.end() ? name->second : "EVENT_" + std::to_string(eventType);
+}
+
+/// the same as watchedAppOf for a path without an executable id, matcher is the copy of pathMatcher of the calling thread
+WatchedApp watchedAppOfPath(std::string_view path, PathMatcher* matcher)
+{
+   if (auto it = global::watchedAppsByName.find(Filter::basename(path)); it != global::watchedAppsByName.end())
+      return it->second;
+   if (matcher)
+   {
+      const auto& patternIds = matcher->match(path);
+      if (!patternIds.empty())
+         return global::watchedAppsByPattern[*std::min_element(patternIds.begin(), patternIds.end())];
+   }
+   return noApp;
+}
+
+/// the same as forEachWatchedApp on the rows of a partition
+template<typename F>
+void forEachCapturedApp(CapturePartition& partition, std::string_view path, PathMatcher* matcher, F&& f)
+{
+   const auto name = Filter::basename(path);
+   if (global::watchedAppsByName.contains(name))
+      f(partition.apps.try_emplace(name, global::maxNames).first->second);
+   if (matcher)
+   {
+      for (const auto patternId : matcher->match(path))
+         f(partition.apps.try_emplace(global::watchedApps[static_cast<size_t>(global::watchedAppsByPattern[patternId])], global::maxNames).first->second);
+   }
+}
+
+void endImage(CapturePartition& partition, uint64_t token, uint64_t time, WatchedApp app, bool exited)
+{
+   if (auto image = partition.running.find(token); image != partition.running.end())
+   {
+      partition.lifetimes[static_cast<size_t>(image->second.app)].record(time - image->second.time);
+      partition.running.erase(image);
+   }
+   else if (app != noApp)
+   {
+      partition.endedWithoutStart.try_emplace(token, CapturedImage {time, app, exited});
+   }
+}
+
+/// the same as countEventMessages and countProcessMessages for a record of a capture file
+void countRecord(CapturePartition& partition, const Capture::RecordHeader& record, PathMatcher* matcher)
+{
+   partition.numRecords++;
+   const auto eventType = static_cast<es_event_type_t>(record.eventType);
+   const uint8_t source = Capture::sourceOf(record);
+   auto& eventCounts = partition.events[record.eventType];
+   // nothing is missing before the first record of a range, the ranges are stitched by mergePartition
+   auto [seqNumbers, _] = partition.seqNumbers.try_emplace(seqNumbersKey(record.eventType, source), CapturedSeqNumbers {record.seqNum, record.seqNum});
+   eventCounts.numMissingMessages += countMissing(seqNumbers->second.next, record.seqNum);
+   
+   if (!(record.flags & Capture::matchedFilter))
+   {
+      eventCounts.numFilteredMessages++;
+      return;
+   }
+   eventCounts.totalCount++;
+   if (global::watchedApps.empty())
+      return;
+   
+   const auto sourcePath = Capture::executablePath(record);
+   const auto sourceName = Filter::basename(sourcePath);
+   const uint64_t token = processToken(record.pid, record.pidVersion, source);
+   switch (eventType)
+   {
+      case ES_EVENT_TYPE_NOTIFY_EXEC:
+      {
+         const auto targetPath = Capture::filePath(record);
+         const auto targetName = Filter::basename(targetPath);
+         forEachCapturedApp(partition, targetPath, matcher, [&](AppEventCounts& appEventCounts) {
+            appEventCounts.numExecTargetEvents++;
+            appEventCounts.parentExecs.byName.add(sourceName, 1);
+         });
+         forEachCapturedApp(partition, sourcePath, matcher, [&](AppEventCounts& appEventCounts) {
+            appEventCounts.numExecSourceEvents++;
+            appEventCounts.sourceExecs.byName.add(targetName, 1);
+         });
+         // the exec ends the image of the source and starts the one of the target
+         endImage(partition, token, record.time, watchedAppOfPath(sourcePath, matcher), false);
+         if (const WatchedApp app = watchedAppOfPath(targetPath, matcher); app != noApp)
+            partition.running[processToken(record.relatedPid, record.relatedPidVersion, source)] = {record.time, app};
+         break;
+      }
+      case ES_EVENT_TYPE_NOTIFY_EXIT:
+         forEachCapturedApp(partition, sourcePath, matcher, [](AppEventCounts& appEventCounts) {
+            appEventCounts.numExitEvents++;
+         });
+         endImage(partition, token, record.time, watchedAppOfPath(sourcePath, matcher), true);
+         break;
+      case ES_EVENT_TYPE_NOTIFY_FORK:
+         forEachCapturedApp(partition, sourcePath, matcher, [](AppEventCounts& appEventCounts) {
+            appEventCounts.numForkEvents++;
+         });
+         break;
+      default:
+         break;
+   }
+}
+
+/// Merges the partition of the following range of blocks into the partition.
+void mergePartition(CapturePartition& partition, CapturePartition& next)
+{
+   for (auto& [eventType, nextCounts] : next.events)
+   {
+      auto& eventCounts = partition.events[eventType];
+      eventCounts.totalCount += nextCounts.totalCount;
+      eventCounts.numMissingMessages += nextCounts.numMissingMessages;
+      eventCounts.numFilteredMessages += nextCounts.numFilteredMessages;
+   }
+   for (const auto& [key, nextSeqNumbers] : next.seqNumbers)
+   {
+      auto [seqNumbers, inserted] = partition.seqNumbers.try_emplace(key, nextSeqNumbers);
+      if (inserted)
+         continue;
+      if (const uint64_t numMissing = countMissing(seqNumbers->second.next, nextSeqNumbers.first); numMissing > 0)
+         partition.events[static_cast<uint16_t>(key)].numMissingMessages += numMissing;
+      seqNumbers->second.next = std::max(seqNumbers->second.next, nextSeqNumbers.next);
+   }
+   
+   for (auto& [appName, nextCounts] : next.apps)
+   {
+      auto& appEventCounts = partition.apps.try_emplace(appName, global::maxNames).first->second;
+      appEventCounts.numExecSourceEvents += nextCounts.numExecSourceEvents;
+      appEventCounts.numExecTargetEvents += nextCounts.numExecTargetEvents;
+      appEventCounts.numExitEvents += nextCounts.numExitEvents;
+      appEventCounts.numForkEvents += nextCounts.numForkEvents;
+      appEventCounts.sourceExecs.merge(nextCounts.sourceExecs);
+      appEventCounts.parentExecs.merge(nextCounts.parentExecs);
+   }
+   
+   // images still running at the end of the range which ended in the following one
+   for (const auto& [token, end] : next.endedWithoutStart)
+   {
+      if (auto image = partition.running.find(token); image != partition.running.end())
+      {
+         partition.lifetimes[static_cast<size_t>(image->second.app)].record(end.time - image->second.time);
+         partition.running.erase(image);
+      }
+      else
+      {
+         partition.endedWithoutStart.insert({token, end});
+      }
+   }
+   partition.running.merge(next.running);
+   for (size_t app = 0; app < partition.lifetimes.size(); ++app)
+      partition.lifetimes[app].merge(next.lifetimes[app]);
+   partition.numRecords += next.numRecords;
+   partition.numDamagedBlocks += next.numDamagedBlocks;
+}
+
+/// Counts the records of the selected blocks. Contiguous ranges of blocks are counted in parallel and the partial
+/// results are merged pairwise, neighbours first, so each merge stitches two adjacent ranges.
+CapturePartition countCapture(const CaptureReader& reader, const std::vector<size_t>& selected, const CaptureFilter& filter, WorkStealingPool& pool)
+{
+   // more ranges than threads, so threads which are done early can steal ranges of the others
+   const size_t numPartitions = std::max<size_t>(1, std::min(selected.size(), pool.size() * 4));
+   std::vector<CapturePartition> partitions(numPartitions);
+   std::vector<std::function<void()>> tasks {};
+   for (size_t p = 0; p < numPartitions; ++p)
+   {
+      tasks.emplace_back([&, p] {
+         auto& partition = partitions[p];
+         partition.lifetimes.resize(global::watchedApps.size());
+         // the matcher caches states while matching, so every range gets its own
+         std::optional<PathMatcher> matcher {global::pathMatcher};
+         for (size_t i = p * selected.size() / numPartitions; i < (p + 1) * selected.size() / numPartitions; ++i)
+         {
+            if (!reader.forEachRecord(selected[i], filter, [&](const Capture::RecordHeader& record) {
+                   countRecord(partition, record, matcher ? &*matcher : nullptr);
+                }))
+               partition.numDamagedBlocks++;
+            reader.release(selected[i]);
+         }
+      });
+   }
+   pool.run(tasks);
+   
+   for (size_t stride = 1; stride < numPartitions; stride *= 2)
+   {
+      tasks.clear();
+      for (size_t p = 0; p + stride < numPartitions; p += 2 * stride)
+         tasks.emplace_back([&, p, stride] { mergePartition(partitions[p], partitions[p + stride]); });
+      pool.run(tasks);
+   }
+   return std::move(partitions.front());
+}
+
+/// Counts the selected records with 1, 2, 4, ... up to maxThreads threads and prints the throughput of each.
+void benchmarkAnalyze(const CaptureReader& reader, const std::vector<size_t>& selected, const CaptureFilter& filter, size_t maxThreads)
+{
+   std::vector<size_t> threadCounts {};
+   for (size_t numThreads = 1; numThreads < maxThreads; numThreads *= 2)
+      threadCounts.push_back(numThreads);
+   threadCounts.push_back(maxThreads);
+   
+   // the first run maps the blocks into the page cache
+   WorkStealingPool warmUpPool {maxThreads};
+   const uint64_t numRecords = countCapture(reader, selected, filter, warmUpPool).numRecords;
+   double singleThreadNanoseconds {0};
+   for (const size_t numThreads : threadCounts)
+   {
+      WorkStealingPool pool {numThreads};
+      const double nanoseconds = Benchmark::nanosecondsPer(numRecords, [&] { countCapture(reader, selected, filter, pool); });
+      if (numThreads == 1)
+         singleThreadNanoseconds = nanoseconds;
+      std::cout << "⏱ " << numThreads << (numThreads == 1 ? " thread: " : " threads: ") << std::fixed << std::setprecision(1) << nanoseconds
+         << " ns per record, " << std::setprecision(2) << 1e3 / nanoseconds << " M records/s, speedup " << singleThreadNanoseconds / nanoseconds << "\n";
+   }
+}
+
+/// Prints the statistics of the records of a capture file selected by the filter, like sigHandler does for the live messages.
+/// Only the blocks whose index entry overlaps the filter are read. With benchmark, the counting is only timed for an
+/// increasing number of threads.
+int analyzeCapture(const std::string& path, const CaptureFilter& filter, size_t numThreads, bool benchmark)
+{
+   const CaptureReader reader {path};
+   if (!reader.valid())
+   {
+      std::cerr << "Couldn't read capture " << path << ": " << reader.error() << "\n";
+      return 2;
+   }
+   
+   const auto selected = reader.select(filter);
+   if (benchmark)
+   {
+      benchmarkAnalyze(reader, selected, filter, numThreads);
+      return 0;
+   }
+   WorkStealingPool pool {numThreads};
+   auto result = countCapture(reader, selected, filter, pool);
+   
+   const auto& header = reader.header();
+   std::cout << "📼 " << path << " (" << header.reason.data() << "): " << header.numRecords << " records in " << reader.blocks().size() << " blocks";
+   if (header.numSources > 1)
+      std::cout << " from " << header.numSources << " recordings";
+   std::cout << ", " << header.numOverwritten << " older records were overwritten before the capture\n";
+   std::cout << "📦 " << result.numRecords << " records selected from " << selected.size() << " blocks read by " << pool.size() << " threads\n";
+   if (result.numDamagedBlocks > 0)
+      std::cout << "⚠️ " << result.numDamagedBlocks << " damaged blocks were skipped\n";
+   
+   if (header.flags & Capture::selectedRecords)
+   {
+      // the gaps are mostly messages which were not selected, not messages which ES dropped
+      std::cout << "📼 only messages selected with --record-apps or --record-path were recorded, missing messages are not counted\n";
+      for (auto& [_, eventCounts] : result.events)
+         eventCounts.numMissingMessages = 0;
+   }
    
-   scoped_lock lock {global::appStatisticsMutex};
-   size_t longestChildNameLength {0};
-   if (global::printChildProcessFlag)
+   global::cumulativeStatistics = true;
+   for (auto& [eventType, eventCounts] : result.events)
+      global::eventStatistics.emplace(capturedEventName(eventType), std::move(eventCounts));
+   if (!global::apps.empty())
    {
-      for (const auto& [app, appStats] : global::appStatistics)
+      for (auto& [appName, appEventCounts] : result.apps)
+         global::appStatistics.try_emplace(appName, global::maxNames).first->second = std::move(appEventCounts);
+      std::cout << "\n";
+      printStatisticsByExecutable();
+      
+      std::vector<uint64_t> numRunning(global::watchedApps.size(), 0);
+      std::vector<uint64_t> numEndedWithoutStart(global::watchedApps.size(), 0);
+      for (const auto& [_, image] : result.running)
+         numRunning[static_cast<size_t>(image.app)]++;
+      // images started by a fork end with an exec all the time, only exits without start are of interest
+      for (const auto& [_, image] : result.endedWithoutStart)
+         numEndedWithoutStart[static_cast<size_t>(image.app)] += image.exited;
+      for (size_t app = 0; app < global::watchedApps.size(); ++app)
       {
-         if (!appStats.sourceExecs.empty())
-            longestChildNameLength = std::max(longestChildNameLength, std::max_element(appStats.sourceExecs.begin(), appStats.sourceExecs.end(), getLongestStringKey)->first.length());
+         const auto& lifetimes = result.lifetimes[app];
+         std::cout << "⏳ " << global::watchedApps[app] << ": " << lifetimes.numValues() << " lifetimes";
+         if (lifetimes.numValues() > 0)
+            std::cout << " p50 " << formatDuration(lifetimes.percentile(0.5)) << " p99 " << formatDuration(lifetimes.percentile(0.99))
+               << " max " << formatDuration(lifetimes.maximum());
+         std::cout << ", " << numRunning[app] << " still running at the end, " << numEndedWithoutStart[app] << " exits without exec\n";
       }
-      longestChildNameLength += 2; // account for formatting with --
    }
+   std::cout << "\n";
+   printStatisticsByEventType();
    
-   size_t longestParentNameLength {0};
-   if (global::printParentProcessFlag)
+   if (global::eventStore)
    {
-      for (const auto& [app, appStats] : global::appStatistics)
+      // the store is filled in record order, so its chunks cover consecutive time ranges like those of a live session
+      auto& store = *global::eventStore;
+      for (const auto block : selected)
       {
-         if (!appStats.parentExecs.empty())
-            longestParentNameLength = std::max(longestParentNameLength, std::max_element(appStats.parentExecs.begin(), appStats.parentExecs.end(), getLongestStringKey)->first.length());
+         reader.forEachRecord(block, filter, [&store](const Capture::RecordHeader& record) {
+            if (!(record.flags & Capture::matchedFilter))
+               return;
+            const auto target = record.eventType == ES_EVENT_TYPE_NOTIFY_EXEC ? store.intern(Capture::filePath(record)) : EventStore::noPath;
+            store.append(record.time, record.eventType, store.intern(Capture::executablePath(record)), target, record.pid, record.ppid);
+         });
+         reader.release(block);
       }
-      longestParentNameLength += 2; // account for formatting with --
+      std::cout << "\n";
+      printQueries();
    }
-   
-   vector<size_t> longestLengths {longestAppNameLength, longestChildNameLength, longestParentNameLength, headers[0].length()};
-   maxColumnWidth_c1 = *std::max_element(longestLengths.begin(), longestLengths.end());
-   
-   unordered_map<string, size_t> maxColumnWidths {};
-   for (const auto& header : headers)
+   return 0;
+}
+
+/// the event type names as JSON strings, by event type
+const std::vector<std::string>& jsonEventNames()
+{
+   static const std::vector<std::string> names = [] {
+      std::vector<std::string> names(Capture::maxEventTypes);
+      for (size_t eventType = 0; eventType < names.size(); ++eventType)
+         names[eventType] = "\"" + capturedEventName(static_cast<uint16_t>(eventType)) + "\"";
+      return names;
+   }();
+   return names;
+}
+
+/// appends a record of a capture as a line of JSON
+void appendRecordJson(Json::Buffer& out, const Capture::RecordHeader& record)
+{
+   out.append("{\"time_ns\":");
+   out.appendNumber(record.time);
+   out.append(",\"event\":");
+   static const auto& eventNames = jsonEventNames();
+   out.append(record.eventType < Capture::maxEventTypes ? std::string_view {eventNames[record.eventType]} : std::string_view {"null"});
+   out.append(",\"seq_num\":");
+   out.appendNumber(record.seqNum);
+   out.append(",\"pid\":");
+   out.appendNumber(record.pid);
+   out.append(",\"pid_version\":");
+   out.appendNumber(record.pidVersion);
+   out.append(",\"ppid\":");
+   out.appendNumber(record.ppid);
+   out.append(",\"uid\":");
+   out.appendNumber(record.uid);
+   out.append(",\"executable\":");
+   out.appendString(Capture::executablePath(record));
+   out.append(",\"file\":");
+   out.appendString(Capture::filePath(record));
+   out.append(",\"related_pid\":");
+   out.appendNumber(record.relatedPid);
+   out.append(",\"related_pid_version\":");
+   out.appendNumber(record.relatedPidVersion);
+   out.append(",\"status\":");
+   out.appendNumber(record.status);
+   out.append(",\"source\":");
+   out.appendNumber(Capture::sourceOf(record));
+   out.append(record.flags & Capture::matchedFilter ? ",\"matched_filter\":true}\n" : ",\"matched_filter\":false}\n");
+}
+
+/// the same as appendRecordJson with iostreams, only used to compare with it
+void writeRecordJson(std::ostream& out, const Capture::RecordHeader& record)
+{
+   auto writeString = [&out](std::string_view text) {
+      out << '"';
+      for (const char c : text)
+      {
+         if (c == '"' || c == '\\')
+            out << '\\' << c;
+         else if (static_cast<unsigned char>(c) < 0x20)
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec << std::setfill(' ');
+         else
+            out << c;
+      }
+      out << '"';
+   };
+   out << "{\"time_ns\":" << record.time << ",\"event\":\"" << capturedEventName(record.eventType) << "\",\"seq_num\":" << record.seqNum
+      << ",\"pid\":" << record.pid << ",\"pid_version\":" << record.pidVersion << ",\"ppid\":" << record.ppid << ",\"uid\":" << record.uid
+      << ",\"executable\":";
+   writeString(Capture::executablePath(record));
+   out << ",\"file\":";
+   writeString(Capture::filePath(record));
+   out << ",\"related_pid\":" << record.relatedPid << ",\"related_pid_version\":" << record.relatedPidVersion << ",\"status\":" << record.status
+      << ",\"source\":" << static_cast<int>(Capture::sourceOf(record)) << ",\"matched_filter\":" << ((record.flags & Capture::matchedFilter) ? "true" : "false")
+      << "}\n";
+}
+
+/// Writes the records of a capture selected by the filter as newline delimited JSON, to stdout if no output is given.
+/// With benchmark the records are written to /dev/null instead, once with the JSON buffer and once with iostreams.
+int exportCapture(const std::string& path, const std::string& outputPath, const CaptureFilter& filter, bool benchmark)
+{
+   const CaptureReader reader {path};
+   if (!reader.valid())
    {
-      if (header == executableColumn)
-         maxColumnWidths[header] = maxColumnWidth_c1;
-      else
-         maxColumnWidths[header] = header.length();
+      std::cerr << "Couldn't read capture " << path << ": " << reader.error() << "\n";
+      return 2;
    }
-   
-   // create and print separator
-   string separator {"+"};
-   for (const auto& header : headers)
+   const std::string target = benchmark ? "/dev/null" : outputPath;
+   const int fd = target.empty() ? STDOUT_FILENO : open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if (fd < 0)
    {
-      separator += string(maxColumnWidths.at(header) + 2, '-');
-      separator += "+";
+      std::cerr << "Couldn't open " << target << ": " << strerror(errno) << "\n";
+      return 2;
    }
-   
-   printHeader(separator, headers, maxColumnWidths);
-   
-   // gather and print statistics lines
-   int colorIdx = 0;
-   for (auto& [appName, appEventCounts] : global::appStatistics)
+
+   // batches of blocks are decoded in parallel, their records are written in order by this thread
+   const auto selected = reader.select(filter);
+   WorkStealingPool pool {std::max(1u, std::thread::hardware_concurrency())};
+   struct DecodedBlock
    {
-      int delta = appEventCounts.numExecTargetEvents
-                  + appEventCounts.numForkEvents
-                  - appEventCounts.numExecSourceEvents
-                  - appEventCounts.numExitEvents;
-      
-      colorIdx %= groupColors.size();
-      cout << "| " << left << ((global::printChildProcessFlag || global::printParentProcessFlag) ? groupColors[colorIdx] : "") << std::setw(static_cast<int>(maxColumnWidths[executableColumn])) << appName << RESET
-         << " | " << std::setw(static_cast<int>(maxColumnWidths[execSourceColumn])) << right << appEventCounts.numExecSourceEvents
-         << " | " << std::setw(static_cast<int>(maxColumnWidths[execTargetColumn])) << appEventCounts.numExecTargetEvents
-         << " | " << std::setw(static_cast<int>(maxColumnWidths[forkColumn])) << appEventCounts.numForkEvents
-         << " | " << std::setw(static_cast<int>(maxColumnWidths[exitColumn])) << appEventCounts.numExitEvents
-         << " | " << (delta != 0 ? RED : GREEN) << setw(static_cast<int>(maxColumnWidths[deltaColumn])) << delta << RESET
-         << " | " << (delta != 0 ? "❌" : "✅") << "\n";
-      cout << separator << "\n";
-      
-      if (global::printChildProcessFlag)
+      std::vector<std::byte> scratch {};
+      std::vector<std::byte> buffer {};
+      std::optional<std::span<const std::byte>> records {};
+   };
+   std::vector<DecodedBlock> batch(pool.size() * 2);
+   std::vector<std::function<void()>> tasks {};
+   uint64_t numDamagedBlocks {0};
+   auto forEachSelectedRecord = [&](auto&& f) {
+      numDamagedBlocks = 0;
+      for (size_t first = 0; first < selected.size(); first += batch.size())
       {
-         // the source execs of the observed app are listed in their own target exec column
-         for (auto& [sourceExecApp, sourceExecAppCount] : appEventCounts.sourceExecs)
+         const size_t count = std::min(batch.size(), selected.size() - first);
+         tasks.clear();
+         for (size_t i = 0; i < count; ++i)
          {
-            cout << "| " << left << subGroupColors[colorIdx] << std::setw(static_cast<int>(maxColumnWidths[executableColumn])) << "--" + sourceExecApp << RESET
-               << " | " << std::setw(static_cast<int>(maxColumnWidths[execSourceColumn])) << right << "-"
-               << " | " << std::setw(static_cast<int>(maxColumnWidths[execTargetColumn])) << sourceExecAppCount
-               << " | " << std::setw(static_cast<int>(maxColumnWidths[forkColumn])) << "-"
-               << " | " << std::setw(static_cast<int>(maxColumnWidths[exitColumn])) << "-"
-               << " | " << setw(static_cast<int>(maxColumnWidths[deltaColumn])) << "-"
-               << " | " << "🐣" <<"\n";
-            cout << separator << "\n";
+            tasks.emplace_back([&, i] {
+               auto& block = batch[i];
+               block.records = reader.recordsOf(selected[first + i], block.scratch, block.buffer);
+            });
          }
-      }
-      
-      if (global::printParentProcessFlag)
-      {
-         for (auto& [parentApp, parentExecAppCount] : appEventCounts.parentExecs)
+         pool.run(tasks);
+         for (size_t i = 0; i < count; ++i)
          {
-            cout << "| " << left << subGroupColors[colorIdx] << std::setw(static_cast<int>(maxColumnWidths[executableColumn])) << "--" + parentApp << RESET
-               << " | " << std::setw(static_cast<int>(maxColumnWidths[execSourceColumn])) << right << parentExecAppCount
-               << " | " << std::setw(static_cast<int>(maxColumnWidths[execTargetColumn])) << "-"
-               << " | " << std::setw(static_cast<int>(maxColumnWidths[forkColumn])) << "-"
-               << " | " << std::setw(static_cast<int>(maxColumnWidths[exitColumn])) << "-"
-               << " | " << setw(static_cast<int>(maxColumnWidths[deltaColumn])) << "-"
-               << " | " << "👨‍👩‍👦" <<"\n";
-            cout << separator << "\n";
+            if (!batch[i].records || !CaptureReader::forEachRecord(*batch[i].records, filter, f))
+               numDamagedBlocks++;
+            reader.release(selected[first + i]);
          }
       }
-      
-      if (!global::cumulativeStatistics)
-      {
-         // clean up between intervals
-         appEventCounts.sourceExecs.clear();
-         appEventCounts.parentExecs.clear();
-         appEventCounts.numExecSourceEvents = 0;
-         appEventCounts.numExecTargetEvents = 0;
-         appEventCounts.numForkEvents = 0;
-         appEventCounts.numExitEvents = 0;
-      }
-         
-      colorIdx++;
+   };
+   const auto start = std::chrono::steady_clock::now();
+   Json::Buffer out {fd};
+   forEachSelectedRecord([&out](const Capture::RecordHeader& record) { appendRecordJson(out, record); });
+   const bool written = out.flush();
+   const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   if (fd != STDOUT_FILENO)
+      close(fd);
+   if (!written)
+   {
+      std::cerr << "Couldn't write " << (target.empty() ? "stdout" : target) << ": " << strerror(errno) << "\n";
+      return 2;
    }
+   if (numDamagedBlocks > 0)
+      std::cerr << numDamagedBlocks << " damaged blocks of " << path << " were skipped\n";
+   if (!benchmark)
+      return 0;
+
+   std::ofstream stream {"/dev/null"};
+   const auto streamStart = std::chrono::steady_clock::now();
+   forEachSelectedRecord([&stream](const Capture::RecordHeader& record) { writeRecordJson(stream, record); });
+   stream.flush();
+   const double streamSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - streamStart).count();
+   const double megabytes = static_cast<double>(out.size()) / 1e6;
+   std::cout << "⏱ " << std::fixed << std::setprecision(1) << megabytes << " MB of JSON: " << megabytes / seconds << " MB/s, "
+      << megabytes / streamSeconds << " MB/s with iostreams\n";
+   return 0;
 }
 
-size_t getMaximumEventColumnWidth(const std::string& header, const std::vector<es_event_type_t>& values)
+/// Measures the per-message cost of filters on generated messages or messages of the executables listed in pathsFile.
+int runBenchmarks(const std::string& filterText, const std::string& pathsFile)
 {
-   // combine column header and row values
-   std::vector<std::string> columnValues {values.size() + 1};
-   columnValues[0] = header;
-   std::transform(values.begin(), values.end(), columnValues.begin() + 1, [](es_event_type_t eventType) {
-      return ESEventTypes::event2name.at(eventType);
+   const auto paths = pathsFile.empty() ? Benchmark::generatePaths(4096) : Benchmark::readPaths(pathsFile);
+   if (paths.empty())
+   {
+      std::cerr << "No paths in " << pathsFile << "\n";
+      return 2;
+   }
+   const Benchmark::Messages messages {paths};
+   std::cout << "⏱ " << messages.all().size() << " messages of " << paths.size() << " executables"
+      << (pathsFile.empty() ? " of generated paths" : " of " + pathsFile) << "\n";
+
+   std::vector<std::pair<std::string, std::string>> filters {};
+   for (const size_t numClauses : {1, 4, 12, 24, 48})
+      filters.emplace_back(std::to_string(numClauses) + (numClauses == 1 ? " clause" : " clauses"), Benchmark::filterWithClauses(numClauses));
+   // the same numbers of clauses mixing &&, ! and ranges, which can't be joined into set lookups
+   for (const size_t numClauses : {4, 12, 24, 48})
+      filters.emplace_back(std::to_string(numClauses) + " mixed clauses", Benchmark::filterWithMixedClauses(numClauses));
+   if (!filterText.empty())
+      filters.emplace_back("--filter", filterText);
+   for (const auto& [name, text] : filters)
+   {
+      std::optional<Filter::Program> filter {};
+      try
+      {
+         filter = Filter::Program::compile(text);
+      }
+      catch (const std::invalid_argument& error)
+      {
+         std::cerr << "Invalid filter: " << error.what() << "\n";
+         return 2;
+      }
+      uint64_t numMatches {0};
+      const double nanoseconds = Benchmark::nanosecondsPer(messages.all().size(), [&filter, &messages, &numMatches] {
+         for (const auto& message : messages.all())
+            numMatches += filter->matches(&message);
+      });
+      std::cout << "⏱ filter with " << name << " (" << filter->numInstructions() << " instructions): " << std::fixed << std::setprecision(1)
+         << nanoseconds << " ns per message" << (numMatches > 0 ? "" : ", no message matched") << "\n";
+   }
+
+   // one automaton for all -a patterns against the patterns tried one after the other
+   for (const size_t numPatterns : {10, 100, 1000})
+   {
+      const auto patterns = Benchmark::generatePatterns(numPatterns);
+      PathMatcher matcher {patterns};
+      uint64_t numMatches {0};
+      const double nanoseconds = Benchmark::nanosecondsPer(paths.size(), [&matcher, &paths, &numMatches] {
+         for (const auto& path : paths)
+            numMatches += matcher.match(path).size();
+      });
+      std::vector<PathMatcher> matchers {};
+      for (const auto& pattern : patterns)
+         matchers.emplace_back(std::vector {pattern});
+      uint64_t numMatchesEach {0};
+      const double nanosecondsEach = Benchmark::nanosecondsPer(paths.size(), [&matchers, &paths, &numMatchesEach] {
+         for (const auto& path : paths)
+         {
+            for (auto& each : matchers)
+               numMatchesEach += each.matches(path);
+         }
+      });
+      std::cout << "⏱ " << numPatterns << " path patterns: " << nanoseconds << " ns per path in one automaton of " << matcher.numCachedStates()
+         << " states, " << nanosecondsEach << " ns one pattern after the other" << (numMatches > 0 ? "" : ", no path matched") << "\n";
+   }
+
+   // the maps keyed by executable name, std::unordered_map needs a std::string to look up a name
+   size_t numNames {0};
+   const double nanosecondsFlatInsert = Benchmark::nanosecondsPer(paths.size(), [&paths, &numNames] {
+      FlatHashMap<std::string, uint64_t> counts {};
+      for (const auto& path : paths)
+         counts[Filter::basename(path)]++;
+      numNames = counts.size();
    });
-   
-   auto maxElem = std::max_element(columnValues.begin(), columnValues.end(), [](const auto& a, const auto& b) {
-      return a.length() < b.length();
+   const double nanosecondsStdInsert = Benchmark::nanosecondsPer(paths.size(), [&paths] {
+      std::unordered_map<std::string, uint64_t> counts {};
+      for (const auto& path : paths)
+         counts[std::string {Filter::basename(path)}]++;
    });
-   return maxElem->length();
+   std::cout << "⏱ counting the names of " << paths.size() << " executables (" << numNames << " distinct): " << nanosecondsFlatInsert
+      << " ns per name in FlatHashMap, " << nanosecondsStdInsert << " ns in std::unordered_map\n";
+
+   // every other watched app is one of the executables
+   FlatHashMap<std::string, uint32_t> watchedApps {};
+   std::unordered_map<std::string, uint32_t> stdWatchedApps {};
+   for (uint32_t i = 0; i < 300; ++i)
+   {
+      const std::string name = i % 2 == 0 ? std::string {Filter::basename(paths[i * 7 % paths.size()])} : "missing" + std::to_string(i);
+      watchedApps.emplace(name, i);
+      stdWatchedApps.emplace(name, i);
+   }
+   uint64_t numFound {0};
+   const double nanosecondsFlatFind = Benchmark::nanosecondsPer(paths.size(), [&paths, &watchedApps, &numFound] {
+      for (const auto& path : paths)
+         numFound += watchedApps.contains(Filter::basename(path));
+   });
+   const double nanosecondsStdFind = Benchmark::nanosecondsPer(paths.size(), [&paths, &stdWatchedApps, &numFound] {
+      for (const auto& path : paths)
+         numFound += stdWatchedApps.contains(std::string {Filter::basename(path)});
+   });
+   std::cout << "⏱ looking up " << watchedApps.size() << " watched apps: " << nanosecondsFlatFind << " ns per path in FlatHashMap, "
+      << nanosecondsStdFind << " ns in std::unordered_map" << (numFound > 0 ? "" : ", no app found") << "\n";
+   return 0;
 }
 
-void printStatisticsByEventType()
+/// Merges the records of the captures selected by the filter into a new capture ordered by message time.
+int mergeCaptures(const std::vector<std::string>& paths, const std::string& outputPath, const CaptureFilter& filter, Capture::Compressor compressor)
 {
-   constexpr size_t numColumns = 3;
-   using namespace std;
-   
-   string eventTypeColumn = "ES_event_type";
-   string messagesReceivedColumn = "#messages_received";
-   string messagesMissingColumn = "#messages_missing";
-   
-   const array<string, numColumns> headers = {
-      eventTypeColumn,
-      messagesReceivedColumn,
-      messagesMissingColumn
-   };
-   static auto maxColumnWidth_c1 = getMaximumEventColumnWidth(headers[0], global::events2subscribe2);
-   
-   static const unordered_map<string, size_t> maxColumnWidths {
-      {eventTypeColumn, maxColumnWidth_c1},
-      {messagesReceivedColumn, headers[1].length()},
-      {messagesMissingColumn, headers[2].length()}
-   };
-   
-   string separator {"+"};
-   for (const auto& header : headers)
+   std::error_code error {};
+   for (const auto& path : paths)
    {
-      separator += string(maxColumnWidths.at(header) + 2, '-');
-      separator += "+";
+      // the inputs are mapped while the output is written
+      if (std::filesystem::equivalent(path, outputPath, error))
+      {
+         std::cerr << "The merged capture " << outputPath << " can't be one of the captures to merge\n";
+         return 2;
+      }
    }
-
-   printHeader(separator, headers, maxColumnWidths);
-   
-   uint64_t totalReceivedMessages {0};
-   uint64_t totalMissedMessages {0};
-   
-   scoped_lock lock {global::eventStatisticsMutex};
-   for (auto& [eventName, eventCounts] : global::eventStatistics)
+   CaptureMerger merger {};
+   for (const auto& path : paths)
    {
-      totalReceivedMessages += eventCounts.totalCount;
-      totalMissedMessages += eventCounts.numMissingMessages;
-      
-      std::cout << "| " << left << std::setw(static_cast<int>(maxColumnWidths.at(eventTypeColumn))) << eventName
-               << " | " << std::setw(static_cast<int>(maxColumnWidths.at(messagesReceivedColumn))) << right << eventCounts.totalCount
-               << " | " << (eventCounts.numMissingMessages != 0 ? RED : GREEN) << std::setw(static_cast<int>(maxColumnWidths.at(messagesMissingColumn))) << eventCounts.numMissingMessages << RESET
-               << " | " << (eventCounts.numMissingMessages != 0 ? "❌" : "✅") << "\n";
-      std::cout << separator << "\n";
-      
-      if (!global::cumulativeStatistics)
+      if (!merger.add(path))
       {
-         eventCounts.totalCount = 0;
-         eventCounts.numMissingMessages = 0;
+         std::cerr << "Couldn't read capture " << merger.error() << "\n";
+         return 2;
       }
    }
-   
-   std::cout << "| " << right << std::setw(static_cast<int>(maxColumnWidths.at(eventTypeColumn))) << "total:"
-            << " | " << std::setw(static_cast<int>(maxColumnWidths.at(messagesReceivedColumn))) << totalReceivedMessages
-            << " | " << (totalMissedMessages != 0 ? RED : GREEN) << std::setw(static_cast<int>(maxColumnWidths.at(messagesMissingColumn))) << totalMissedMessages << RESET
-            << " | " << (totalMissedMessages != 0 ? "❌" : "✅") << "\n";
-   std::cout << separator << "\n";
-   
-}
 
-
-/// Is called when the user presses ctrl + t to send SIGINFO
-void sigHandler()
-{
-   using namespace std;
-   using namespace std::chrono;
-   static int signalCounter {0};
-   signalCounter++;
-   
-   std::cout << "\n🚀 ES client statistics #" << signalCounter << ":" << "\n";
-   
-   if (!global::apps.empty())
-      printStatisticsByExecutable();
+   WorkStealingPool pool {std::max(1u, std::thread::hardware_concurrency())};
+   const auto start = std::chrono::steady_clock::now();
+   const auto merged = merger.merge(outputPath, filter, compressor, &pool);
+   const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   if (!merged)
+   {
+      std::cerr << "Couldn't write capture file " << outputPath << "\n";
+      return 2;
+   }
+   std::cout << "📼 " << merged->numRecords << " records of " << paths.size() << " captures merged into " << outputPath << " in " << std::fixed
+      << std::setprecision(3) << seconds << " seconds";
+   if (seconds > 0)
+      std::cout << ", " << static_cast<uint64_t>(static_cast<double>(merged->numRecords) / seconds) << " records/second";
+   if (merged->written.storedBytes > 0)
+      std::cout << ", compressed " << std::setprecision(1)
+         << static_cast<double>(merged->written.rawBytes) / static_cast<double>(merged->written.storedBytes) << ":1";
    std::cout << "\n";
-   printStatisticsByEventType();
-   
-   auto intervalEnd = steady_clock::now();
-   auto intervalDuration = intervalEnd - global::intervalStart;
+   if (merged->numDamagedBlocks > 0)
+      std::cout << "⚠️ " << merged->numDamagedBlocks << " damaged blocks were skipped\n";
+   return 0;
+}
 
-   std::cout << "⏱ interval duration: " << duration_cast<seconds>(intervalDuration).count() << " seconds\n";
-   global::intervalStart = steady_clock::now();
+/// Compiles the --query options and creates the event store for them, prints the first invalid query.
+bool compileQueries(const std::vector<std::string>& texts, size_t storeMegabytes)
+{
+   if (texts.empty())
+      return true;
+   for (const auto& text : texts)
+   {
+      try
+      {
+         global::queries.push_back(EventQuery::Query::compile(text, parseTime));
+      }
+      catch (const std::invalid_argument& error)
+      {
+         std::cerr << "Invalid query: " << error.what() << "\n";
+         return false;
+      }
+   }
+   global::eventStore.emplace(storeMegabytes * 1024 * 1024);
+   return true;
 }
 
 /// to format numbers seperated by thousands
@@ -446,9 +3262,12 @@ int main(int argc, char* argv[])
       "sudo ./esmat.app/Contents/MacOS/esmat -a ls git\n\n"
       "sudo ./esmat.app/Contents/MacOS/esmat -e NOTIFY_PTY_GRANT NOTIFY_PTY_CLOSE -a sshd\n\n"
       "sudo ./esmat.app/Contents/MacOS/esmat -a xpcproxy -pc\n\n"
+      "sudo ./esmat.app/Contents/MacOS/esmat -e NOTIFY_OPEN -- make -j8\n\n"
    };
-   app.add_option("-a,--apps", global::apps,
+   auto appsOption = app.add_option("-a,--apps", global::apps,
                   "Add executable names to watch events for. \n"
+                  "Arguments containing '/', '*' or '?' are glob patterns matched against the full executable path,\n"
+                  "e.g. '/Applications/Xcode.app/**' or '*clang*'. Patterns not starting with '/' match in any directory.\n"
                   "If one or more executable names are specified as arguments, \n"
                   "the event types NOTIFY_EXEC, NOTIFY_FORK and NOTIFY_EXIT are automatically enabled. \n"
                   );
@@ -468,10 +3287,209 @@ int main(int argc, char* argv[])
    app.add_flag("-c,--child", global::printChildProcessFlag,
                   "Include child processes which the via -a specified processes exec into.\n");
    
-   app.add_flag("-C,--cumulative", global::cumulativeStatistics,
+   app.add_option("--max-names", global::maxNames,
+                  "Maximum number of child and parent names kept per app for -c and -p (default: 32),\n"
+                  "the least frequent ones are merged into an 'other' row.\n")->check(CLI::Range(1, 100000));
+   
+   auto cumulativeFlag = app.add_flag("-C,--cumulative", global::cumulativeStatistics,
                 "If set statistics are never reset between intervals.");
+   app.add_flag("-r,--rates", global::printRates,
+                "Adds the rolling message rates of the last 1, 10 and 60 seconds and the busiest second of the interval\n"
+                "to the executable and event type tables.\n");
+   app.add_option("--bursts", global::burstResolutionMs,
+                  "Counts messages per event type in 1 or 10 millisecond buckets and reports the most messages\n"
+                  "in any 10 ms and 100 ms window of the interval together with a profile of the 10 ms windows.\n")->check(CLI::IsMember({1, 10}));
+   auto alertZOption = app.add_option("--alert-z", global::alertZ,
+                  "Keeps an exponentially weighted baseline of the messages per second of every event type and of the\n"
+                  "exec/fork/exit counters of every app, updated each second. Raises an alert when a rate reaches the\n"
+                  "given z-score against its baseline, alerts are listed in the next report.\n")->check(CLI::PositiveNumber);
+   app.add_option("--alert-ratio", global::alertRatio,
+                  "Only raise an alert if the rate is also at least the given factor above its baseline, e.g. 10.\n")->check(CLI::PositiveNumber)->needs(alertZOption);
+   double alertHalfLife {60};
+   app.add_option("--alert-half-life", alertHalfLife,
+                  "Seconds after which a rate only counts half in its baseline (default: 60).\n"
+                  "Baselines raise alerts once they are that many seconds old.\n")->check(CLI::Range(1.0, 86400.0))->needs(alertZOption);
+   std::string alertsPath {};
+   app.add_option("--alerts", alertsPath,
+                  "Also appends every alert with a UTC timestamp to the given file as soon as it is raised.\n")->needs(alertZOption);
+   app.add_flag("-B,--both", global::bothViews,
+                "Shows the message counts of the interval and since the start next to each other.\n")->excludes(cumulativeFlag);
    
-   CLI11_PARSE(app, argc, argv);
+   app.add_flag("-i,--identity", global::identityMode,
+                "Distinguishes executables by their file (device and inode) instead of by name.\n"
+                "Same-named binaries at different paths are shown in separate rows.\n");
+   
+   app.add_flag("-P,--processes", global::trackProcesses,
+                "Tracks every process from fork/exec to exit and lists the processes of the apps specified via -a\n"
+                "which were started but did not exit, as well as exits without an observed start.\n")->needs(appsOption);
+   app.add_flag("-t,--tree", global::treeMode,
+                "Every process forked or exec'ed by a process of an app specified via -a inherits the watch,\n"
+                "all messages of the whole process tree are counted for the app by event type.\n")->needs(appsOption);
+   app.add_flag("-l,--latencies", global::trackLatencies,
+                "Measures for the apps specified via -a how long it takes from the fork of a process to its exec\n"
+                "and how long a process lives after its exec, printed as p50/p99/max.\n")->needs(appsOption);
+   size_t maxProcesses {16384};
+   app.add_option("--max-processes", maxProcesses,
+                  "Maximum number of processes tracked with -P, -t or -l (default: 16384), the least recently active are evicted.\n")->check(CLI::Range(64, 10'000'000));
+   
+   app.add_option("--top", global::topK,
+                  "Lists the K executables which sent the most messages per event type, in fixed memory\n"
+                  "no matter how many distinct executables run. Works without -a.\n")->check(CLI::Range(1, 1000));
+   
+   app.add_flag("-d,--distinct", global::printDistinctCounts,
+                "Estimates per event type how many distinct executables, file paths and processes sent messages,\n"
+                "in constant memory per event type.\n");
+   app.add_option("--estimate", global::estimatedExecutables,
+                  "Estimates the number of messages per event type of the given executable names (paths with -i),\n"
+                  "no matter whether they are watched via -a.\n");
+   
+   std::string filterExpression {};
+   app.add_option("-f,--filter", filterExpression,
+                  "Only count messages matching the given filter expression, e.g.\n"
+                  "'exec.target.path =~ \"/usr/bin/*\" && process.uid == 501 && !(signing_id =~ \"com.apple.*\")'\n"
+                  "Fields: process.path, process.name, process.pid, process.ppid, process.uid,\n"
+                  "process.platform_binary, signing_id, team_id, exec.target.path, exec.target.name,\n"
+                  "exec.target.pid, event. Operators: == != =~ !~ (glob) < <= > >= && || ! ( ).\n"
+                  "In globs * does not match '/', ** matches anything and ? matches one character.\n");
+   
+   double sampleLagMs {0};
+   app.add_option("--sample-lag", sampleLagMs,
+                  "Enables adaptive sampling: if the delay between an event and its handling exceeds\n"
+                  "the given milliseconds, only every n-th NOTIFY_EXEC/FORK/EXIT message is evaluated\n"
+                  "for the per-app statistics, which are then reported as scaled estimates.\n"
+                  "Event type counters always stay exact.\n")->check(CLI::PositiveNumber);
+   app.add_option("--sample-rate", global::sampling.rate,
+                  "Evaluate 1 in n process messages while sampling is active (default: 10).\n")->check(CLI::Range(2, 1000000));
+   
+   const std::map<std::string, Capture::Compressor> compressorNames {{"none", Capture::Compressor::none},
+                                                                    {"lz4", Capture::Compressor::lz4},
+                                                                    {"lzfse", Capture::Compressor::lzfse},
+                                                                    {"zlib", Capture::Compressor::zlib}};
+   size_t recordMegabytes {0};
+   auto recordOption = app.add_option("--record", recordMegabytes,
+                  "Keeps the most recent messages in a ring of the given size in MB and writes them to a capture file\n"
+                  "when messages are missing, on ctrl + t and on SIGUSR1. Recording costs a copy per message.\n")->check(CLI::Range(1, 65536));
+   bool recordSuperpages {false};
+   app.add_flag("--record-superpages", recordSuperpages,
+                "Backs the ring with 2 MB superpages where available.\n")->needs(recordOption);
+   app.add_option("--record-dir", global::captureDirectory,
+                  "Directory of the capture files (default: current directory).\n")->check(CLI::ExistingDirectory)->needs(recordOption);
+   app.add_option("--record-max-gaps", global::maxGapCaptures,
+                  "Maximum number of capture files written because of missing messages (default: 10).\n")->needs(recordOption);
+   app.add_option("--record-compressor", global::captureCompressor,
+                  "Compresses the blocks of capture files with none, lz4, lzfse or zlib (default: lz4).\n"
+                  "Paths are always interned per block and numbers stored as deltas.\n")
+      ->transform(CLI::CheckedTransformer(compressorNames))
+      ->needs(recordOption);
+   std::vector<std::string> recordEventTypes {};
+   app.add_option("--record-events", recordEventTypes, "Only records messages of these of the observed event types.\n")->needs(recordOption);
+   bool recordApps {false};
+   app.add_flag("--record-apps", recordApps, "Only records messages of the processes of the apps given with -a and of execs into them.\n")
+      ->needs(recordOption)->needs(appsOption);
+   std::vector<std::string> recordPathPrefixes {};
+   app.add_option("--record-path", recordPathPrefixes,
+                  "Only records messages whose executable or file path starts with one of these prefixes,\n"
+                  "or which are of the apps with --record-apps.\n")->needs(recordOption);
+   
+   std::vector<std::string> groupByDimensions {};
+   auto groupByOption = app.add_option("--group-by", groupByDimensions,
+                  "Counts the messages which match the filter per combination of the values of the given dimensions and\n"
+                  "lists the groups with the most messages, e.g. --group-by event,exe,uid. Dimensions: event,\n"
+                  "exe (name, path with -i), target (of execs), uid, tty, pid, ppid.\n")->delimiter(',');
+   size_t groupByMax {65536};
+   app.add_option("--group-by-max", groupByMax,
+                  "Maximum number of groups (default: 65536), messages of further groups are only counted.\n")
+      ->check(CLI::Range(1, 100'000'000))->needs(groupByOption);
+   app.add_option("--group-by-rows", global::groupByRows, "Number of groups listed (default: 20).\n")
+      ->check(CLI::Range(1, 100000))->needs(groupByOption);
+   
+   std::vector<std::string> queryTexts {};
+   auto queryOption = app.add_option("--query", queryTexts,
+                  "Keeps the messages which match the filter in an in-memory column store and prints the result of the\n"
+                  "query on every report, can be given several times. Syntax:\n"
+                  "count [by field[, field]] [where field op value && ...] [top n], e.g.\n"
+                  "'count by process.name where event == \"NOTIFY_EXEC\" && time >= \"12:01\" top 5'.\n"
+                  "Fields: time, event, process.path, process.name, process.pid, process.ppid, exec.target.path,\n"
+                  "exec.target.name. Operators: == != =~ !~ (glob) < <= > >=, times in the format of analyze --from.\n");
+   size_t storeMegabytes {256};
+   app.add_option("--store", storeMegabytes,
+                  "Memory of the event store in MB, beyond it the oldest messages are dropped (default: 256).\n")
+      ->check(CLI::Range(1, 65536))->needs(queryOption);
+   
+   auto analyzeCommand = app.add_subcommand("analyze", "Prints the statistics of a capture file written with --record, using all cores.\n"
+                                                       "Does not need root.");
+   std::string capturePath {};
+   analyzeCommand->add_option("capture", capturePath, "The capture file")->required()->check(CLI::ExistingFile);
+   std::string fromTime {};
+   analyzeCommand->add_option("--from", fromTime,
+                              "Only messages from this time on, as UTC time like 2024-05-01T12:00:00Z, seconds since the epoch\n"
+                              "or local time of today like 12:00 or 12:00:30.\n");
+   std::string toTime {};
+   analyzeCommand->add_option("--to", toTime, "Only messages before this time, in the format of --from.\n");
+   std::vector<std::string> analyzedEventTypes {};
+   analyzeCommand->add_option("--events", analyzedEventTypes, "Only messages of these event types.\n");
+   analyzeCommand->add_option("-a,--apps", global::apps, "Executable names and patterns to print the executable table and process lifetimes for.\n");
+   analyzeCommand->add_flag("-p,--parent", global::printParentProcessFlag, "Shows which parent processes have exec'ed into the apps.\n");
+   analyzeCommand->add_flag("-c,--child", global::printChildProcessFlag, "Include child processes which the apps exec into.\n");
+   size_t analyzeThreads = std::max(1u, std::thread::hardware_concurrency());
+   analyzeCommand->add_option("--threads", analyzeThreads, "Number of threads (default: number of cores).\n")->check(CLI::Range(1, 1024));
+   bool analyzeBenchmark {false};
+   analyzeCommand->add_flag("--benchmark", analyzeBenchmark,
+                            "Only times the counting of the selected records with 1, 2, 4, ... up to --threads threads.\n");
+   auto analyzeQueryOption = analyzeCommand->add_option("--query", queryTexts, "Prints the result of the query on the selected messages, like --query.\n");
+   analyzeCommand->add_option("--store", storeMegabytes, "Memory of the event store in MB, like --store (default: 256).\n")
+      ->check(CLI::Range(1, 65536))->needs(analyzeQueryOption);
+   
+   auto mergeCommand = app.add_subcommand("merge", "Merges capture files, e.g. of several Macs, into one capture ordered by message time.\n"
+                                                   "Does not need root.");
+   std::vector<std::string> mergedPaths {};
+   mergeCommand->add_option("captures", mergedPaths, "The capture files")->required()->check(CLI::ExistingFile);
+   std::string mergeOutputPath {};
+   mergeCommand->add_option("-o,--output", mergeOutputPath, "The merged capture file")->required();
+   mergeCommand->add_option("--from", fromTime, "Only messages from this time on, in the format of analyze --from.\n");
+   mergeCommand->add_option("--to", toTime, "Only messages before this time, in the format of analyze --from.\n");
+   mergeCommand->add_option("--events", analyzedEventTypes, "Only messages of these event types.\n");
+   Capture::Compressor mergeCompressor {Capture::Compressor::lz4};
+   mergeCommand->add_option("--compressor", mergeCompressor, "Compressor of the merged blocks, like --record-compressor (default: lz4).\n")
+      ->transform(CLI::CheckedTransformer(compressorNames));
+   
+   auto exportCommand = app.add_subcommand("export", "Writes the records of a capture file as JSON, one object per line.\n"
+                                                     "Does not need root.");
+   exportCommand->add_option("capture", capturePath, "The capture file")->required()->check(CLI::ExistingFile);
+   std::string exportFormat {"ndjson"};
+   exportCommand->add_option("--format", exportFormat, "Output format, only ndjson (default: ndjson).\n")->check(CLI::IsMember({"ndjson"}));
+   std::string exportOutputPath {};
+   auto exportOutputOption = exportCommand->add_option("-o,--output", exportOutputPath, "The output file (default: stdout).\n");
+   exportCommand->add_option("--from", fromTime, "Only messages from this time on, in the format of analyze --from.\n");
+   exportCommand->add_option("--to", toTime, "Only messages before this time, in the format of analyze --from.\n");
+   exportCommand->add_option("--events", analyzedEventTypes, "Only messages of these event types.\n");
+   bool exportBenchmark {false};
+   exportCommand->add_flag("--benchmark", exportBenchmark,
+                           "Writes the JSON to /dev/null instead and compares the throughput with a plain iostream writer.\n")
+      ->excludes(exportOutputOption);
+
+   auto benchmarkCommand = app.add_subcommand("benchmark", "Measures the cost per message of filters, path patterns and maps on generated messages.\n"
+                                                           "Does not need root.");
+   std::string benchmarkFilter {};
+   benchmarkCommand->add_option("-f,--filter", benchmarkFilter, "Also measures this filter expression, see -f.\n");
+   std::string benchmarkPaths {};
+   benchmarkCommand->add_option("--paths", benchmarkPaths,
+                                "File with one executable path per line the messages are made of (default: generated paths),\n"
+                                "e.g. of find /Applications /usr /System/Library -perm +111 -type f.\n")
+      ->check(CLI::ExistingFile);
+
+   app.footer("esmat [OPTIONS] -- COMMAND [ARGUMENTS...]\n"
+              "   Starts the command, only counts the messages of its process tree and prints the statistics,\n"
+              "   wall time, messages/second and peak process concurrency once it and all of its descendants exited.\n"
+              "   esmat exits with the exit code of the command. Statistics are cumulative, ctrl + t shows the progress so far.\n");
+   
+   // the command is split off before parsing, so its arguments are never taken for options of esmat
+   const auto commandSeparator = std::find_if(argv + 1, argv + argc, [](const char* argument) { return std::string_view {argument} == "--"; });
+   std::vector<std::string> commandArguments {};
+   if (commandSeparator != argv + argc)
+      commandArguments.assign(commandSeparator + 1, argv + argc);
+   
+   CLI11_PARSE(app, static_cast<int>(commandSeparator - argv), argv);
    
    if (printAvailableEvents)
    {
@@ -484,25 +3502,99 @@ int main(int argc, char* argv[])
       }
       exit(0);
    }
-   
 
+   if (*benchmarkCommand)
+      return runBenchmarks(benchmarkFilter, benchmarkPaths);
+
+   if (*analyzeCommand || *mergeCommand || *exportCommand)
+   {
+      const auto filter = parseCaptureFilter(fromTime, toTime, analyzedEventTypes);
+      if (!filter)
+         return 2;
+      if (*exportCommand)
+         return exportCapture(capturePath, exportOutputPath, *filter, exportBenchmark);
+      std::cout.imbue(std::locale(std::cout.getloc(), new space_out));
+      if (*mergeCommand)
+         return mergeCaptures(mergedPaths, mergeOutputPath, *filter, mergeCompressor);
+      if (!compileQueries(queryTexts, storeMegabytes))
+         return 2;
+      watchApps();
+      return analyzeCapture(capturePath, *filter, analyzeThreads, analyzeBenchmark);
+   }
+   
    if (getuid() != 0)
    {
       std::cerr << "App must be run as root. Only root can subscribe to Endpoint Security." << std::endl;
       exit(3);
    }
    
-   // thousands separator
-   std::cout.imbue(std::locale(std::cout.getloc(), new space_out));
+   if (!filterExpression.empty())
+   {
+      try
+      {
+         global::filter = Filter::Program::compile(filterExpression);
+      }
+      catch (const std::invalid_argument& error)
+      {
+         std::cerr << "Invalid filter: " << error.what() << "\n";
+         return 2;
+      }
+   }
+   if (!compileQueries(queryTexts, storeMegabytes))
+      return 2;
+   if (!groupByDimensions.empty())
+   {
+      try
+      {
+         global::groupBy.emplace(GroupBy::parse(groupByDimensions), groupByMax);
+         global::groupByExecutableIds.resize(groupByDimensions.size());
+      }
+      catch (const std::invalid_argument& error)
+      {
+         std::cerr << "Invalid --group-by: " << error.what() << "\n";
+         return 2;
+      }
+   }
+   
+   if (!commandArguments.empty())
+   {
+      global::command.emplace();
+      global::cumulativeStatistics = true;
+   }
    
-   if (global::apps.size() > 0)
+   if (!alertsPath.empty())
+   {
+      global::alertsStream.open(alertsPath, std::ios::app);
+      if (!global::alertsStream)
+      {
+         std::cerr << "Couldn't open alerts file " << alertsPath << ": " << strerror(errno) << "\n";
+         return 2;
+      }
+   }
+   if (recordMegabytes > 0)
    {
-      // store executable names to monitor
-      for (const auto& appName : global::apps)
+      global::flightRecorder.emplace(recordMegabytes * 1024 * 1024, recordSuperpages);
+      if (!global::flightRecorder->valid())
       {
-         global::appStatistics.emplace(appName, AppEventCounts());
+         std::cerr << "Couldn't map " << recordMegabytes << " MB for the flight recorder: " << strerror(errno) << "\n";
+         return 2;
       }
+      if (recordSuperpages && !global::flightRecorder->usesSuperpages())
+         std::cout << "Superpages are not available, the flight recorder uses regular pages\n";
+      global::captureQueue = dispatch_queue_create("esmat.capture", DISPATCH_QUEUE_SERIAL);
+      // half of the cores, the other half keeps handling messages while a capture is written
+      global::encoderPool.emplace(std::max(1u, std::thread::hardware_concurrency() / 2));
    }
+   global::alertAlpha = EwmaBaseline::alphaForHalfLife(alertHalfLife);
+   global::alertWarmup = static_cast<uint32_t>(std::ceil(alertHalfLife));
+   
+   global::sampling.lagThresholdNs = static_cast<uint64_t>(sampleLagMs * 1'000'000);
+   mach_timebase_info(&global::sampling.timebase);
+   
+   // thousands separator
+   std::cout.imbue(std::locale(std::cout.getloc(), new space_out));
+   
+   watchApps();
    std::cout << "Press ctrl + t to get event statistics. Statistics will" << (global::cumulativeStatistics ? " NOT " : " ") <<  "be reset after each query" << "\n";
    
    es_client_t* client;
@@ -530,8 +3622,9 @@ int main(int argc, char* argv[])
    }
          
 
-   if (!global::apps.empty())
+   if (!global::apps.empty() || global::command)
    {
+      // also required by the process table
       global::events2subscribe2.push_back(ES_EVENT_TYPE_NOTIFY_EXEC);
       global::events2subscribe2.push_back(ES_EVENT_TYPE_NOTIFY_FORK);
       global::events2subscribe2.push_back(ES_EVENT_TYPE_NOTIFY_EXIT);
@@ -557,6 +3650,51 @@ int main(int argc, char* argv[])
       }
    }
    
+   if (!recordEventTypes.empty() || recordApps || !recordPathPrefixes.empty())
+   {
+      auto& selection = global::recordSelection.emplace();
+      selection.apps = recordApps;
+      selection.pathPrefixes = recordPathPrefixes;
+      for (const auto& eventName : recordEventTypes)
+      {
+         std::string eventNameUpper = eventName;
+         std::transform(eventNameUpper.begin(), eventNameUpper.end(), eventNameUpper.begin(), toupper);
+         const auto event = ESEventTypes::name2event.find(eventNameUpper);
+         if (event == ESEventTypes::name2event.end()
+             || std::find(global::events2subscribe2.begin(), global::events2subscribe2.end(), event->second) == global::events2subscribe2.end())
+         {
+            std::cerr << eventNameUpper << " is not an observed ES event type, add it with -e" << "\n";
+            return 2;
+         }
+         selection.eventTypes.resize(ES_EVENT_TYPE_LAST, false);
+         selection.eventTypes[event->second] = true;
+      }
+   }
+   
+   if (global::trackProcesses || global::treeMode || global::trackLatencies || global::command)
+   {
+      const auto maxEventType = *std::max_element(global::events2subscribe2.begin(), global::events2subscribe2.end());
+      global::processCounterIndex.resize(static_cast<size_t>(maxEventType) + 1, 0);
+      for (size_t i = 0; i < global::events2subscribe2.size(); ++i)
+      {
+         global::processCounterIndex[global::events2subscribe2[i]] = i;
+      }
+      global::processTable.emplace(maxProcesses, global::events2subscribe2.size());
+      global::treeEventCounts.assign(global::watchedApps.size(), std::vector<uint64_t>(global::events2subscribe2.size(), 0));
+      global::treeProcessCounts.assign(global::watchedApps.size(), 0);
+   }
+   
+   // the handler reads the sketches without locking, so they are created before subscribing
+   if (global::printDistinctCounts || !global::estimatedExecutables.empty())
+   {
+      global::eventSketches.resize(ES_EVENT_TYPE_LAST);
+      for (const auto& event : global::events2subscribe2)
+      {
+         if (!global::eventSketches[event])
+            global::eventSketches[event] = std::make_unique<EventSketches>();
+      }
+   }
+   
    // subscribe to ES
    es_event_type_t* events = global::events2subscribe2.data();
    auto count = static_cast<unsigned int>(global::events2subscribe2.size());
@@ -571,9 +3709,15 @@ int main(int argc, char* argv[])
    // set up event statistics
    {
       std::scoped_lock lock {global::eventStatisticsMutex};
+      global::eventStatistics.reserve(global::events2subscribe2.size());
       for (const auto& event : global::events2subscribe2)
       {
-         global::eventStatistics.emplace(ESEventTypes::event2name.at(event), EventCounts());
+         auto [eventCounts, _] = global::eventStatistics.emplace(ESEventTypes::event2name.at(event), EventCounts());
+         // monitoring more executables than listed keeps the overestimation of the listed ones small
+         if (global::topK > 0 && !eventCounts->second.topExecutables)
+            eventCounts->second.topExecutables.emplace(4 * global::topK);
+         if (global::burstResolutionMs > 0 && !eventCounts->second.bursts)
+            eventCounts->second.bursts.emplace(global::burstResolutionMs);
       }
    }
    
@@ -588,6 +3732,27 @@ int main(int argc, char* argv[])
       });
    }
    
+   if (global::alertZ > 0)
+   {
+      dispatch_source_t alertTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, queue);
+      dispatch_source_set_timer(alertTimer, dispatch_time(DISPATCH_TIME_NOW, NSEC_PER_SEC), NSEC_PER_SEC, NSEC_PER_SEC / 10);
+      dispatch_source_set_event_handler(alertTimer, ^{
+         checkRateBaselines();
+      });
+      dispatch_resume(alertTimer);
+   }
+   
+   if (global::flightRecorder)
+   {
+      // SIGUSR1 only writes a capture file, without a report
+      signal(SIGUSR1, SIG_IGN);
+      dispatch_source_t captureSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_SIGNAL, SIGUSR1, 0, queue);
+      dispatch_source_set_event_handler(captureSource, ^{
+         dumpFlightRecorder("SIGUSR1");
+      });
+      dispatch_resume(captureSource);
+   }
+   
 #ifdef DEBUG
    // print initial row during debug to check formatting
    sigHandler();
@@ -595,6 +3760,12 @@ int main(int argc, char* argv[])
    // dispatch signal handling
    dispatch_resume(source);
    
+   if (global::command && !startCommand(commandArguments))
+   {
+      es_delete_client(client);
+      return 4;
+   }
+   
    // dispatch es client
    dispatch_main();
 